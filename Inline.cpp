@@ -17,13 +17,19 @@
 #include "NonLLVMMisc.hh"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include <vector>
 #include <string>
+#include <stdexcept>
 
 enum MODE {
   LIST_ALL,
   WHERE_IS_INLINED,
   INLINE_CLOSURE,
+  BUILD_INDEX,
+  BUILD_KERNEL_INDEX,
+  BATCH,
 };
 
 enum OUTPUT_MODE {
@@ -35,11 +41,17 @@ enum OUTPUT_MODE {
 static enum OUTPUT_MODE Output = TERMINAL;
 static enum MODE Mode = LIST_ALL;
 
+/* Whether the batch mode reads and writes newline-delimited JSON.  */
+static bool Batch_Json = false;
+
 const char *Output_Path = nullptr;
 
 static const char *Elf_Path = nullptr;
 static const char *Ipa_Path = nullptr;
 static const char *Symvers_Path = nullptr;
+static const char *Debuginfo_Cache = nullptr;
+static const char *Kernel_Index = nullptr;
+static const char *Kernel_Tree = nullptr;
 
 static std::vector<std::string> Symbols_To_Analyze;
 
@@ -51,10 +63,29 @@ static void Print_Usage(void)
 "     -ipa-files <PATH>        Path to the .ipa-clone file,\n"
 "     -debuginfo <PATH>        Path to the debuginfo file,\n"
 "     -symvers   <PATH>        Path to the Kernel Module.symvers file,\n"
+"     -debuginfo-cache <PATH>  Directory where the symbols of a compressed\n"
+"                              debuginfo file are cached,\n"
+"     -kernel-index <PATH>     Path to the index of the kernel symbols,\n"
 "     -graphviz                Output as a .dot graphviz format,\n"
 "     -csv                     Output as a .csv table format,\n"
 "     -where-is-inlined        Find where <SYMBOLS> got inlined,\n"
 "     -compute-closure         Find symbols that got inlined into <SYMBOLS>,\n"
+"     -build-index <PATH>      Write an index of the .ipa-clone files in <PATH>\n"
+"                              to the file given by -o.  The index can be\n"
+"                              given to -ipa-files or -DCE_IPACLONES_PATH and\n"
+"                              loads much faster than the .ipa-clone files,\n"
+"     -build-kernel-index <PATH>\n"
+"                              Write an index of the symbols defined by vmlinux\n"
+"                              and the .ko files of the kernel build in <PATH>\n"
+"                              to the file given by -o.  The index can be given\n"
+"                              to -kernel-index or -DCE_KERNEL_INDEX,\n"
+"     -batch                   Load the files once and answer the queries read\n"
+"                              from stdin, one per line, in the form\n"
+"                              <QUERY> <SYMBOLS>, where <QUERY> is one of\n"
+"                              where-is-inlined, closure, externalize or module,\n"
+"     -json                    With -batch, read queries as JSON objects like\n"
+"                              {\"id\": 1, \"query\": \"closure\", \"symbols\": [...]}\n"
+"                              and answer with one JSON object per line,\n"
 "     -o         <PATH>        Output to file in <PATH>.\n"
   );
   exit(0);
@@ -88,6 +119,28 @@ static void Parse(int argc, char *argv[])
         continue;
       }
 
+      if (strcmp(argv[i], "-debuginfo-cache") == 0) {
+        Debuginfo_Cache = argv[++i];
+        continue;
+      }
+
+      if (strcmp(argv[i], "-build-index") == 0) {
+        Ipa_Path = argv[++i];
+        Mode = BUILD_INDEX;
+        continue;
+      }
+
+      if (strcmp(argv[i], "-kernel-index") == 0) {
+        Kernel_Index = argv[++i];
+        continue;
+      }
+
+      if (strcmp(argv[i], "-build-kernel-index") == 0) {
+        Kernel_Tree = argv[++i];
+        Mode = BUILD_KERNEL_INDEX;
+        continue;
+      }
+
     }
 
     if (strcmp(argv[i], "-graphviz") == 0) {
@@ -110,6 +163,16 @@ static void Parse(int argc, char *argv[])
       continue;
     }
 
+    if (strcmp(argv[i], "-batch") == 0) {
+      Mode = BATCH;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-json") == 0) {
+      Batch_Json = true;
+      continue;
+    }
+
     Symbols_To_Analyze.push_back(std::string(argv[i]));
   }
 }
@@ -118,19 +181,53 @@ static void Parse(int argc, char *argv[])
 
 static int Check_Input(void)
 {
+  if (Mode == BUILD_INDEX) {
+    if (is_null_or_empty(Output_Path)) {
+      printf("ERROR: -build-index requires an output file given by -o.\n\n");
+      Print_Usage();
+      return 1;
+    }
+    return 0;
+  }
+
+  if (Mode == BUILD_KERNEL_INDEX) {
+    if (is_null_or_empty(Output_Path)) {
+      printf("ERROR: -build-kernel-index requires an output file given by -o.\n\n");
+      Print_Usage();
+      return 1;
+    }
+    return 0;
+  }
+
+  if (!is_null_or_empty(Kernel_Index)
+      && !KernelSymbolIndex::Is_Index_File(Kernel_Index)) {
+    printf("ERROR: %s is not a kernel symbol index.\n\n", Kernel_Index);
+    Print_Usage();
+    return 1;
+  }
+
+  /* In batch mode stdout is the answer to the queries.  */
+  FILE *log = (Mode == BATCH) ? stderr : stdout;
+
   if (is_null_or_empty(Ipa_Path)) {
-    printf("WARNING: No IPA files found.\n");
+    fprintf(log, "WARNING: No IPA files found.\n");
   }
 
   if (is_null_or_empty(Elf_Path)) {
-    printf("WARNING: No debuginfo file found.\n");
+    fprintf(log, "WARNING: No debuginfo file found.\n");
   }
 
   if (is_null_or_empty(Symvers_Path)) {
-    printf("WARNING: No Module.symvers file found.\n");
+    fprintf(log, "WARNING: No Module.symvers file found.\n");
   }
 
-  if (Mode != LIST_ALL) {
+  if (Batch_Json && Mode != BATCH) {
+    printf("ERROR: -json requires -batch.\n\n");
+    Print_Usage();
+    return 1;
+  }
+
+  if (Mode != LIST_ALL && Mode != BATCH) {
     if (Symbols_To_Analyze.size() == 0) {
       printf("ERROR: No symbol to analyze.\n\n");
       Print_Usage();
@@ -139,7 +236,7 @@ static int Check_Input(void)
   }
 
   if (Output == DOT) {
-    if (Mode == LIST_ALL) {
+    if (Mode == LIST_ALL || Mode == BATCH) {
       printf("ERROR: Graphviz output requires -where-is-inlined or -compute-closure\n\n");
       Print_Usage();
       return 1;
@@ -148,8 +245,9 @@ static int Check_Input(void)
 
   if (is_null_or_empty(Elf_Path) &&
       is_null_or_empty(Ipa_Path) &&
-      is_null_or_empty(Symvers_Path)) {
-      printf("ERROR: Please inform -debuginfo, -ipa-files or -symvers option.\n\n");
+      is_null_or_empty(Symvers_Path) &&
+      is_null_or_empty(Kernel_Index)) {
+      printf("ERROR: Please inform -debuginfo, -ipa-files, -symvers or -kernel-index option.\n\n");
       Print_Usage();
       return 1;
   }
@@ -194,6 +292,332 @@ static void Print_Symbol_Set(InlineAnalysis &ia, std::set<std::string> &set)
   }
 }
 
+/** A query read by the batch mode.  */
+struct Batch_Query
+{
+  /* The id given by the caller, as raw JSON, which is echoed back.  */
+  std::string Id;
+
+  std::string Query;
+
+  std::vector<std::string> Symbols;
+};
+
+/** Minimal parser of the JSON objects which the batch mode accepts, so that
+    ce-inline does not need a JSON library.  Only "id", "query" and
+    "symbols" are looked at, any other member is skipped.  */
+class Json_Query_Parser
+{
+  public:
+  Json_Query_Parser(const char *line)
+    : Str(line)
+  {}
+
+  void Parse(Batch_Query &q)
+  {
+    Expect('{');
+    if (Peek() == '}') {
+      Str++;
+      return;
+    }
+
+    do {
+      std::string key = Parse_String();
+      Expect(':');
+      if (key == "id") {
+        const char *start = Skip_Spaces();
+        Skip_Value();
+        q.Id.assign(start, Str - start);
+      } else if (key == "query") {
+        q.Query = Parse_String();
+      } else if (key == "symbols") {
+        Expect('[');
+        if (Peek() == ']') {
+          Str++;
+          continue;
+        }
+        do {
+          q.Symbols.push_back(Parse_String());
+        } while (Accept(','));
+        Expect(']');
+      } else {
+        Skip_Value();
+      }
+    } while (Accept(','));
+    Expect('}');
+
+    if (*Skip_Spaces() != '\0') {
+      throw std::runtime_error("trailing characters after the query");
+    }
+  }
+
+  private:
+  const char *Skip_Spaces(void)
+  {
+    while (*Str == ' ' || *Str == '\t' || *Str == '\r' || *Str == '\n') {
+      Str++;
+    }
+    return Str;
+  }
+
+  char Peek(void)
+  {
+    return *Skip_Spaces();
+  }
+
+  bool Accept(char c)
+  {
+    if (Peek() == c) {
+      Str++;
+      return true;
+    }
+    return false;
+  }
+
+  void Expect(char c)
+  {
+    if (!Accept(c)) {
+      throw std::runtime_error(std::string("expected '") + c + "' in query");
+    }
+  }
+
+  std::string Parse_String(void)
+  {
+    Expect('"');
+
+    std::string str;
+    while (*Str != '"') {
+      char c = *Str++;
+      if (c == '\0') {
+        throw std::runtime_error("unterminated string in query");
+      }
+      if (c == '\\') {
+        c = *Str++;
+        switch (c) {
+          case 'n': c = '\n'; break;
+          case 't': c = '\t'; break;
+          case 'r': c = '\r'; break;
+          case 'b': c = '\b'; break;
+          case 'f': c = '\f'; break;
+          case '"': case '\\': case '/': break;
+          default:
+            /* Symbol names are ASCII, so \u is not needed.  */
+            throw std::runtime_error("unsupported escape in query");
+        }
+      }
+      str.push_back(c);
+    }
+    Str++;
+
+    return str;
+  }
+
+  void Skip_Value(void)
+  {
+    char c = Peek();
+    if (c == '"') {
+      Parse_String();
+    } else if (c == '{' || c == '[') {
+      char close = (c == '{') ? '}' : ']';
+      Str++;
+      if (Accept(close)) {
+        return;
+      }
+      do {
+        if (c == '{') {
+          Parse_String();
+          Expect(':');
+        }
+        Skip_Value();
+      } while (Accept(','));
+      Expect(close);
+    } else {
+      /* Numbers, true, false and null.  */
+      const char *start = Str;
+      while (isalnum(*Str) || *Str == '-' || *Str == '+' || *Str == '.') {
+        Str++;
+      }
+      if (Str == start) {
+        throw std::runtime_error("invalid value in query");
+      }
+    }
+  }
+
+  const char *Str;
+};
+
+static void Print_Json_String(std::string_view str)
+{
+  putchar('"');
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if ((unsigned char) c < 0x20) {
+      printf("\\u%04x", (unsigned char) c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+static const char *Externalization_Type_Name(ExternalizationType type)
+{
+  switch (type) {
+    case ExternalizationType::NONE:
+      return "NONE";
+    case ExternalizationType::WEAK:
+      return "WEAK";
+    case ExternalizationType::STRONG:
+      return "STRONG";
+    case ExternalizationType::RENAME:
+      return "RENAME";
+  }
+  return "UNKNOWN";
+}
+
+/** Answer to a Batch_Query.  */
+struct Batch_Answer
+{
+  /* Whether the answer is the list Set, or a value for each symbol of the
+     query in Values.  */
+  bool Is_Set = false;
+
+  std::set<std::string> Set;
+
+  std::vector<std::string_view> Values;
+};
+
+static Batch_Answer Answer_Query(InlineAnalysis &ia, const Batch_Query &q)
+{
+  Batch_Answer answer;
+
+  if (q.Query == "where-is-inlined") {
+    answer.Set = ia.Get_Where_Symbols_Is_Inlined(q.Symbols);
+    answer.Is_Set = true;
+  } else if (q.Query == "closure") {
+    answer.Set = ia.Get_Inline_Closure_Of_Symbols(q.Symbols);
+    answer.Is_Set = true;
+  } else if (q.Query == "externalize") {
+    for (const std::string &sym : q.Symbols) {
+      answer.Values.push_back(Externalization_Type_Name(ia.Needs_Externalization(sym)));
+    }
+  } else if (q.Query == "module") {
+    for (const std::string &sym : q.Symbols) {
+      answer.Values.push_back(ia.Get_Symbol_Module(sym));
+    }
+  } else {
+    throw std::runtime_error("unknown query '" + q.Query + "'");
+  }
+
+  return answer;
+}
+
+static void Print_Answer(const Batch_Query &q, const Batch_Answer &answer)
+{
+  if (!Batch_Json) {
+    /* One symbol per line, followed by its value if any.  */
+    if (answer.Is_Set) {
+      for (const std::string &sym : answer.Set) {
+        printf("%s\n", sym.c_str());
+      }
+    } else {
+      for (size_t i = 0; i < answer.Values.size(); i++) {
+        std::string_view value = answer.Values[i];
+        printf("%s\t%.*s\n", q.Symbols[i].c_str(), (int) value.size(),
+               value.data());
+      }
+    }
+    return;
+  }
+
+  if (answer.Is_Set) {
+    printf("[");
+    const char *sep = "";
+    for (const std::string &sym : answer.Set) {
+      printf("%s", sep);
+      Print_Json_String(sym);
+      sep = ", ";
+    }
+    printf("]");
+  } else {
+    printf("{");
+    for (size_t i = 0; i < answer.Values.size(); i++) {
+      printf("%s", i ? ", " : "");
+      Print_Json_String(q.Symbols[i]);
+      printf(": ");
+      Print_Json_String(answer.Values[i]);
+    }
+    printf("}");
+  }
+}
+
+/* Answer the queries read from stdin until it is closed.  Each answer is
+   flushed right away, so the caller can wait for it before sending the next
+   query.  */
+static void Run_Batch(InlineAnalysis &ia)
+{
+  char *line = nullptr;
+  size_t n = 0;
+  ssize_t len;
+
+  while ((len = getline(&line, &n, stdin)) != -1) {
+    /* Remove the trailing newline.  */
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+
+    if (len == 0) {
+      continue;
+    }
+
+    Batch_Query q;
+    if (Batch_Json) {
+      /* The answer is only printed once it is known, so that an error does
+         not leave a broken JSON object.  */
+      printf("{");
+      try {
+        Json_Query_Parser(line).Parse(q);
+        Batch_Answer answer = Answer_Query(ia, q);
+        if (!q.Id.empty()) {
+          printf("\"id\": %s, ", q.Id.c_str());
+        }
+        printf("\"result\": ");
+        Print_Answer(q, answer);
+      } catch (std::runtime_error &err) {
+        if (!q.Id.empty()) {
+          printf("\"id\": %s, ", q.Id.c_str());
+        }
+        printf("\"error\": ");
+        Print_Json_String(err.what());
+      }
+      printf("}\n");
+    } else {
+      /* <QUERY> <SYMBOLS>, separated by blanks.  */
+      for (char *tok = strtok(line, " \t"); tok; tok = strtok(nullptr, " \t")) {
+        if (q.Query.empty()) {
+          q.Query = tok;
+        } else {
+          q.Symbols.push_back(tok);
+        }
+      }
+
+      try {
+        Print_Answer(q, Answer_Query(ia, q));
+      } catch (std::runtime_error &err) {
+        printf("ERROR: %s\n", err.what());
+      }
+
+      /* An empty line ends the answer.  */
+      printf("\n");
+    }
+
+    fflush(stdout);
+  }
+
+  free(line);
+}
+
 int main(int argc, char *argv[])
 {
   Parse(argc, argv);
@@ -202,8 +626,32 @@ int main(int argc, char *argv[])
   }
 
   try {
+    if (Mode == BUILD_INDEX) {
+      /* Only the inline graph is needed.  */
+      IpaClones ipa(Ipa_Path);
+      ipa.Write_Index(Output_Path);
+      printf("Output written to %s\n", Output_Path);
+      return 0;
+    }
+
+    if (Mode == BUILD_KERNEL_INDEX) {
+      KernelSymbolIndex::Build(Kernel_Tree, Output_Path);
+      printf("Output written to %s\n", Output_Path);
+      return 0;
+    }
 
-    InlineAnalysis ia(Elf_Path, Ipa_Path, Symvers_Path, false);
+    /* Only the externalization queries of the batch mode care whether this
+       is the kernel, which it is if we have the kernel symbols.  */
+    bool is_kernel = !is_null_or_empty(Symvers_Path)
+                     || !is_null_or_empty(Kernel_Index);
+
+    InlineAnalysis ia(Elf_Path, Ipa_Path, Symvers_Path, is_kernel,
+                      Debuginfo_Cache, Kernel_Index);
+
+    if (Mode == BATCH) {
+      Run_Batch(ia);
+      return 0;
+    }
 
     if (Mode == LIST_ALL) {
       std::set<std::string> set = ia.Get_All_Symbols();
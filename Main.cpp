@@ -16,24 +16,58 @@
 #include "ArgvParser.hh"
 #include "Passes.hh"
 #include "Error.hh"
+#include "ExtractServer.hh"
 
 #include <iostream>
+#include <string.h>
 
 using namespace llvm;
 using namespace clang;
 
 int main(int argc, char **argv)
 {
-  ArgvParser args(argc, argv);
+  try {
+    /* The server options must come first.  */
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+      return ExtractServer(argv[2]).Run();
+    }
 
-  auto func_extract_names = args.Get_Functions_To_Extract();
+    if (argc >= 3 && strcmp(argv[1], "--connect") == 0) {
+      const char *socket = argv[2];
 
-  if (func_extract_names.size() == 0) {
-    DiagsClass::Emit_Error("No function to extract.\n"
-                           "pass -DCE_EXTRACT_FUNCTIONS=func<1>,...,func<n> to determine which functions to extract.");
+      /* Send the arguments as if --connect was not given.  */
+      argv[2] = argv[0];
+      argc -= 2;
+      argv += 2;
 
+      int status;
+      if (ExtractServer::Send_Request(socket, argc, argv, status)) {
+        return status;
+      }
+
+      DiagsClass::Emit_Warn("No server listening on " + std::string(socket) +
+                            ", running without it.");
+    }
+
+    ArgvParser args(argc, argv);
+
+    if (args.Should_Print_Help()) {
+      args.Print_Usage_Message();
+      return 0;
+    }
+
+    auto func_extract_names = args.Get_Functions_To_Extract();
+
+    if (func_extract_names.size() == 0) {
+      DiagsClass::Emit_Error("No function to extract.\n"
+                             "pass -DCE_EXTRACT_FUNCTIONS=func<1>,...,func<n> to determine which functions to extract.");
+
+      return 1;
+    }
+
+    return PassManager().Run_Passes(args);
+  } catch (std::runtime_error &err) {
+    DiagsClass::Emit_Error(err.what());
     return 1;
   }
-
-  return PassManager().Run_Passes(args);
 }
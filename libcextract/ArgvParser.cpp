@@ -19,6 +19,8 @@
 
 #include <clang/Basic/Version.h>
 
+#include <stdexcept>
+
 #ifndef CLANG_VERSION_MAJOR
 # error "Unable to find clang version"
 #endif
@@ -73,13 +75,20 @@ ArgvParser::ArgvParser(int argc, char **argv)
     Kernel(false),
     Ibt(false),
     AllowLateExternalization(false),
+    ExternalizeInAST(false),
+    SkipFunctionBodies(false),
+    OpaqueTypes(false),
+    PrintHelp(false),
     PatchObject(""),
     Debuginfos(),
+    DebuginfoCachePath(nullptr),
     IpaclonesPath(nullptr),
     SymversPath(nullptr),
+    KernelIndexPath(nullptr),
     DescOutputPath(nullptr),
     IncExpansionPolicy(nullptr),
-    OutputFunctionPrototypeHeader(nullptr)
+    OutputFunctionPrototypeHeader(nullptr),
+    FingerprintPath(nullptr)
 {
   for (int i = 0; i < argc; i++) {
     if (!Handle_Clang_Extract_Arg(argv[i])) {
@@ -141,6 +150,14 @@ void ArgvParser::Print_Usage_Message(void)
 "          It should be invoked as a C compiler.\n"
 "\n"
 "USAGE: clang-extract [options] file...\n"
+"       clang-extract --serve <socket>\n"
+"       clang-extract --connect <socket> [options] file...\n"
+"\n"
+"  --serve <socket>         Stay resident and run the requests sent to <socket>,\n"
+"                           keeping the debuginfo, ipa-clones and symvers loaded and\n"
+"                           the last parsed files in memory.\n"
+"  --connect <socket>       Run through the server listening on <socket>.  Runs\n"
+"                           as usual if there is no server.\n"
 "\n"
 "CLANG-EXTRACT OPTIONS:\n"
 "   <clang-switch>          A clang switch, as specified by calling clang --help.\n"
@@ -166,13 +183,24 @@ void ArgvParser::Print_Usage_Message(void)
 "                           Path to the compiled (ELF) object of the desired program to\n"
 "                           extract.  This is used to decide if externalization is\n"
 "                           necessary or not for given symbol.\n"
+"  -DCE_DEBUGINFO_CACHE=<arg>\n"
+"                           Directory where the symbols of compressed debuginfo\n"
+"                           files are cached, so that later runs do not need to\n"
+"                           decompress them.\n"
 "  -DCE_IPACLONES_PATH=<arg>\n"
-"                           Path to .ipa-clones files generated by gcc.  Used to decide\n"
+"                           Path to .ipa-clones files generated by gcc, or to an index\n"
+"                           of them built by ce-inline -build-index.  Used to decide\n"
 "                           if desired function to extract was inlined into other\n"
 "                           functions.\n"
 "  -DCE_SYMVERS_PATH=<arg>  Path to kernel Modules.symvers file.  Only used when\n"
 "                           -D__KERNEL__ is specified.\n"
+"  -DCE_KERNEL_INDEX=<arg>  Index of the symbols of the whole kernel build, built by\n"
+"                           ce-inline -build-kernel-index.  Used to find out which\n"
+"                           module defines symbols which are not in the debuginfo.\n"
 "  -DCE_DSC_OUTPUT=<arg>    Libpulp .dsc file output, used for userspace livepatching.\n"
+"  -DCE_FINGERPRINT=<arg>   Fingerprint of the closure of the output, kept in <arg>.\n"
+"                           If it did not change and the output exists, nothing\n"
+"                           is extracted.  Otherwise what changed is reported.\n"
 "  -DCE_OUTPUT_FUNCTION_PROTOTYPE_HEADER=<arg>\n"
 "                           Outputs a header file with a foward declaration of all\n"
 "                           functions. This header is not self-compilable.\n"
@@ -181,6 +209,16 @@ void ArgvParser::Print_Usage_Message(void)
 "                           -DCE_KEEP_INCLUDES is enabled\n"
 "  -DCE_IGNORE_CLANG_ERRORS Ignore clang compilation errors in a hope that code is\n"
 "                           generated even if it won't compile.\n"
+"  -DCE_EXTERNALIZE_IN_AST  Apply the externalization changes when printing the code\n"
+"                           rather than parsing the source code again with them.\n"
+"                           Only the output is parsed, to verify it.\n"
+"  -DCE_SKIP_FUNCTION_BODIES\n"
+"                           Only parse the bodies of the functions which are\n"
+"                           extracted.  Errors in the other functions are not\n"
+"                           reported.\n"
+"  -DCE_OPAQUE_TYPES        Do not output what is only needed by the definitions of\n"
+"                           structs and unions that are only used through pointers,\n"
+"                           which are output as forward declarations.\n"
 "\n";
 
   llvm::outs() << "The following arguments are ignored by clang-extract:\n";
@@ -270,6 +308,11 @@ bool ArgvParser::Handle_Clang_Extract_Arg(const char *str)
 
     return true;
   }
+  if (prefix("-DCE_DEBUGINFO_CACHE=", str)) {
+    DebuginfoCachePath = Extract_Single_Arg_C(str);
+
+    return true;
+  }
   if (prefix("-DCE_IPACLONES_PATH=", str)) {
     IpaclonesPath = Extract_Single_Arg_C(str);
 
@@ -280,6 +323,16 @@ bool ArgvParser::Handle_Clang_Extract_Arg(const char *str)
 
     return true;
   }
+  if (prefix("-DCE_KERNEL_INDEX=", str)) {
+    KernelIndexPath = Extract_Single_Arg_C(str);
+
+    return true;
+  }
+  if (prefix("-DCE_FINGERPRINT=", str)) {
+    FingerprintPath = Extract_Single_Arg_C(str);
+
+    return true;
+  }
   if (prefix("-DCE_DSC_OUTPUT=", str)) {
     DescOutputPath = Extract_Single_Arg_C(str);
 
@@ -305,14 +358,29 @@ bool ArgvParser::Handle_Clang_Extract_Arg(const char *str)
 
     return true;
   }
+  if (!strcmp("-DCE_EXTERNALIZE_IN_AST", str)) {
+    ExternalizeInAST = true;
+
+    return true;
+  }
+  if (!strcmp("-DCE_SKIP_FUNCTION_BODIES", str)) {
+    SkipFunctionBodies = true;
+
+    return true;
+  }
+  if (!strcmp("-DCE_OPAQUE_TYPES", str)) {
+    OpaqueTypes = true;
+
+    return true;
+  }
 
   if (!strcmp("--help", str)) {
-    Print_Usage_Message();
-    exit(0);
+    PrintHelp = true;
+
+    return true;
   }
   if (prefix("-DCE_", str)) {
-    DiagsClass::Emit_Error("Unrecognized command-line option: " + std::string(str));
-    exit(1);
+    throw std::runtime_error("Unrecognized command-line option: " + std::string(str));
   }
 
   return false;
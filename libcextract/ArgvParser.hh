@@ -104,6 +104,11 @@ class ArgvParser
     return Debuginfos;
   }
 
+  inline const char *Get_Debuginfo_Cache_Path(void)
+  {
+    return DebuginfoCachePath;
+  }
+
   inline const char *Get_Ipaclones_Path(void)
   {
     return IpaclonesPath;
@@ -114,11 +119,21 @@ class ArgvParser
     return SymversPath;
   }
 
+  inline const char *Get_Kernel_Index_Path(void)
+  {
+    return KernelIndexPath;
+  }
+
   inline const char *Get_Dsc_Output_Path(void)
   {
     return DescOutputPath;
   }
 
+  inline const char *Get_Fingerprint_Path(void)
+  {
+    return FingerprintPath;
+  }
+
   inline bool Should_Rename_Symbols(void)
   {
     return RenameSymbols;
@@ -144,6 +159,27 @@ class ArgvParser
     return IgnoreClangErrors;
   }
 
+  inline bool Should_Externalize_In_AST(void)
+  {
+    return ExternalizeInAST;
+  }
+
+  inline bool Should_Skip_Function_Bodies(void)
+  {
+    return SkipFunctionBodies;
+  }
+
+  inline bool Should_Use_Opaque_Types(void)
+  {
+    return OpaqueTypes;
+  }
+
+  /** Check if --help was given.  */
+  inline bool Should_Print_Help(void)
+  {
+    return PrintHelp;
+  }
+
   /** Print help usage message.  */
   void Print_Usage_Message(void);
 
@@ -171,16 +207,33 @@ class ArgvParser
   /* If set, then clang-extract may write the externalized decl later than the
      original code.  */
   bool AllowLateExternalization;
+
+  /* If set, then the externalization changes are applied when printing the
+     AST instead of reparsing the source code with them.  */
+  bool ExternalizeInAST;
+
+  /* If set, then the bodies of the functions which are not in the closure
+     are not parsed.  */
+  bool SkipFunctionBodies;
+
+  /* If set, then the closure does not go into the fields of the records
+     which are output as forward declarations.  */
+  bool OpaqueTypes;
+  bool PrintHelp;
   std::string PatchObject;
 
   std::vector<std::string> Debuginfos;
+  const char *DebuginfoCachePath;
 
   const char *IpaclonesPath;
   const char *SymversPath;
+  const char *KernelIndexPath;
 
   const char *DescOutputPath;
 
   const char *IncExpansionPolicy;
 
   const char *OutputFunctionPrototypeHeader;
+
+  const char *FingerprintPath;
 };
@@ -0,0 +1,266 @@
+//===- CachingFileSystem.cpp - Cache the real filesystem between parses *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Cache the status and contents of the files of the real filesystem between
+/// the parses of a run and across runs.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CachingFileSystem.hh"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+using namespace llvm;
+
+/** Buffer sharing the contents cached by the CachingFileSystem.  */
+class SharedMemoryBuffer : public MemoryBuffer
+{
+  public:
+  SharedMemoryBuffer(std::shared_ptr<MemoryBuffer> buffer, const Twine &name)
+    : Buffer(std::move(buffer)),
+      Name(name.str())
+  {
+    init(Buffer->getBufferStart(), Buffer->getBufferEnd(),
+         /*RequiresNullTerminator=*/true);
+  }
+
+  StringRef getBufferIdentifier(void) const override
+  {
+    return Name;
+  }
+
+  BufferKind getBufferKind(void) const override
+  {
+    return MemoryBuffer_Malloc;
+  }
+
+  private:
+  std::shared_ptr<MemoryBuffer> Buffer;
+  std::string Name;
+};
+
+/** File of the CachingFileSystem.  Its contents are only read when asked,
+    as clang also opens files to get their status.  */
+class CachingFile : public vfs::File
+{
+  public:
+  CachingFile(CachingFileSystem &fs, std::string path, vfs::Status stat)
+    : FS(fs),
+      Path(std::move(path)),
+      Stat(std::move(stat))
+  {
+  }
+
+  ErrorOr<vfs::Status> status(void) override
+  {
+    return Stat;
+  }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> getBuffer(const Twine &name,
+                                                   int64_t, bool,
+                                                   bool) override
+  {
+    auto contents = FS.Get_Contents(Path, Stat);
+    if (!contents) {
+      return contents.getError();
+    }
+
+    return std::unique_ptr<MemoryBuffer>(
+             new SharedMemoryBuffer(std::move(*contents), name));
+  }
+
+  std::error_code close(void) override
+  {
+    return std::error_code();
+  }
+
+  private:
+  CachingFileSystem &FS;
+
+  /* Absolute path of the file.  */
+  std::string Path;
+
+  vfs::Status Stat;
+};
+
+CachingFileSystem::CachingFileSystem(void)
+  : RealFS(vfs::getRealFileSystem()),
+    Generation(0)
+{
+  Invalidate_Status();
+}
+
+IntrusiveRefCntPtr<CachingFileSystem> CachingFileSystem::Get_Instance(void)
+{
+  static IntrusiveRefCntPtr<CachingFileSystem> instance(new CachingFileSystem);
+  return instance;
+}
+
+void CachingFileSystem::Invalidate_Status(void)
+{
+  Generation++;
+  Statuses.clear();
+
+  /* Don't keep the files of translation units which are not extracted
+     anymore forever.  */
+  for (auto it = Contents.begin(); it != Contents.end(); ) {
+    if (Generation - it->second.Generation > MAX_UNUSED_GENERATIONS) {
+      it = Contents.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  /* The process may have changed its directory since.  */
+  ErrorOr<std::string> cwd = RealFS->getCurrentWorkingDirectory();
+  Cwd = cwd ? *cwd : "";
+}
+
+std::string CachingFileSystem::Get_Absolute_Path(const Twine &path)
+{
+  SmallString<256> abs;
+  path.toVector(abs);
+
+  if (!Cwd.empty()) {
+    sys::fs::make_absolute(Cwd, abs);
+  }
+  sys::path::remove_dots(abs, /*remove_dot_dot=*/false);
+
+  return std::string(abs.str());
+}
+
+bool CachingFileSystem::Is_Same_Version(const vfs::Status &a,
+                                        const vfs::Status &b)
+{
+  return a.getUniqueID() == b.getUniqueID() &&
+         a.getLastModificationTime() == b.getLastModificationTime() &&
+         a.getSize() == b.getSize();
+}
+
+ErrorOr<vfs::Status> CachingFileSystem::Get_Status(const std::string &path)
+{
+  auto it = Statuses.find(path);
+  if (it == Statuses.end()) {
+    ErrorOr<vfs::Status> stat = RealFS->status(path);
+
+    StatusEntry &entry = Statuses[path];
+    entry.Error = stat.getError();
+    entry.Status = stat ? *stat : vfs::Status();
+
+    /* Drop the contents of a file which changed or is gone, rather than
+       waiting for them to be read again.  */
+    auto contents = Contents.find(path);
+    if (contents != Contents.end()
+        && (!stat || !Is_Same_Version(contents->second.Status, *stat))) {
+      Contents.erase(contents);
+    }
+
+    return stat;
+  }
+
+  if (it->second.Error) {
+    return it->second.Error;
+  }
+
+  return it->second.Status;
+}
+
+ErrorOr<vfs::Status> CachingFileSystem::status(const Twine &path)
+{
+  ErrorOr<vfs::Status> stat = Get_Status(Get_Absolute_Path(path));
+  if (!stat) {
+    return stat;
+  }
+
+  /* Clang expects the status to be named after the path it asked for.  */
+  return vfs::Status::copyWithNewName(*stat, path);
+}
+
+ErrorOr<std::unique_ptr<vfs::File>>
+CachingFileSystem::openFileForRead(const Twine &path)
+{
+  std::string abs = Get_Absolute_Path(path);
+  ErrorOr<vfs::Status> stat = Get_Status(abs);
+  if (!stat) {
+    return stat.getError();
+  }
+
+  if (stat->isDirectory()) {
+    return std::make_error_code(std::errc::is_a_directory);
+  }
+
+  return std::unique_ptr<vfs::File>(
+           new CachingFile(*this, abs, vfs::Status::copyWithNewName(*stat, path)));
+}
+
+ErrorOr<std::shared_ptr<MemoryBuffer>>
+CachingFileSystem::Get_Contents(const std::string &path, const vfs::Status &stat)
+{
+  auto it = Contents.find(path);
+  if (it != Contents.end() && Is_Same_Version(it->second.Status, stat)) {
+    it->second.Generation = Generation;
+    return it->second.Buffer;
+  }
+
+  auto file = RealFS->openFileForRead(path);
+  if (!file) {
+    return file.getError();
+  }
+
+  /* Read the file rather than mapping it, as a mapping would see the changes
+     to the file while the contents are cached.  */
+  auto buffer = (*file)->getBuffer(path, stat.getSize(),
+                                   /*RequiresNullTerminator=*/true,
+                                   /*IsVolatile=*/true);
+  (*file)->close();
+  if (!buffer) {
+    return buffer.getError();
+  }
+
+  ContentsEntry &entry = Contents[path];
+  entry.Status = stat;
+  entry.Generation = Generation;
+  entry.Buffer = std::shared_ptr<MemoryBuffer>(std::move(*buffer));
+
+  return entry.Buffer;
+}
+
+vfs::directory_iterator CachingFileSystem::dir_begin(const Twine &dir,
+                                                     std::error_code &ec)
+{
+  return RealFS->dir_begin(dir, ec);
+}
+
+ErrorOr<std::string> CachingFileSystem::getCurrentWorkingDirectory(void) const
+{
+  return RealFS->getCurrentWorkingDirectory();
+}
+
+std::error_code CachingFileSystem::setCurrentWorkingDirectory(const Twine &path)
+{
+  std::error_code ec = RealFS->setCurrentWorkingDirectory(path);
+  if (!ec) {
+    ErrorOr<std::string> cwd = RealFS->getCurrentWorkingDirectory();
+    Cwd = cwd ? *cwd : "";
+  }
+
+  return ec;
+}
+
+std::error_code CachingFileSystem::getRealPath(const Twine &path,
+                                               SmallVectorImpl<char> &output) const
+{
+  return RealFS->getRealPath(path, output);
+}
+
+std::error_code CachingFileSystem::isLocal(const Twine &path, bool &result)
+{
+  return RealFS->isLocal(path, result);
+}
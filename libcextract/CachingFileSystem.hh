@@ -0,0 +1,124 @@
+//===- CachingFileSystem.hh - Cache the real filesystem between parses *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Cache the status and contents of the files of the real filesystem between
+/// the parses of a run and across runs.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/** @brief The real filesystem, with the status and contents of its files
+ *  cached.
+ *
+ * The translation unit is parsed several times in a run, and every parse
+ * looks up and reads the same few thousand headers again.  This filesystem
+ * sits below the overlays of the passes, and is shared by every parse of the
+ * process, so that:
+ *
+ *   - the status of a path, including that it does not exist, is only asked
+ *     to the real filesystem once per run.  See Invalidate_Status.
+ *   - the contents of a file are only read again if its status changed since
+ *     they were read.  The contents of files which changed, or which were
+ *     not used by the last few runs, are dropped.
+ *
+ * Directories and real paths are not cached.
+ */
+class CachingFileSystem : public llvm::vfs::FileSystem
+{
+  public:
+  /** Get the filesystem shared by the whole process.  */
+  static llvm::IntrusiveRefCntPtr<CachingFileSystem> Get_Instance(void);
+
+  /** Forget the status of every path, so that it is asked again to the real
+      filesystem.  Must be called when the files may have changed, e.g. at
+      the start of each run.  The contents are kept, and are reused if the
+      status of their files did not change, unless they were not used since
+      MAX_UNUSED_GENERATIONS calls.  */
+  void Invalidate_Status(void);
+
+  llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &path) override;
+
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+  openFileForRead(const llvm::Twine &path) override;
+
+  llvm::vfs::directory_iterator dir_begin(const llvm::Twine &dir,
+                                          std::error_code &ec) override;
+
+  llvm::ErrorOr<std::string> getCurrentWorkingDirectory(void) const override;
+
+  std::error_code setCurrentWorkingDirectory(const llvm::Twine &path) override;
+
+  std::error_code getRealPath(const llvm::Twine &path,
+                              llvm::SmallVectorImpl<char> &output) const override;
+
+  std::error_code isLocal(const llvm::Twine &path, bool &result) override;
+
+  /** Get the contents of the file at the absolute path `path`, whose status
+      is `stat`.  */
+  llvm::ErrorOr<std::shared_ptr<llvm::MemoryBuffer>>
+  Get_Contents(const std::string &path, const llvm::vfs::Status &stat);
+
+  private:
+  CachingFileSystem(void);
+
+  /** Get `path` relative to the current working directory as an absolute
+      path, which is what the caches are keyed on.  */
+  std::string Get_Absolute_Path(const llvm::Twine &path);
+
+  /** Get the status of the absolute path `path`.  */
+  llvm::ErrorOr<llvm::vfs::Status> Get_Status(const std::string &path);
+
+  /** Check if `a` and `b` are the status of the same version of a file.  */
+  static bool Is_Same_Version(const llvm::vfs::Status &a,
+                              const llvm::vfs::Status &b);
+
+  struct StatusEntry
+  {
+    /* The error on asking the status, if any.  */
+    std::error_code Error;
+
+    llvm::vfs::Status Status;
+  };
+
+  struct ContentsEntry
+  {
+    /* Status of the file when the contents were read.  */
+    llvm::vfs::Status Status;
+
+    /* Value of Generation when the contents were last used.  */
+    unsigned Generation;
+
+    /* Shared with the buffers given to the parses, which may outlive the
+       entry if the file changes.  */
+    std::shared_ptr<llvm::MemoryBuffer> Buffer;
+  };
+
+  /** The real filesystem.  */
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> RealFS;
+
+  /** Current working directory, as the relative paths are resolved.  */
+  std::string Cwd;
+
+  /** Incremented by Invalidate_Status.  */
+  unsigned Generation;
+
+  /** Contents not used for this many generations are dropped.  */
+  static const unsigned MAX_UNUSED_GENERATIONS = 8;
+
+  std::unordered_map<std::string, StatusEntry> Statuses;
+  std::unordered_map<std::string, ContentsEntry> Contents;
+};
@@ -88,11 +88,38 @@ bool DeclClosureVisitor::TraverseDecl(Decl *decl)
   DO_NOT_RUN_IF_ALREADY_ANALYZED(decl);
   Mark_As_Analyzed(decl);
   Stack.push_back(decl);
-  bool ret = RecursiveASTVisitor::TraverseDecl(decl);
+
+  bool ret;
+  RecordDecl *record = dyn_cast_or_null<RecordDecl>(decl);
+  if (record && Is_Opaque_Record(record)) {
+    /* Only visit the record itself and not its fields.  */
+    OpaqueRecords.insert(record);
+    ret = WalkUpFromRecordDecl(record);
+  } else {
+    ret = RecursiveASTVisitor::TraverseDecl(decl);
+  }
+
   Stack.pop_back();
   return ret;
 }
 
+bool DeclClosureVisitor::Is_Opaque_Record(RecordDecl *decl)
+{
+  /* PrettyPrint outputs only a forward declaration of structs and unions
+     which clang did not require to be complete, i.e. that were never
+     accessed, copied or had their size taken.  This can only be done with
+     records that are declared by themselves, and not as part of a typedef,
+     of a variable or of another record.  */
+  return OpaqueTypes &&
+         !isa<CXXRecordDecl>(decl) &&
+         decl->isThisDeclarationADefinition() &&
+         !decl->isCompleteDefinitionRequired() &&
+         !decl->getName().empty() &&
+         decl->isFreeStanding() &&
+         !decl->isEmbeddedInDeclarator() &&
+         decl->getLexicalDeclContext()->isFileContext();
+}
+
 bool DeclClosureVisitor::VisitFunctionDecl(FunctionDecl *decl)
 {
   if (decl->getBuiltinID() != 0) {
@@ -124,7 +151,7 @@ bool DeclClosureVisitor::VisitFunctionDecl(FunctionDecl *decl)
   const clang::Type *ret_type = to_mark->getReturnType().getTypePtr();
   if (ret_type->isRecordType()) {
     if (TagDecl *tag = ret_type->getAsTagDecl()) {
-      tag->setCompleteDefinitionRequired(true);
+      TRY_TO(RequireCompleteDefinitionHelper(tag));
     }
   }
 
@@ -423,7 +450,7 @@ bool DeclClosureVisitor::VisitUnaryOperator(const UnaryOperator *expr)
    */
   const clang::Type *type = expr->getType().getTypePtr();
   if (TagDecl *tag = type->getAsTagDecl()) {
-    tag->setCompleteDefinitionRequired(true);
+    TRY_TO(RequireCompleteDefinitionHelper(tag));
   }
 
   return VISITOR_CONTINUE;
@@ -496,7 +523,7 @@ bool DeclClosureVisitor::ParentRecordDeclHelper(TagDecl *decl)
        then we need to set it to true, else the nested struct won't be
        output as of only a partial definition of the parent struct is
        output. */
-    parent->setCompleteDefinitionRequired(true);
+    TRY_TO(RequireCompleteDefinitionHelper(parent));
 
     /* Analyze parent struct.  */
     TRY_TO(TraverseDecl(parent));
@@ -505,10 +532,26 @@ bool DeclClosureVisitor::ParentRecordDeclHelper(TagDecl *decl)
   return VISITOR_CONTINUE;
 }
 
+bool DeclClosureVisitor::RequireCompleteDefinitionHelper(TagDecl *decl)
+{
+  decl->setCompleteDefinitionRequired(true);
+
+  /* In case the record was analyzed as opaque, its fields are needed now.  */
+  RecordDecl *record = dyn_cast<RecordDecl>(decl);
+  if (record && OpaqueRecords.erase(record)) {
+    Stack.push_back(record);
+    bool ret = RecursiveASTVisitor::TraverseDecl(record);
+    Stack.pop_back();
+    return ret;
+  }
+
+  return VISITOR_CONTINUE;
+}
+
 bool DeclClosureVisitor::AnalyzeDeclsWithSameBeginlocHelper(Decl *decl)
 {
   SourceManager &SM = AST->getSourceManager();
-  ArrayRef<Decl *> decls = Get_Toplev_Decls_With_Same_Beginloc(AST,
+  ArrayRef<Decl *> decls = DeclIndex.Get_Decls_With_Same_Beginloc(
                            SM.getExpansionLoc(decl->getBeginLoc()));
 
   for (auto it = decls.begin(); it != decls.end(); ++it) {
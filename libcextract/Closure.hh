@@ -23,6 +23,7 @@
 
 #include "LLVMMisc.hh"
 #include "PrettyPrint.hh"
+#include "TranslationUnitOrder.hh"
 
 using namespace clang;
 
@@ -138,11 +139,14 @@ class ClosureSet
 class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
 {
   public:
-  DeclClosureVisitor(ASTUnit *ast)
+  DeclClosureVisitor(ASTUnit *ast, bool opaque_types = false)
     : RecursiveASTVisitor(),
       AST(ast),
+      DeclIndex(ast),
       Closure(),
       AnalyzedDecls(),
+      OpaqueTypes(opaque_types),
+      OpaqueRecords(),
       Stack()
   {
   }
@@ -247,6 +251,12 @@ class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
 
   bool AnalyzePreviousDecls(Decl *decl);
 
+  bool RequireCompleteDefinitionHelper(TagDecl *decl);
+
+  /** Check if only a forward declaration of `decl` will be output, in which
+      case the types of its fields are not needed.  */
+  bool Is_Opaque_Record(RecordDecl *decl);
+
   ClosureSet &Get_Closure(void)
   {
     return Closure;
@@ -257,6 +267,12 @@ class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
     return Closure;
   }
 
+  /** Index of the toplevel decls of the AST by location.  */
+  TopLevelDeclIndex &Get_Toplevel_Decl_Index(void)
+  {
+    return DeclIndex;
+  }
+
   void Compute_Closure_Of_Symbols(const std::vector<std::string> &names,
                                  std::unordered_set<std::string> *matched_names = nullptr);
 
@@ -265,6 +281,9 @@ class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
   /** The ASTUnit object.  */
   ASTUnit *AST;
 
+  /** Index of the toplevel decls of AST by location.  */
+  TopLevelDeclIndex DeclIndex;
+
   /** Datastructure holding all Decls required for the functions. This is
       then used to mark which Decls we need to output.
 
@@ -275,6 +294,14 @@ class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
   /** The set of all analyzed Decls.  */
   std::unordered_set<Decl *> AnalyzedDecls;
 
+  /** Should records which are not required to be complete be analyzed
+      without their fields?  */
+  bool OpaqueTypes;
+
+  /** Records analyzed without their fields, which must be analyzed again if
+      they turn out to be required complete.  */
+  std::unordered_set<RecordDecl *> OpaqueRecords;
+
   /** Stack of Decls.  Implement using a vector because we may need to access
       the second element on the top, and we also need its continuity.  */
   llvm::SmallVector<Decl *, 128> Stack;
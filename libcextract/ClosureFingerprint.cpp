@@ -0,0 +1,254 @@
+//===- ClosureFingerprint.cpp - Fingerprint of the closure of an extraction *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Fingerprint of what the output of an extraction depends on.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ClosureFingerprint.hh"
+#include "MacroWalker.hh"
+#include "PrettyPrint.hh"
+#include "TopLevelASTIterator.hh"
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+/** First line of the stored fingerprint.  Bump the version when what goes
+    into the members changes, so that older fingerprints never match.  */
+#define FINGERPRINT_HEADER "clang-extract closure fingerprint 2"
+
+ClosureFingerprint::ClosureFingerprint(ASTUnit *ast,
+                                       const std::unordered_set<Decl *> &closure,
+                                       IncludeTree &include_tree,
+                                       bool keep_includes,
+                                       InlineAnalysis &ia)
+{
+  /* Entities are visited in the order RecursivePrint outputs them, so that
+     the hash of a member with several parts, e.g. a prototype and its
+     definition, is stable.  The members are also recorded in this order, as
+     moving a decl or a #undef changes the output even if no member did.
+     Anonymous decls are named by their order.  */
+  std::map<std::string, unsigned> anonymous;
+  std::string order;
+
+  /* Whether `loc` is in an #include that is kept, hence not output.  */
+  auto in_kept_include = [&](const SourceLocation &loc) {
+    if (!keep_includes) {
+      return false;
+    }
+    IncludeNode *include = include_tree.Get(loc);
+    return include && include->Should_Be_Expanded() == false;
+  };
+
+  auto add = [&](const std::string &key, StringRef text) {
+    Add_Member(key, text);
+    order += key + '\n';
+  };
+
+  Preprocessor &pp = ast->getPreprocessor();
+  MacroWalker mw(pp);
+  TopLevelASTIterator it(ast, /*skip_macros_in_decl=*/false);
+
+  while (!it.End()) {
+    switch ((*it).Type) {
+      case TopLevelASTIterator::ReturnType::TYPE_INVALID:
+        assert(0 && "Invalid type in ASTIterator.");
+        break;
+
+      case TopLevelASTIterator::ReturnType::TYPE_DECL: {
+        Decl *decl = (*it).AsDecl;
+        ++it;
+        it.Skip_Until(decl->getEndLoc());
+
+        if (closure.find(decl) == closure.end()
+            || in_kept_include(decl->getLocation())) {
+          break;
+        }
+
+        std::string key = decl->getDeclKindName();
+        std::string name;
+        if (NamedDecl *ndecl = dyn_cast<NamedDecl>(decl)) {
+          name = ndecl->getNameAsString();
+        }
+
+        if (name.empty()) {
+          key += " <anonymous " + std::to_string(anonymous[key]++) + ">";
+        } else {
+          key += " " + name;
+        }
+
+        std::string text = PrettyPrint::Get_Source_Text(decl->getSourceRange()).str();
+        if (text.empty()) {
+          /* No source text, e.g. it comes from a macro expansion.  */
+          llvm::raw_string_ostream out(text);
+          decl->print(out);
+        }
+
+        /* Whether symbols are externalized is decided later, but only from
+           the debuginfo, the ipa-clones and the symvers.  */
+        VarDecl *vdecl = dyn_cast<VarDecl>(decl);
+        if (!name.empty() &&
+            (isa<FunctionDecl>(decl) || (vdecl && vdecl->hasGlobalStorage()))) {
+          ExternalizationType type = ia.Needs_Externalization(name);
+          text += "\nexternalization: " + std::to_string((int) type);
+          if (type != ExternalizationType::NONE) {
+            text += " " + std::string(ia.Get_Symbol_Module(name));
+          }
+        }
+
+        add(key, text);
+        break;
+      }
+
+      case TopLevelASTIterator::ReturnType::TYPE_PREPROCESSED_ENTITY: {
+        PreprocessedEntity *entity = (*it).AsPrep;
+        ++it;
+
+        if (MacroDefinitionRecord *def = dyn_cast<MacroDefinitionRecord>(entity)) {
+          MacroInfo *info = mw.Get_Macro_Info(def);
+          if (info == nullptr || !info->isUsed() || mw.Is_Builtin_Macro(info)
+              || in_kept_include(def->getLocation())) {
+            break;
+          }
+
+          add("macro " + def->getName()->getName().str(),
+              PrettyPrint::Get_Source_Text(def->getSourceRange()));
+        } else if (InclusionDirective *inc = dyn_cast<InclusionDirective>(entity)) {
+          IncludeNode *node = keep_includes ? include_tree.Get(inc) : nullptr;
+          if (node && node->Should_Be_Output()) {
+            add("include " + inc->getFileName().str(),
+                PrettyPrint::Get_Source_Text(inc->getSourceRange()));
+          }
+        }
+        break;
+      }
+
+      case TopLevelASTIterator::ReturnType::TYPE_MACRO_UNDEF: {
+        MacroDirective *directive = (*it).AsUndef;
+        ++it;
+
+        /* Same conditions as RecursivePrint::Print_Macro_Undef.  */
+        SourceLocation undef_loc = directive->getDefinition().getUndefLocation();
+        MacroInfo *info = directive->getMacroInfo();
+        if (undef_loc.isInvalid() || info == nullptr || !info->isUsed()) {
+          break;
+        }
+        if (keep_includes) {
+          IncludeNode *node = include_tree.Get(undef_loc);
+          if (node == nullptr || !node->Should_Be_Expanded()) {
+            break;
+          }
+        }
+
+        StringRef name = PrettyPrint::Get_Source_Text(undef_loc);
+        add("undef " + name.str(), name);
+        break;
+      }
+    }
+  }
+
+  Add_Member("order", order);
+}
+
+void ClosureFingerprint::Add_Member(const std::string &key, StringRef text)
+{
+  uint64_t hash = llvm::xxHash64(text);
+
+  auto it = Members.find(key);
+  if (it == Members.end()) {
+    Members[key] = hash;
+  } else {
+    /* Mix in the order the parts were added.  */
+    it->second = (it->second * 0x100000001b3ULL) ^ hash;
+  }
+}
+
+bool ClosureFingerprint::Load(const char *path)
+{
+  auto buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/true);
+  if (!buffer) {
+    return false;
+  }
+
+  StringRef contents = (*buffer)->getBuffer();
+  StringRef line;
+  std::tie(line, contents) = contents.split('\n');
+  if (line != FINGERPRINT_HEADER) {
+    return false;
+  }
+
+  Members.clear();
+  while (!contents.empty()) {
+    std::tie(line, contents) = contents.split('\n');
+    if (line.empty()) {
+      continue;
+    }
+
+    /* Each line is the hash followed by the name of the member.  */
+    StringRef hash_text, key;
+    std::tie(hash_text, key) = line.split(' ');
+
+    uint64_t hash;
+    if (key.empty() || hash_text.getAsInteger(16, hash)) {
+      Members.clear();
+      return false;
+    }
+
+    Members[key.str()] = hash;
+  }
+
+  return true;
+}
+
+bool ClosureFingerprint::Save(const char *path) const
+{
+  std::error_code ec;
+  llvm::raw_fd_ostream out(path, ec);
+  if (ec) {
+    return false;
+  }
+
+  out << FINGERPRINT_HEADER << '\n';
+  for (const auto &[key, hash] : Members) {
+    out << llvm::format_hex_no_prefix(hash, 16) << ' ' << key << '\n';
+  }
+
+  out.close();
+  return !out.has_error();
+}
+
+std::vector<std::string>
+ClosureFingerprint::Get_Differences(const ClosureFingerprint &old) const
+{
+  std::vector<std::string> differences;
+
+  /* Walk both sorted maps at once.  */
+  auto it = Members.begin();
+  auto old_it = old.Members.begin();
+  while (it != Members.end() || old_it != old.Members.end()) {
+    if (old_it == old.Members.end() ||
+        (it != Members.end() && it->first < old_it->first)) {
+      differences.push_back("added " + it->first);
+      ++it;
+    } else if (it == Members.end() || old_it->first < it->first) {
+      differences.push_back("removed " + old_it->first);
+      ++old_it;
+    } else {
+      if (it->second != old_it->second) {
+        differences.push_back("changed " + it->first);
+      }
+      ++it;
+      ++old_it;
+    }
+  }
+
+  return differences;
+}
@@ -0,0 +1,71 @@
+//===- ClosureFingerprint.hh - Fingerprint of the closure of an extraction *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Fingerprint of what the output of an extraction depends on.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "IncludeTree.hh"
+#include "InlineAnalysis.hh"
+
+#include "clang/Frontend/ASTUnit.h"
+
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace clang;
+
+/** @brief Fingerprint of the closure of an extraction.
+ *
+ * Livepatches extract the same functions from many revisions of a program,
+ * e.g. from every kernel codestream, which mostly give the same output.  The
+ * fingerprint holds a hash of the source text of every decl, macro, #undef
+ * and #include in the closure, together with whether it must be externalized,
+ * of the order in which they are output, and of the options of the
+ * extraction.  A run which finds the same fingerprint
+ * as the one of the previous output only computes the closure, and the ones
+ * which do not tell which members of the closure changed.
+ *
+ * The fingerprint is stored as text, one member per line.
+ */
+class ClosureFingerprint
+{
+  public:
+  /** Empty fingerprint, to be loaded.  */
+  ClosureFingerprint(void) = default;
+
+  /** Fingerprint of the decls in `closure` and of the macros, #undefs and
+      #includes that are output with them.  `ia` gives the externalization decisions
+      of the symbols.  */
+  ClosureFingerprint(ASTUnit *ast, const std::unordered_set<Decl *> &closure,
+                     IncludeTree &include_tree, bool keep_includes,
+                     InlineAnalysis &ia);
+
+  /** Add `text` to the member named `key`.  */
+  void Add_Member(const std::string &key, StringRef text);
+
+  /** Load the fingerprint stored at `path`.  Returns false if there is no
+      valid fingerprint there.  */
+  bool Load(const char *path);
+
+  /** Store the fingerprint at `path`.  */
+  bool Save(const char *path) const;
+
+  /** Get the members which changed from `old`, each one prefixed with
+      whether it was added, removed or changed.  */
+  std::vector<std::string> Get_Differences(const ClosureFingerprint &old) const;
+
+  private:
+  /** Hash of each member, sorted by name so the stored file is stable.  */
+  std::map<std::string, uint64_t> Members;
+};
@@ -125,7 +125,7 @@ void DscFileGenerator::Local_Symbols(void)
       }
       Out << "\n#" << Get_TLS_Token(Is_TLS(decls)) << entry.OldName << ":" <<
 	     entry.NewName;
-      std::string mod = IA.Get_Symbol_Module(entry.OldName);
+      std::string_view mod = IA.Get_Symbol_Module(entry.OldName);
       if (!mod.empty())
         Out << ":" << mod;
     }
@@ -15,12 +15,21 @@
 
 #include "ElfCXX.hh"
 #include "NonLLVMMisc.hh"
+#include "StringTable.hh"
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdexcept>
 #include <iostream>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include <zlib.h>
 #include <zstd.h>
@@ -84,10 +93,13 @@ ElfObject::ElfObject(const char *path)
   : Parser(path),
     ElfObj(nullptr),
     DecompressedObj(nullptr),
+    DecompressedSize(0),
     ElfFd(-1)
 {
-  /* Libelf quirks.  If not present it fails to load current Linux binaries.  */
-  elf_version(EV_CURRENT);
+  /* Libelf quirks.  If not present it fails to load current Linux binaries.
+     Objects may be opened from many threads, so only do it once.  */
+  static const unsigned version = elf_version(EV_CURRENT);
+  (void) version;
 
   /* Open using Unix File Descriptor, as required by libelf.  */
   ElfFd = open(parser_path.c_str(), O_RDONLY);
@@ -99,8 +111,9 @@ ElfObject::ElfObject(const char *path)
 
   switch (ft) {
   case FileHandling::FILE_TYPE_ELF: {
-    /* Create libelf object and store it in the class variable.  */
-    ElfObj = elf_begin(ElfFd, ELF_C_READ, nullptr);
+    /* Create libelf object and store it in the class variable.  Map the file
+       rather than reading it, as only a few parts of it are ever used.  */
+    ElfObj = elf_begin(ElfFd, ELF_C_READ_MMAP, nullptr);
     if (ElfObj == nullptr) {
       close(ElfFd);
       throw std::runtime_error("libelf error on file " + parser_path + ": "
@@ -150,7 +163,7 @@ ElfObject::~ElfObject(void)
   }
 
   if (DecompressedObj)
-    free(DecompressedObj);
+    munmap(DecompressedObj, DecompressedSize);
 
   if (ElfFd != -1) {
     /* File Descriptor is still open.  */
@@ -159,20 +172,58 @@ ElfObject::~ElfObject(void)
   }
 }
 
-Elf *ElfObject::decompress_gz(void)
+void ElfObject::Reserve_Decompressed(size_t size)
 {
-  const size_t CHUNK = 16384;
+  if (size <= DecompressedSize) {
+    return;
+  }
 
-  unsigned have;
-  unsigned char in[CHUNK];
-  unsigned char out[CHUNK];
+  /* Round to whole pages.  */
+  size_t page = sysconf(_SC_PAGESIZE);
+  size = (size + page - 1) & ~(page - 1);
+
+  void *map;
+  if (DecompressedObj == nullptr) {
+    map = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    /* Let the kernel move the pages rather than copying them.  */
+    map = mremap(DecompressedObj, DecompressedSize, size, MREMAP_MAYMOVE);
+  }
+
+  if (map == MAP_FAILED) {
+    throw std::runtime_error("Unable to map " + std::to_string(size) +
+                             " bytes to decompress " + parser_path);
+  }
 
-  unsigned long dest_size = CHUNK;
-  DecompressedObj = (unsigned char *)malloc(CHUNK);
-  if (!DecompressedObj)
-    throw std::runtime_error("zlib malloc failed\n");
+#ifdef MADV_HUGEPAGE
+  /* Decompressed debuginfo can be hundreds of MB.  */
+  madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+  DecompressedObj = (unsigned char *) map;
+  DecompressedSize = size;
+}
+
+Elf *ElfObject::decompress_gz(void)
+{
+  MappedFile file(parser_path.c_str());
+  const unsigned char *in = (const unsigned char *) file.Data();
+  size_t in_size = file.Size();
+
+  /* The last 4 bytes of a gzip file is the size of the uncompressed data
+     modulo 2^32, in little endian.  It is wrong for files larger than 4GB or
+     with many gzip members, in which case the memory is grown as needed.  */
+  if (in_size < 18) {
+    throw std::runtime_error("zlib: file too small: " + parser_path);
+  }
 
-  unsigned long dest_current = 0;
+  const unsigned char *trailer = in + in_size - 4;
+  size_t isize = (size_t) trailer[0]
+               | (size_t) trailer[1] << 8
+               | (size_t) trailer[2] << 16
+               | (size_t) trailer[3] << 24;
+  Reserve_Decompressed(std::max(isize, (size_t) 1));
 
   z_stream strm;
   memset(&strm, 0, sizeof(strm));
@@ -182,52 +233,61 @@ Elf *ElfObject::decompress_gz(void)
   if (ret != Z_OK)
     throw std::runtime_error("zlib inflateInit failed\n");
 
-  /* decompress until deflate stream ends or end of file */
-  do {
-    strm.avail_in = read(ElfFd, in, CHUNK);
-    if (strm.avail_in < 0)
-      throw std::runtime_error("zlib read failed: " + std::to_string(strm.avail_in) + "\n");
-
-    if (strm.avail_in == 0)
-      break;
-    strm.next_in = in;
-
-    /* run inflate() on input until output buffer not full */
-    do {
-      strm.avail_out = CHUNK;
-      strm.next_out = out;
-      ret = inflate(&strm, Z_NO_FLUSH);
-
-      switch (ret) {
-        case Z_NEED_DICT:
-          ret = Z_DATA_ERROR;     /* and fall through */
-        case Z_DATA_ERROR:
-        case Z_MEM_ERROR:
-          inflateEnd(&strm);
-          throw std::runtime_error("zlib inflate error: " + std::to_string(ret) + "\n");
+  /* zlib counts in 32-bit, so give it at most this much at once.  */
+  const size_t max_chunk = UINT_MAX;
+  size_t in_pos = 0;
+  size_t out_pos = 0;
+
+  while (true) {
+    if (out_pos == DecompressedSize) {
+      try {
+        Reserve_Decompressed(DecompressedSize * 2);
+      } catch (...) {
+        inflateEnd(&strm);
+        throw;
       }
+    }
 
-      have = CHUNK - strm.avail_out;
+    size_t in_chunk = std::min(in_size - in_pos, max_chunk);
+    size_t out_chunk = std::min(DecompressedSize - out_pos, max_chunk);
 
-      /* double the buffer when needed */
-      if (have > dest_size - dest_current) {
-        dest_size = dest_size * 2;
-        DecompressedObj = (unsigned char *)realloc(DecompressedObj, dest_size);
+    strm.next_in = (Bytef *) in + in_pos;
+    strm.avail_in = in_chunk;
+    strm.next_out = DecompressedObj + out_pos;
+    strm.avail_out = out_chunk;
+
+    ret = inflate(&strm, Z_NO_FLUSH);
+
+    in_pos += in_chunk - strm.avail_in;
+    out_pos += out_chunk - strm.avail_out;
+
+    if (ret == Z_STREAM_END) {
+      /* A gzip file may have many members one after the other.  */
+      if (in_pos < in_size && in[in_pos] == 0x1f) {
+        inflateReset(&strm);
+        continue;
       }
+      break;
+    }
 
-      memcpy(DecompressedObj + dest_current, out, have);
-      dest_current += have;
-    } while (strm.avail_out == 0);
+    if (ret == Z_BUF_ERROR && in_pos == in_size) {
+      inflateEnd(&strm);
+      throw std::runtime_error("zlib: truncated file: " + parser_path);
+    }
 
-    /* done when inflate() says it's done */
-  } while (ret != Z_STREAM_END);
+    switch (ret) {
+      case Z_NEED_DICT:
+      case Z_DATA_ERROR:
+      case Z_MEM_ERROR:
+      case Z_STREAM_ERROR:
+        inflateEnd(&strm);
+        throw std::runtime_error("zlib inflate error: " + std::to_string(ret) + "\n");
+    }
+  }
 
   inflateEnd(&strm);
 
-  if (ret != Z_STREAM_END)
-      throw std::runtime_error("zlib inflateEnd error: " + std::to_string(ret) + "\n");
-
-  Elf *elf = elf_memory((char *)DecompressedObj, ret);
+  Elf *elf = elf_memory((char *)DecompressedObj, out_pos);
   if (elf == nullptr)
     throw std::runtime_error("libelf elf_memory error: " + std::string(elf_errmsg(elf_errno())));
 
@@ -236,35 +296,110 @@ Elf *ElfObject::decompress_gz(void)
 
 Elf *ElfObject::decompress_zstd()
 {
-  size_t buffInSize = ZSTD_DStreamInSize();
-  unsigned char buffIn[buffInSize];
+  MappedFile file(parser_path.c_str());
+  const char *in = file.Data();
+  size_t in_size = file.Size();
+
+  /* Find the frames and how large they are decompressed.  */
+  struct Frame
+  {
+    size_t In, InSize, Out, OutSize;
+  };
+  std::vector<Frame> frames;
+  bool sizes_known = true;
+  size_t out_size = 0;
+
+  for (size_t pos = 0; pos < in_size; ) {
+    size_t frame_size = ZSTD_findFrameCompressedSize(in + pos, in_size - pos);
+    if (ZSTD_isError(frame_size)) {
+      throw std::runtime_error("ZSTD_findFrameCompressedSize failed: " +
+                               std::string(ZSTD_getErrorName(frame_size)) + "\n");
+    }
 
-  size_t buffOutSize = ZSTD_DStreamOutSize();
-  unsigned char buffOut[buffOutSize];
+    unsigned long long content_size = ZSTD_getFrameContentSize(in + pos, frame_size);
+    if (content_size == ZSTD_CONTENTSIZE_ERROR) {
+      throw std::runtime_error("zstd: bad frame in " + parser_path);
+    }
+    if (content_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+      sizes_known = false;
+      content_size = 0;
+    }
 
-  unsigned long dest_size = buffOutSize;
-  DecompressedObj = (unsigned char *)malloc(dest_size);
-  if (!DecompressedObj)
-    throw std::runtime_error("zstd malloc failed\n");
+    frames.push_back({pos, frame_size, out_size, (size_t) content_size});
+    out_size += content_size;
+    pos += frame_size;
+  }
 
-  unsigned long dest_current = 0;
+  if (sizes_known) {
+    Reserve_Decompressed(std::max(out_size, (size_t) 1));
+
+    /* Each frame is decompressed on its own into its place, so frames can be
+       decompressed in parallel.  */
+    std::atomic<size_t> next_frame(0);
+    std::vector<std::string> errors(frames.size());
+
+    auto worker = [&](void) {
+      ZSTD_DCtx *dctx = ZSTD_createDCtx();
+      size_t i;
+      while ((i = next_frame.fetch_add(1)) < frames.size()) {
+        const Frame &f = frames[i];
+        if (dctx == nullptr) {
+          errors[i] = "zstd createDCtx failed";
+          continue;
+        }
+
+        size_t ret = ZSTD_decompressDCtx(dctx, DecompressedObj + f.Out,
+                                         f.OutSize, in + f.In, f.InSize);
+        if (ZSTD_isError(ret)) {
+          errors[i] = "ZSTD_decompressDCtx failed: " + std::string(ZSTD_getErrorName(ret));
+        } else if (ret != f.OutSize) {
+          errors[i] = "zstd: frame size mismatch";
+        }
+      }
+      ZSTD_freeDCtx(dctx);
+    };
 
-  ZSTD_DCtx* dctx = ZSTD_createDCtx();
-  if (!dctx)
-    throw std::runtime_error("zstd createDCtx failed\n");
+    unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min<size_t>(num_threads, frames.size());
 
-  size_t bytes_read;
-  while ((bytes_read = read(ElfFd, buffIn, buffInSize)) ) {
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads; i++) {
+      threads.emplace_back(worker);
+    }
+    worker();
 
-    if (bytes_read < 0) {
-      ZSTD_freeDCtx(dctx);
-      throw std::runtime_error("ZSTD read failed: " + std::to_string(bytes_read) + "\n");
+    for (std::thread &t : threads) {
+      t.join();
     }
 
-    ZSTD_inBuffer input = { buffIn, bytes_read, 0 };
+    for (const std::string &error : errors) {
+      if (!error.empty()) {
+        throw std::runtime_error(error + "\n");
+      }
+    }
+  } else {
+    /* Some frame does not tell its size.  Stream everything into memory
+       which is grown as needed.  */
+    Reserve_Decompressed(std::max(out_size, in_size) * 4);
+
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    if (!dctx)
+      throw std::runtime_error("zstd createDCtx failed\n");
+
+    ZSTD_inBuffer input = { in, in_size, 0 };
+    out_size = 0;
 
     while (input.pos < input.size) {
-      ZSTD_outBuffer output = { buffOut, buffOutSize, 0 };
+      if (out_size == DecompressedSize) {
+        try {
+          Reserve_Decompressed(DecompressedSize * 2);
+        } catch (...) {
+          ZSTD_freeDCtx(dctx);
+          throw;
+        }
+      }
+
+      ZSTD_outBuffer output = { DecompressedObj, DecompressedSize, out_size };
 
       size_t ret = ZSTD_decompressStream(dctx, &output , &input);
       if (ZSTD_isError(ret)) {
@@ -272,19 +407,13 @@ Elf *ElfObject::decompress_zstd()
         throw std::runtime_error("ZSTD_decompressStream failed: " + std::string(ZSTD_getErrorName(ret)) + "\n");
       }
 
-      if (output.size > dest_size - dest_current) {
-        dest_size = dest_size * 2;
-        DecompressedObj = (unsigned char *)realloc(DecompressedObj, dest_size);
-      }
-
-      memcpy(DecompressedObj + dest_current, buffOut, output.pos);
-      dest_current += output.size;
+      out_size = output.pos;
     }
-  }
 
-  ZSTD_freeDCtx(dctx);
+    ZSTD_freeDCtx(dctx);
+  }
 
-  Elf *elf = elf_memory((char *)DecompressedObj, dest_size);
+  Elf *elf = elf_memory((char *)DecompressedObj, out_size);
   if (elf == nullptr)
     throw std::runtime_error("libelf elf_memory error: " + std::string(elf_errmsg(elf_errno())));
 
@@ -318,47 +447,750 @@ const char *ElfSection::Get_Name(void)
   return elf_strptr(elf, shstrndx, SectionHeader.sh_name);
 }
 
-/* Cache the symbols from section.  */
-void ElfSymbolCache::Insert_Symbols_Into_Hash(SymbolTableHash &map, ElfSection &section)
+ElfSymbolTable::ElfSymbolTable(ElfObject &eo, ElfSection &section,
+                               ElfSection *gnu_hash, ElfSection *sysv_hash)
+  : Symbols(nullptr),
+    Entries(nullptr),
+    NumSymbols(0),
+    Strtab(nullptr),
+    StrtabSize(0),
+    GnuHash(nullptr),
+    GnuHashWords(0),
+    GnuHashFirst(0),
+    BloomBits(0),
+    SysvHash(nullptr),
+    SysvHashWords(0),
+    Index(),
+    IndexStorage()
 {
-  size_t n = section.Get_Num_Symbols();
-  for (size_t i = 0; i < n; i++) {
-    ElfSymbol symbol = section.Get_Symbol(i);
-    if (symbol.Get_Type() == STT_FILE) {
-      /* Skip the file symbols, we don't need them.  */
-      continue;
+  struct Elf *elf = eo.Get_Wrapped_Object();
+
+  /* Sections stripped from debuginfo files have no data.  */
+  Symbols = section.Get_Data();
+  if (Symbols == nullptr || Symbols->d_buf == nullptr
+      || section.Get_Entry_Size() == 0) {
+    return;
+  }
+
+  Elf_Scn *strtab = elf_getscn(elf, section.Get_Link());
+  Elf_Data *strtab_data = strtab ? elf_getdata(strtab, nullptr) : nullptr;
+  if (strtab_data == nullptr || strtab_data->d_buf == nullptr) {
+    return;
+  }
+
+  Strtab = (const char *) strtab_data->d_buf;
+  StrtabSize = strtab_data->d_size;
+  NumSymbols = section.Get_Num_Symbols();
+
+  if (gnu_hash) {
+    Elf_Data *data = gnu_hash->Get_Data();
+    if (data && data->d_buf && data->d_size >= 4 * sizeof(uint32_t)) {
+      const uint32_t *words = (const uint32_t *) data->d_buf;
+      size_t num_words = data->d_size / sizeof(uint32_t);
+      uint32_t nbuckets = words[0];
+      uint32_t symoffset = words[1];
+      uint32_t bloom_size = words[2];
+      unsigned bloom_bits = gelf_getclass(elf) == ELFCLASS64 ? 64 : 32;
+
+      /* Only use it if it is sane.  */
+      uint64_t needed = 4 + (uint64_t) bloom_size * (bloom_bits / 32) + nbuckets;
+      if (nbuckets > 0 && bloom_size > 0 && symoffset <= NumSymbols
+          && needed <= num_words) {
+        GnuHash = words;
+        GnuHashWords = num_words;
+        BloomBits = bloom_bits;
+
+        /* Linkers emit a symoffset of 1 when nothing is hashed, so find where
+           the chains really start.  Empty buckets are 0.  */
+        const uint32_t *buckets = words + 4 + bloom_size * (bloom_bits / 32);
+        GnuHashFirst = NumSymbols;
+        for (uint32_t i = 0; i < nbuckets; i++) {
+          if (buckets[i] != 0 && buckets[i] < GnuHashFirst) {
+            GnuHashFirst = buckets[i];
+          }
+        }
+      }
     }
+  }
 
-    std::string symbol_name(symbol.Get_Name());
-    map[symbol_name] = symbol.Get_Info();
+  /* Some architectures use 64-bit entries in .hash.  Those are not worth
+     handling.  */
+  if (sysv_hash && sysv_hash->Get_Entry_Size() == sizeof(uint32_t)) {
+    Elf_Data *data = sysv_hash->Get_Data();
+    if (data && data->d_buf && data->d_size >= 2 * sizeof(uint32_t)) {
+      const uint32_t *words = (const uint32_t *) data->d_buf;
+      size_t num_words = data->d_size / sizeof(uint32_t);
+      uint32_t nbucket = words[0];
+      uint32_t nchain = words[1];
+
+      if (nbucket > 0 && 2 + (uint64_t) nbucket + nchain <= num_words) {
+        SysvHash = words;
+        SysvHashWords = num_words;
+      }
+    }
   }
 }
 
-ElfSymbolCache::ElfSymbolCache(ElfObject &eo)
+ElfSymbolTable::ElfSymbolTable(std::string_view strtab,
+                               std::span<const Entry> symbols,
+                               std::span<const uint32_t> index)
+  : Symbols(nullptr),
+    Entries(symbols.data()),
+    NumSymbols(symbols.size()),
+    Strtab(strtab.data()),
+    StrtabSize(strtab.size()),
+    GnuHash(nullptr),
+    GnuHashWords(0),
+    GnuHashFirst(0),
+    BloomBits(0),
+    SysvHash(nullptr),
+    SysvHashWords(0),
+    Index(index),
+    IndexStorage()
+{
+}
+
+GElf_Sym *ElfSymbolTable::Read_Symbol(size_t i, GElf_Sym &sym)
+{
+  if (Entries == nullptr) {
+    return gelf_getsym(Symbols, i, &sym);
+  }
+
+  if (i >= NumSymbols) {
+    return nullptr;
+  }
+
+  memset(&sym, 0, sizeof(sym));
+  sym.st_name = Entries[i].Name;
+  sym.st_info = Entries[i].Info;
+  return &sym;
+}
+
+GElf_Sym *ElfSymbolTable::Get_Symbol(size_t i, GElf_Sym &sym)
+{
+  if (Read_Symbol(i, sym) == nullptr) {
+    return nullptr;
+  }
+
+  /* Skip the file symbols, we don't need them.  */
+  if (ELF64_ST_TYPE(sym.st_info) == STT_FILE || sym.st_name >= StrtabSize) {
+    return nullptr;
+  }
+
+  return &sym;
+}
+
+bool ElfSymbolTable::Name_Equals(const GElf_Sym &sym, std::string_view name)
+{
+  size_t offset = sym.st_name;
+
+  /* There must be room for the name and its NUL terminator.  */
+  if (offset >= StrtabSize || name.size() >= StrtabSize - offset) {
+    return false;
+  }
+
+  return memcmp(Strtab + offset, name.data(), name.size()) == 0
+         && Strtab[offset + name.size()] == '\0';
+}
+
+std::string_view ElfSymbolTable::Get_Name(const GElf_Sym &sym)
+{
+  const char *name = Strtab + sym.st_name;
+  return std::string_view(name, strnlen(name, StrtabSize - sym.st_name));
+}
+
+size_t ElfSymbolTable::Lookup_GNU_Hash(std::string_view name)
+{
+  uint32_t nbuckets = GnuHash[0];
+  uint32_t symoffset = GnuHash[1];
+  uint32_t bloom_size = GnuHash[2];
+  uint32_t bloom_shift = GnuHash[3];
+
+  const uint32_t *bloom = GnuHash + 4;
+  const uint32_t *buckets = bloom + bloom_size * (BloomBits / 32);
+  const uint32_t *chain = buckets + nbuckets;
+  size_t chain_size = GnuHashWords - (chain - GnuHash);
+
+  uint32_t h = 5381;
+  for (unsigned char c : name) {
+    h = h * 33 + c;
+  }
+
+  size_t found = 0;
+  GElf_Sym sym;
+
+  /* The bloom filter tells if the symbol is surely not in the table.  */
+  uint64_t word, mask;
+  size_t bloom_index = (h / BloomBits) % bloom_size;
+  if (BloomBits == 64) {
+    memcpy(&word, bloom + 2 * bloom_index, sizeof(word));
+  } else {
+    word = bloom[bloom_index];
+  }
+  mask = (1ULL << (h % BloomBits)) | (1ULL << ((h >> bloom_shift) % BloomBits));
+
+  if ((word & mask) == mask) {
+    /* Symbols with the same hash bucket are consecutive, with the last one
+       having the lowest bit of its chain entry set.  */
+    for (size_t i = buckets[h % nbuckets];
+         i >= symoffset && i < NumSymbols && i - symoffset < chain_size; i++) {
+      uint32_t h2 = chain[i - symoffset];
+      if ((h | 1) == (h2 | 1) && Get_Symbol(i, sym) && Name_Equals(sym, name)) {
+        found = i;
+      }
+      if (h2 & 1) {
+        break;
+      }
+    }
+  }
+
+  if (found != 0) {
+    return found;
+  }
+
+  /* Undefined symbols come before the hashed ones and are not in the chains.
+     There are few of them.  */
+  for (size_t i = 1; i < GnuHashFirst; i++) {
+    if (Get_Symbol(i, sym) && Name_Equals(sym, name)) {
+      found = i;
+    }
+  }
+
+  return found;
+}
+
+size_t ElfSymbolTable::Lookup_SysV_Hash(std::string_view name)
+{
+  uint32_t nbucket = SysvHash[0];
+  uint32_t nchain = SysvHash[1];
+  const uint32_t *bucket = SysvHash + 2;
+  const uint32_t *chain = bucket + nbucket;
+
+  uint32_t h = 0;
+  for (unsigned char c : name) {
+    h = (h << 4) + c;
+    uint32_t g = h & 0xf0000000;
+    if (g) {
+      h ^= g >> 24;
+    }
+    h &= ~g;
+  }
+
+  size_t found = 0;
+  GElf_Sym sym;
+
+  /* Bound the number of steps in case the chain has a loop.  */
+  uint32_t steps = 0;
+  for (uint32_t i = bucket[h % nbucket];
+       i != STN_UNDEF && i < nchain && i < NumSymbols && steps < nchain;
+       i = chain[i], steps++) {
+    if (i > found && Get_Symbol(i, sym) && Name_Equals(sym, name)) {
+      found = i;
+    }
+  }
+
+  return found;
+}
+
+size_t ElfSymbolTable::Find_Slot(std::string_view name)
+{
+  size_t mask = Index.size() - 1;
+  size_t slot = StringTable::Hash(name) & mask;
+  GElf_Sym sym;
+
+  while (Index[slot] != 0) {
+    if (Read_Symbol(Index[slot], sym) && Name_Equals(sym, name)) {
+      return slot;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  return slot;
+}
+
+void ElfSymbolTable::Build_Index(void)
+{
+  /* Keep the load factor at most 1/2.  */
+  size_t size = 16;
+  while (size < 2 * NumSymbols) {
+    size *= 2;
+  }
+  IndexStorage.assign(size, 0);
+  Index = IndexStorage;
+
+  GElf_Sym sym;
+  for (size_t i = 1; i < NumSymbols; i++) {
+    if (Get_Symbol(i, sym)) {
+      /* Later symbols replace earlier ones with the same name.  */
+      IndexStorage[Find_Slot(Get_Name(sym))] = i;
+    }
+  }
+}
+
+std::span<const uint32_t> ElfSymbolTable::Get_Index(void)
+{
+  if (Index.empty() && NumSymbols > 0) {
+    Build_Index();
+  }
+
+  return Index;
+}
+
+void ElfSymbolTable::Extract(std::string &strtab, std::vector<Entry> &symbols)
+{
+  GElf_Sym sym;
+  for (size_t i = 1; i < NumSymbols; i++) {
+    /* Only the last symbol with a given name is ever found.  */
+    if (Get_Symbol(i, sym) && Get_Index()[Find_Slot(Get_Name(sym))] == i) {
+      symbols.push_back({(uint32_t) strtab.size(), sym.st_info});
+      strtab.append(Get_Name(sym));
+      strtab.push_back('\0');
+    }
+  }
+}
+
+size_t ElfSymbolTable::Lookup_Index(std::string_view name)
+{
+  if (Index.empty()) {
+    Build_Index();
+  }
+
+  return Index[Find_Slot(name)];
+}
+
+bool ElfSymbolTable::Get_Symbol_Info(std::string_view name, unsigned char &info)
+{
+  if (NumSymbols == 0) {
+    return false;
+  }
+
+  size_t i;
+  if (GnuHash) {
+    i = Lookup_GNU_Hash(name);
+  } else if (SysvHash) {
+    i = Lookup_SysV_Hash(name);
+  } else {
+    i = Lookup_Index(name);
+  }
+
+  GElf_Sym sym;
+  if (i == 0 || Read_Symbol(i, sym) == nullptr) {
+    return false;
+  }
+
+  info = sym.st_info;
+  return true;
+}
+
+void ElfSymbolTable::Get_All_Symbols(std::vector<std::string> &vec)
+{
+  if (NumSymbols == 0) {
+    return;
+  }
+
+  if (Index.empty()) {
+    Build_Index();
+  }
+
+  GElf_Sym sym;
+  for (uint32_t i : Index) {
+    if (i != 0 && Read_Symbol(i, sym)) {
+      vec.push_back(std::string(Get_Name(sym)));
+    }
+  }
+}
+
+void ElfSymbolTable::Dump(void)
+{
+  if (NumSymbols == 0) {
+    return;
+  }
+
+  if (Index.empty()) {
+    Build_Index();
+  }
+
+  GElf_Sym sym;
+  for (uint32_t i : Index) {
+    if (i != 0 && Read_Symbol(i, sym)) {
+      std::cout << Get_Name(sym)
+                << "    " << ElfSymbol::Type_As_String(ELF64_ST_TYPE(sym.st_info))
+                << "    " << ElfSymbol::Bind_As_String(ELF64_ST_BIND(sym.st_info))
+                << '\n';
+    }
+  }
+}
+
+/* Layout of the files where ElfSymbolExtract are saved:
+
+   - Header: identifies the object the extract is of, and tells where the
+     other parts are.
+   - The string table with the names of the symbols and of the module.
+   - NumTables TableHeader, one per symbol table.
+   - For each table, its NumSymbols ElfSymbolTable::Entry, of which the first
+     is the null symbol, and its NumSlots open addressing index.
+
+   Every part starts at an offset aligned to 8 bytes, and every number is in
+   the byte order of the machine which wrote the file.  */
+struct ElfSymbolExtract::Header
+{
+  char Magic[8];
+  uint32_t Version;
+  uint32_t ByteOrder;
+
+  uint64_t ObjectSize;
+  int64_t ObjectMtimeSec;
+  int64_t ObjectMtimeNsec;
+  uint64_t ObjectDigest;
+
+  uint32_t NumTables;
+  uint32_t HasModule;
+  uint32_t ModuleName;
+  uint32_t Reserved;
+
+  uint64_t StrtabOffset;
+  uint64_t StrtabSize;
+  uint64_t TablesOffset;
+};
+
+struct ElfSymbolExtract::TableHeader
+{
+  uint32_t Type;
+  uint32_t NumSymbols;
+  uint32_t NumSlots;
+  uint32_t Reserved;
+
+  uint64_t SymbolsOffset;
+  uint64_t IndexOffset;
+};
+
+static const char EXTRACT_MAGIC[8] = { 'C', 'E', 'S', 'Y', 'M', '\0', '\0', '\0' };
+
+/* Must be incremented every time the layout of the extract changes.  */
+static const uint32_t EXTRACT_VERSION = 1;
+
+static const uint32_t EXTRACT_BYTE_ORDER = 0x01020304;
+
+/* Size of the head and of the tail of the object covered by the digest.  */
+static const size_t EXTRACT_DIGEST_SIZE = 4096;
+
+ElfSymbolExtract::ElfSymbolExtract(const std::string &path,
+                                   const std::string &cache_dir)
+  : Path(path),
+    Strtab(),
+    Tables(),
+    HasModule(false),
+    ModuleName(0),
+    File(),
+    StrtabStorage(),
+    SymbolsStorage(),
+    IndexStorage()
+{
+  Header object;
+  Identify_Object(object);
+
+  /* The identifying fields are also what names the file.  */
+  char name[32];
+  snprintf(name, sizeof(name), "%016" PRIx64 ".cesym",
+           StringTable::Hash(std::string_view((const char *) &object,
+                                              sizeof(object))));
+  std::string cache_path = cache_dir + "/" + name;
+
+  if (Load(cache_path, object)) {
+    return;
+  }
+
+  {
+    ElfObject eo(path);
+    Extract(eo);
+  }
+
+  /* The cache only saves time, so not being able to write it is not an
+     error.  */
+  mkdir(cache_dir.c_str(), 0755);
+  if (!Save(cache_path, object)) {
+    std::cerr << "WARNING: Unable to save the symbols of " << path << " to "
+              << cache_dir << '\n';
+  }
+}
+
+ElfSymbolExtract::~ElfSymbolExtract(void)
+{
+}
+
+bool ElfSymbolExtract::Is_Compressed(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  enum FileHandling::FileType ft = FileHandling::Get_File_Type(fd);
+  close(fd);
+
+  return ft == FileHandling::FILE_TYPE_GZ || ft == FileHandling::FILE_TYPE_ZSTD;
+}
+
+void ElfSymbolExtract::Identify_Object(Header &header)
+{
+  memset(&header, 0, sizeof(header));
+  memcpy(header.Magic, EXTRACT_MAGIC, sizeof(EXTRACT_MAGIC));
+  header.Version = EXTRACT_VERSION;
+  header.ByteOrder = EXTRACT_BYTE_ORDER;
+
+  int fd = open(Path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    if (fd != -1) {
+      close(fd);
+    }
+    throw std::runtime_error("ELF file not found: " + Path);
+  }
+
+  header.ObjectSize = st.st_size;
+  header.ObjectMtimeSec = st.st_mtim.tv_sec;
+  header.ObjectMtimeNsec = st.st_mtim.tv_nsec;
+
+  /* Digest the head and the tail of the object.  They overlap on small
+     objects, which does not matter.  */
+  size_t part = std::min((size_t) st.st_size, EXTRACT_DIGEST_SIZE);
+  std::string buffer(2 * part, '\0');
+  bool ok = pread(fd, buffer.data(), part, 0) == (ssize_t) part
+            && pread(fd, buffer.data() + part, part, st.st_size - part) == (ssize_t) part;
+  close(fd);
+
+  if (!ok) {
+    throw std::runtime_error("Unable to read " + Path);
+  }
+
+  header.ObjectDigest = StringTable::Hash(buffer);
+}
+
+bool ElfSymbolExtract::Load(const std::string &cache_path, const Header &object)
+{
+  std::unique_ptr<MappedFile> file;
+  try {
+    file = std::make_unique<MappedFile>(cache_path.c_str(), false);
+  } catch (std::runtime_error &) {
+    return false;
+  }
+
+  const char *base = file->Data();
+  uint64_t size = file->Size();
+  const Header *header = (const Header *) base;
+
+  /* The identifying fields come first in the header, and must all match.  */
+  if (size < sizeof(Header)
+      || memcmp(header, &object, offsetof(Header, NumTables)) != 0) {
+    return false;
+  }
+
+  /* Check that every part is within the file, so that a truncated file can
+     not make us read past the mapping.  */
+  auto in_file = [size](uint64_t offset, uint64_t count, size_t elem_size) {
+    return offset % 8 == 0 && offset <= size
+           && count <= (size - offset) / elem_size;
+  };
+
+  if (!in_file(header->StrtabOffset, header->StrtabSize, 1)
+      || !in_file(header->TablesOffset, header->NumTables, sizeof(TableHeader))
+      || (header->HasModule && header->ModuleName >= header->StrtabSize)) {
+    return false;
+  }
+
+  std::string_view strtab(base + header->StrtabOffset, header->StrtabSize);
+  const TableHeader *tables = (const TableHeader *) (base + header->TablesOffset);
+  std::vector<Table> loaded;
+
+  for (uint32_t i = 0; i < header->NumTables; i++) {
+    const TableHeader &t = tables[i];
+    uint32_t num_slots = t.NumSlots;
+
+    if (t.NumSymbols == 0 || num_slots <= t.NumSymbols
+        || (num_slots & (num_slots - 1))
+        || !in_file(t.SymbolsOffset, t.NumSymbols, sizeof(ElfSymbolTable::Entry))
+        || !in_file(t.IndexOffset, num_slots, sizeof(uint32_t))) {
+      return false;
+    }
+
+    std::span<const uint32_t> index((const uint32_t *) (base + t.IndexOffset),
+                                    num_slots);
+
+    /* An index with no empty slot would make lookups never end.  It is
+       small, so check it all.  */
+    for (uint32_t slot : index) {
+      if (slot >= t.NumSymbols) {
+        return false;
+      }
+    }
+    if (std::count(index.begin(), index.end(), 0) == 0) {
+      return false;
+    }
+
+    loaded.push_back({
+      t.Type,
+      std::span<const ElfSymbolTable::Entry>(
+        (const ElfSymbolTable::Entry *) (base + t.SymbolsOffset), t.NumSymbols),
+      index,
+    });
+  }
+
+  Strtab = strtab;
+  Tables = std::move(loaded);
+  HasModule = header->HasModule;
+  ModuleName = header->ModuleName;
+  File = std::move(file);
+  return true;
+}
+
+void ElfSymbolExtract::Extract(ElfObject &eo)
+{
+  /* Name 0 is the empty name of the null symbols.  */
+  StrtabStorage.push_back('\0');
+
+  std::vector<std::pair<ElfW(Word), size_t>> starts;
+
+  for (auto it = eo.section_begin(); it != eo.section_end(); ++it) {
+    ElfSection &section = *it;
+    ElfW(Word) type = section.Get_Section_Type();
+
+    if (type == SHT_DYNSYM || type == SHT_SYMTAB) {
+      starts.push_back(std::make_pair(type, SymbolsStorage.size()));
+      SymbolsStorage.push_back({0, 0});
+
+      ElfSymbolTable table(eo, section, nullptr, nullptr);
+      table.Extract(StrtabStorage, SymbolsStorage);
+    } else if (type == SHT_PROGBITS
+               && !strncmp(section.Get_Name(), ".gnu.linkonce.this_module", 25)) {
+      /* See ElfSymbolCache::Analyze_ELF.  */
+      Elf_Data *data = section.Get_Data();
+      if (data && data->d_buf && data->d_size > 24) {
+        const char *name = (const char *) data->d_buf + 24;
+        HasModule = true;
+        ModuleName = StrtabStorage.size();
+        StrtabStorage.append(name, strnlen(name, data->d_size - 24));
+        StrtabStorage.push_back('\0');
+      }
+    }
+  }
+
+  Strtab = StrtabStorage;
+
+  /* The symbols do not move anymore, so the tables can refer to them.  */
+  std::vector<size_t> index_starts;
+  for (size_t i = 0; i < starts.size(); i++) {
+    size_t end = i + 1 < starts.size() ? starts[i + 1].second : SymbolsStorage.size();
+    std::span<const ElfSymbolTable::Entry> symbols(SymbolsStorage.data() + starts[i].second,
+                                                   end - starts[i].second);
+    Tables.push_back({starts[i].first, symbols, {}});
+
+    index_starts.push_back(IndexStorage.size());
+    ElfSymbolTable table = Get_Table(i);
+    std::span<const uint32_t> index = table.Get_Index();
+    IndexStorage.insert(IndexStorage.end(), index.begin(), index.end());
+  }
+  index_starts.push_back(IndexStorage.size());
+
+  for (size_t i = 0; i < Tables.size(); i++) {
+    Tables[i].Index = std::span<const uint32_t>(IndexStorage.data() + index_starts[i],
+                                                index_starts[i + 1] - index_starts[i]);
+  }
+}
+
+bool ElfSymbolExtract::Save(const std::string &cache_path, const Header &object)
+{
+  Header header = object;
+  header.NumTables = Tables.size();
+  header.HasModule = HasModule;
+  header.ModuleName = ModuleName;
+  header.StrtabSize = Strtab.size();
+
+  std::vector<TableHeader> tables(Tables.size());
+
+  std::string buffer(sizeof(header), '\0');
+  header.StrtabOffset = Append_Aligned(buffer, Strtab.data(), Strtab.size());
+  header.TablesOffset = Append_Aligned(buffer, tables.data(),
+                                       tables.size() * sizeof(TableHeader));
+
+  for (size_t i = 0; i < Tables.size(); i++) {
+    TableHeader &t = tables[i];
+    t.Type = Tables[i].Type;
+    t.NumSymbols = Tables[i].Symbols.size();
+    t.NumSlots = Tables[i].Index.size();
+    t.SymbolsOffset = Append_Aligned(buffer, Tables[i].Symbols.data(),
+                                     Tables[i].Symbols.size_bytes());
+    t.IndexOffset = Append_Aligned(buffer, Tables[i].Index.data(),
+                                   Tables[i].Index.size_bytes());
+  }
+
+  memcpy(buffer.data(), &header, sizeof(header));
+  memcpy(buffer.data() + header.TablesOffset, tables.data(),
+         tables.size() * sizeof(TableHeader));
+
+  /* Write to a temporary file and rename it, so that other runs never see
+     a partially written extract.  */
+  std::string tmp_path = cache_path + ".tmp." + std::to_string(getpid());
+  FILE *file = fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  ok = (fclose(file) == 0) && ok;
+  ok = ok && rename(tmp_path.c_str(), cache_path.c_str()) == 0;
+  if (!ok) {
+    unlink(tmp_path.c_str());
+  }
+
+  return ok;
+}
+
+ElfSymbolCache::ElfSymbolCache(std::unique_ptr<ElfObject> eo)
   : ElfSymbolCache()
 {
-  Analyze_ELF(eo);
+  Analyze_ELF(std::move(eo));
 }
 
-void ElfSymbolCache::Analyze_ELF(ElfObject &eo)
+void ElfSymbolCache::Analyze_ELF(std::unique_ptr<ElfObject> eo)
 {
+  /* Find the hash sections first, which are linked to their symbol
+     tables.  */
+  std::vector<ElfSection> hashes;
+  for (auto it = eo->section_begin(); it != eo->section_end(); ++it) {
+    ElfSection &section = *it;
+    ElfW(Word) type = section.Get_Section_Type();
+    if (type == SHT_GNU_HASH || type == SHT_HASH) {
+      hashes.push_back(section);
+    }
+  }
+
+  auto find_hash = [&](ElfSection &table, ElfW(Word) type) -> ElfSection * {
+    for (ElfSection &hash : hashes) {
+      if (hash.Get_Section_Type() == type && hash.Get_Link() == table.Get_Index()) {
+        return &hash;
+      }
+    }
+    return nullptr;
+  };
+
   /* Look for dynsym and symtab sections.  */
-  for (auto it = eo.section_begin(); it != eo.section_end(); ++it)
+  for (auto it = eo->section_begin(); it != eo->section_end(); ++it)
   {
     ElfSection &section = *it;
     switch (section.Get_Section_Type()) {
       case SHT_DYNSYM:
-        Insert_Symbols_Into_Hash(DynsymMap, section);
+        Dynsyms.emplace_back(*eo, section, find_hash(section, SHT_GNU_HASH),
+                             find_hash(section, SHT_HASH));
 
         assert(ObjectPath == "" && "Multiple libraries passed as debuginfo?");
-        ObjectPath = eo.Get_Path();
+        ObjectPath = eo->Get_Path();
         break;
 
       case SHT_SYMTAB:
-        Insert_Symbols_Into_Hash(SymtabMap, section);
+        Symtabs.emplace_back(*eo, section, nullptr, nullptr);
 
         /* We can also have symtab in the .so library.  */
-        DebuginfoPath = eo.Get_Path();
+        DebuginfoPath = eo->Get_Path();
         break;
 
       case SHT_PROGBITS:
@@ -374,6 +1206,52 @@ void ElfSymbolCache::Analyze_ELF(ElfObject &eo)
         break;
     }
   }
+
+  /* The tables point into the object, so keep it.  */
+  Objects.push_back(std::move(eo));
+}
+
+void ElfSymbolCache::Analyze_Extract(std::unique_ptr<ElfSymbolExtract> extract)
+{
+  for (size_t i = 0; i < extract->Get_Num_Tables(); i++) {
+    switch (extract->Get_Table_Type(i)) {
+      case SHT_DYNSYM:
+        Dynsyms.push_back(extract->Get_Table(i));
+
+        assert(ObjectPath == "" && "Multiple libraries passed as debuginfo?");
+        ObjectPath = extract->Get_Path();
+        break;
+
+      case SHT_SYMTAB:
+        Symtabs.push_back(extract->Get_Table(i));
+        DebuginfoPath = extract->Get_Path();
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  if (extract->Get_Module_Name()) {
+    Mod = extract->Get_Module_Name();
+  }
+
+  /* The tables point into the extract, so keep it.  */
+  Extracts.push_back(std::move(extract));
+}
+
+unsigned char ElfSymbolCache::Get_Symbol_Info(std::vector<ElfSymbolTable> &tables,
+                                              const std::string &sym)
+{
+  /* Objects analyzed later take precedence.  */
+  unsigned char info;
+  for (auto it = tables.rbegin(); it != tables.rend(); ++it) {
+    if (it->Get_Symbol_Info(sym, info)) {
+      return info;
+    }
+  }
+
+  return 0;
 }
 
 /** Get symbol if available in either symtab.  Returns in which symtab this
@@ -404,12 +1282,12 @@ std::vector<std::string> ElfSymbolCache::Get_All_Symbols(void)
 {
   std::vector<std::string> vec;
 
-  for (auto const &i : DynsymMap) {
-    vec.push_back(i.first);
+  for (ElfSymbolTable &table : Dynsyms) {
+    table.Get_All_Symbols(vec);
   }
 
-  for (auto const &i : SymtabMap) {
-    vec.push_back(i.first);
+  for (ElfSymbolTable &table : Symtabs) {
+    table.Get_All_Symbols(vec);
   }
 
   return vec;
@@ -428,16 +1306,12 @@ void Print_Section(ElfSection &section)
 void ElfSymbolCache::Dump_Cache(void)
 {
   std::cout << "DynsymMap:\n";
-  for (auto const &i : DynsymMap) {
-    std::cout << i.first << "    " << ElfSymbol::Type_As_String(ELF64_ST_TYPE(i.second))
-                         << "    " << ElfSymbol::Bind_As_String(ELF64_ST_BIND(i.second))
-                         << '\n';
+  for (ElfSymbolTable &table : Dynsyms) {
+    table.Dump();
   }
 
   std::cout << "SymtabMap:\n";
-  for (auto const &i : SymtabMap) {
-    std::cout << i.first << "    " << ElfSymbol::Type_As_String(ELF64_ST_TYPE(i.second))
-                         << "    " << ElfSymbol::Bind_As_String(ELF64_ST_BIND(i.second))
-                         << '\n';
+  for (ElfSymbolTable &table : Symtabs) {
+    table.Dump();
   }
 }
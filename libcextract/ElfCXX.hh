@@ -31,12 +31,16 @@
 #include <gelf.h>
 #include <link.h>
 #include <string>
+#include <string_view>
 #include <iterator>
-#include <unordered_map>
+#include <memory>
+#include <span>
+#include <vector>
 
 class ElfObject;
 class ElfSection;
 class ElfSymbol;
+class MappedFile;
 
 
 /** The symbol table in which this symbol was found.  */
@@ -177,6 +181,25 @@ class ElfSection
     return SectionHeader.sh_type;
   }
 
+  /** Get the index of this section in the section header table.  */
+  inline size_t Get_Index(void)
+  {
+    return elf_ndxscn(Section);
+  }
+
+  /** Get the index of the section linked to this one, e.g. the string table
+      of a symbol table.  */
+  inline ElfW(Word) Get_Link(void)
+  {
+    return SectionHeader.sh_link;
+  }
+
+  /** Get the size of each entry, for sections which are tables.  */
+  inline size_t Get_Entry_Size(void)
+  {
+    return SectionHeader.sh_entsize;
+  }
+
   /** Get name of this section.  */
   const char *Get_Name(void);
 
@@ -247,6 +270,8 @@ class ElfObject : public Parser
     return ElfObj;
   }
 
+  /** Decompress the object straight into memory mapped for it, with the
+      size found on the gzip trailer or on the zstd frame headers.  */
   Elf *decompress_gz(void);
   Elf *decompress_zstd(void);
 
@@ -327,62 +352,297 @@ class ElfObject : public Parser
   /** Wrapped libelf object.  */
   struct Elf *ElfObj;
 
-  /* Memory allocated to hold the decompressed ELF images */
+  /** Make DecompressedObj hold at least `size` bytes, keeping its contents.  */
+  void Reserve_Decompressed(size_t size);
+
+  /* Memory mapped to hold the decompressed ELF images */
   unsigned char *DecompressedObj;
 
+  /* Size of the memory mapped at DecompressedObj.  */
+  size_t DecompressedSize;
+
   /** File descriptor used by libelf object.  */
   int ElfFd;
 };
 
+/** @brief Symbol table which is looked up without loading it.
+  *
+  * Only a few symbols are ever looked up on a symbol table with hundreds of
+  * thousands of them, so the names are compared right on the string table of
+  * the ELF object and nothing is copied.  Symbol tables with a .gnu.hash or a
+  * .hash section (i.e. .dynsym) are looked up with it.  Otherwise an open
+  * addressing index of the names is built on the first lookup.
+  *
+  * A table can also be made of the symbols kept in an ElfSymbolExtract, in
+  * which case the index usually comes with them.
+  *
+  * The ElfObject, or the extract, must outlive this object.
+  */
+class ElfSymbolTable
+{
+  public:
+  /** A symbol as kept in an extract: the offset of its name in the string
+      table, and its `info`.  */
+  struct Entry
+  {
+    uint32_t Name;
+    uint32_t Info;
+  };
+
+  /** Build the table of `section`.  `gnu_hash` and `sysv_hash` are the
+      .gnu.hash and .hash sections of this table, or nullptr.  */
+  ElfSymbolTable(ElfObject &eo, ElfSection &section, ElfSection *gnu_hash,
+                 ElfSection *sysv_hash);
+
+  /** Build the table of `symbols`, whose names are in `strtab`.  The first
+      entry is the null symbol.  `index` is as built by Get_Index, or empty
+      to build it on the first lookup.  */
+  ElfSymbolTable(std::string_view strtab, std::span<const Entry> symbols,
+                 std::span<const uint32_t> index);
+
+  ElfSymbolTable(ElfSymbolTable &&) = default;
+  ElfSymbolTable(const ElfSymbolTable &) = delete;
+
+  /** Get the `info` of the symbol named `name`.  If there are many symbols
+      with that name the last one is used.  Returns false if there is no such
+      symbol.  */
+  bool Get_Symbol_Info(std::string_view name, unsigned char &info);
+
+  /** Append the symbols which Get_Symbol_Info can find to `symbols`, in the
+      order they are in the table, with their names appended to `strtab`.  */
+  void Extract(std::string &strtab, std::vector<Entry> &symbols);
+
+  /** Get the open addressing index of the names, building it if needed.  */
+  std::span<const uint32_t> Get_Index(void);
+
+  /** Get the name of every symbol, once each.  */
+  void Get_All_Symbols(std::vector<std::string> &vec);
+
+  /** Dump for debugging reasons.  */
+  void Dump(void);
+
+  private:
+  /** Read symbol number `i`, of which only the name and info are set for
+      extracts.  */
+  GElf_Sym *Read_Symbol(size_t i, GElf_Sym &sym);
+
+  /** Symbol number `i`, or nullptr if it should be ignored.  */
+  GElf_Sym *Get_Symbol(size_t i, GElf_Sym &sym);
+
+  /** Check if the name of `sym` is `name`.  */
+  bool Name_Equals(const GElf_Sym &sym, std::string_view name);
+
+  /** Get the name of `sym`.  */
+  std::string_view Get_Name(const GElf_Sym &sym);
+
+  /** Look up `name` on .gnu.hash.  Returns the symbol number, or 0 if not
+      found.  */
+  size_t Lookup_GNU_Hash(std::string_view name);
+
+  /** Look up `name` on .hash.  Returns the symbol number, or 0 if not
+      found.  */
+  size_t Lookup_SysV_Hash(std::string_view name);
+
+  /** Look up `name` on the index.  Returns the symbol number, or 0 if not
+      found.  */
+  size_t Lookup_Index(std::string_view name);
+
+  /** Find the slot of `name` on the index, which is either empty or has the
+      symbol with this name.  */
+  size_t Find_Slot(std::string_view name);
+
+  /** Build the index of every symbol.  */
+  void Build_Index(void);
+
+  /** The symbols, either on the ELF object or on an extract.  */
+  Elf_Data *Symbols;
+  const Entry *Entries;
+  size_t NumSymbols;
+
+  /** The string table with the symbol names.  */
+  const char *Strtab;
+  size_t StrtabSize;
+
+  /** Words of the .gnu.hash section, or nullptr.  */
+  const uint32_t *GnuHash;
+  size_t GnuHashWords;
+
+  /** First symbol in the .gnu.hash chains.  Symbols before it are not hashed,
+      which may be more than the symoffset of the section says.  */
+  size_t GnuHashFirst;
+
+  /** Size in bits of the .gnu.hash bloom filter words.  */
+  unsigned BloomBits;
+
+  /** Words of the .hash section, or nullptr.  */
+  const uint32_t *SysvHash;
+  size_t SysvHashWords;
+
+  /** Open addressing index of symbol numbers, hashed by name.  0 marks an
+      empty slot, as symbol 0 is always the null symbol.  Empty until built,
+      unless given with the extract.  */
+  std::span<const uint32_t> Index;
+
+  /** The index, when built here.  */
+  std::vector<uint32_t> IndexStorage;
+};
+
+/** @brief The symbols of an ELF object, kept apart from the object.
+  *
+  * Looking up a symbol on a compressed debuginfo means decompressing the whole
+  * object first, although only the symbol tables and the module name are ever
+  * used.  An extract keeps just those, so it can be saved in a cache directory
+  * and loaded by later runs without decompressing the object or opening it
+  * with libelf.
+  *
+  * The extract is saved in a file named after the size, modification time and
+  * a digest of the object.  The digest covers only the first and last 4KB of
+  * the object, which hold the gzip CRC32 and size, or the zstd frame header
+  * and checksum, so that checking the cache does not mean reading the object.
+  */
+class ElfSymbolExtract
+{
+  public:
+  /** Get the extract of the object at `path`, from `cache_dir` if it was
+      saved there, else by opening the object and saving it there.  */
+  ElfSymbolExtract(const std::string &path, const std::string &cache_dir);
+  ~ElfSymbolExtract(void);
+
+  ElfSymbolExtract(const ElfSymbolExtract &) = delete;
+
+  /** Check if the object at `path` is compressed, thus worth caching.  */
+  static bool Is_Compressed(const std::string &path);
+
+  /** Get the path to the object.  */
+  inline const std::string &Get_Path(void) const
+  {
+    return Path;
+  }
+
+  /** Get the number of symbol tables on the object.  */
+  inline size_t Get_Num_Tables(void) const
+  {
+    return Tables.size();
+  }
+
+  /** Get the section type of table `i`, SHT_DYNSYM or SHT_SYMTAB.  */
+  inline ElfW(Word) Get_Table_Type(size_t i) const
+  {
+    return Tables[i].Type;
+  }
+
+  /** Get table `i`, which refers to this extract.  */
+  inline ElfSymbolTable Get_Table(size_t i) const
+  {
+    return ElfSymbolTable(Strtab, Tables[i].Symbols, Tables[i].Index);
+  }
+
+  /** Get the kernel module name, if the object is a kernel module.  */
+  inline const char *Get_Module_Name(void) const
+  {
+    return HasModule ? Strtab.data() + ModuleName : nullptr;
+  }
+
+  private:
+  struct Header;
+  struct TableHeader;
+
+  /** A symbol table of the extract.  */
+  struct Table
+  {
+    ElfW(Word) Type;
+    std::span<const ElfSymbolTable::Entry> Symbols;
+    std::span<const uint32_t> Index;
+  };
+
+  /** Fill the header fields which identify the object.  */
+  void Identify_Object(Header &header);
+
+  /** Load the extract from the file at `cache_path`.  Returns false if it
+      can not be used, e.g. because it is of another version of the object.  */
+  bool Load(const std::string &cache_path, const Header &object);
+
+  /** Extract the symbols from the ELF object.  */
+  void Extract(ElfObject &eo);
+
+  /** Save the extract to the file at `cache_path`.  Returns false on error.  */
+  bool Save(const std::string &cache_path, const Header &object);
+
+  /** Path to the object.  */
+  std::string Path;
+
+  /** The names of the symbols and of the module.  */
+  std::string_view Strtab;
+
+  /** The symbol tables.  */
+  std::vector<Table> Tables;
+
+  /** Whether the object is a kernel module, and the offset of its name.  */
+  bool HasModule;
+  uint32_t ModuleName;
+
+  /** The cache file, if the extract was loaded from it.  */
+  std::unique_ptr<MappedFile> File;
+
+  /** The extract, if it was extracted from the object.  */
+  std::string StrtabStorage;
+  std::vector<ElfSymbolTable::Entry> SymbolsStorage;
+  std::vector<uint32_t> IndexStorage;
+};
+
 /** ElfSymbolCache -- Cache ELF symbols content for fast access.
   *
   * Very often we have to check if a given symbol is available in the debuginfo
   * file.  This is a fast way of doing this instead of reparse the ELF
-  * structure.
+  * structure.  The ELF objects are kept open and their symbol tables are only
+  * read on lookups.
   **/
 class ElfSymbolCache
 {
   public:
   /** Build cache from ElfObject).  */
-  ElfSymbolCache(ElfObject &eo);
+  ElfSymbolCache(std::unique_ptr<ElfObject> eo);
 
   /** Build empty cache to be filled later.  */
   ElfSymbolCache(void)
-    : DynsymMap(),
-      SymtabMap(),
+    : Objects(),
+      Extracts(),
+      Dynsyms(),
+      Symtabs(),
       Mod(""),
       DebuginfoPath(""),
       ObjectPath("")
   {};
 
-  /** Analyze ELF object.  */
-  void Analyze_ELF(ElfObject &eo);
+  /** Analyze ELF object.  The cache takes ownership of it.  */
+  void Analyze_ELF(std::unique_ptr<ElfObject> eo);
+
+  /** Analyze the extract of an ELF object.  The cache takes ownership of it.  */
+  void Analyze_Extract(std::unique_ptr<ElfSymbolExtract> extract);
 
   /* Get symbol if available in the Dynsym table.  Or 0 if not available.  */
   inline unsigned char Get_Symbol_Info_Dynsym(const std::string &sym)
   {
-    auto container = DynsymMap.find(sym);
-    if (container != DynsymMap.end()) {
-      return container->second;
-    }
-    return 0;
+    return Get_Symbol_Info(Dynsyms, sym);
   }
 
   /** Get symbol if available in Symtab table.  Or 0 if not available.  */
   inline unsigned char Get_Symbol_Info_Symtab(const std::string &sym)
   {
-    auto container = SymtabMap.find(sym);
-    if (container != SymtabMap.end()) {
-      return container->second;
-    }
-    return 0;
+    return Get_Symbol_Info(Symtabs, sym);
   }
-
   /** Get symbol if available in either symtab.  Returns in which symtab this
       symbo was found.  */
   std::pair<unsigned char, ElfSymtabType> Get_Symbol_Info(const std::string &sym);
 
-  std::string Get_Symbol_Module(const std::string &)
+  const std::string &Get_Symbol_Module(const std::string &)
+  {
+    return Mod;
+  }
+
+  /** Get the name of the kernel module of the objects, or empty if they are
+      not kernel modules.  */
+  inline const std::string &Get_Module_Name(void) const
   {
     return Mod;
   }
@@ -403,15 +663,20 @@ class ElfSymbolCache
   void Dump_Cache(void);
 
   private:
-  /** The hash.  */
-  typedef std::unordered_map<std::string, unsigned char> SymbolTableHash;
-  void Insert_Symbols_Into_Hash(SymbolTableHash &map, ElfSection &section);
+  /** Get the info of `sym` in the last table of `tables` which has it, or 0
+      if none has it.  */
+  unsigned char Get_Symbol_Info(std::vector<ElfSymbolTable> &tables,
+                                const std::string &sym);
+
+  /** The ELF objects and extracts which the tables come from.  */
+  std::vector<std::unique_ptr<ElfObject>> Objects;
+  std::vector<std::unique_ptr<ElfSymbolExtract>> Extracts;
 
-  /** Hash symbols from dynsym into their value.  */
-  SymbolTableHash DynsymMap;
+  /** The dynsym tables, in the order the objects were analyzed.  */
+  std::vector<ElfSymbolTable> Dynsyms;
 
-  /** Hash symbols from symtab into their value.  */
-  SymbolTableHash SymtabMap;
+  /** The symtab tables, in the order the objects were analyzed.  */
+  std::vector<ElfSymbolTable> Symtabs;
 
   /** Kernel module name, if .modinfo section is present. */
   std::string Mod;
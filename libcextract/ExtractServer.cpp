@@ -0,0 +1,513 @@
+//===- ExtractServer.cpp - Keep clang-extract resident between runs -*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Keep clang-extract resident between runs.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ExtractServer.hh"
+#include "Error.hh"
+#include "PrettyPrint.hh"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <iostream>
+#include <stdexcept>
+
+/* How many InlineAnalysis and ASTs are kept resident.  A kernel
+   InlineAnalysis takes a lot of memory, so keep few of them.  */
+static const size_t MAX_RESIDENT_ANALYSES = 2;
+static const size_t MAX_RESIDENT_UNITS = 4;
+
+/* Requests larger than this are refused.  */
+static const uint32_t MAX_REQUEST_SIZE = 16 * 1024 * 1024;
+
+/** Sent by the client before the arguments.  It comes with the stdout and
+    stderr of the client.  */
+struct Request_Header
+{
+  char Magic[4];
+  uint32_t Size;
+};
+
+static const char REQUEST_MAGIC[4] = { 'C', 'E', 'S', '1' };
+
+static bool Read_All(int fd, void *buf, size_t size)
+{
+  char *p = (char *) buf;
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool Write_All(int fd, const void *buf, size_t size)
+{
+  const char *p = (const char *) buf;
+  while (size > 0) {
+    /* Don't get killed by SIGPIPE if the client is gone.  */
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static struct sockaddr_un Get_Socket_Address(const char *path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    throw std::runtime_error("Socket path is too long: " + std::string(path));
+  }
+  strcpy(addr.sun_path, path);
+
+  return addr;
+}
+
+static std::string Get_Cwd(void)
+{
+  char buf[PATH_MAX];
+  if (getcwd(buf, sizeof(buf)) == nullptr) {
+    throw std::runtime_error("Unable to get the working directory: " +
+                             std::string(strerror(errno)));
+  }
+  return std::string(buf);
+}
+
+/* Append `str` to the key, with a separator which can not be in it.  */
+static void Append_Key(std::string &key, const char *str)
+{
+  if (str) {
+    key += str;
+  }
+  key.push_back('\0');
+}
+
+/* Append the path and identity of the file at `path` to the key, so that the
+   resident objects are not used if the file changed.  */
+static void Append_File_Key(std::string &key, const char *path)
+{
+  Append_Key(key, path);
+
+  struct stat st;
+  if (path && stat(path, &st) == 0) {
+    key += std::to_string(st.st_size) + ':' +
+           std::to_string(st.st_mtim.tv_sec) + '.' +
+           std::to_string(st.st_mtim.tv_nsec);
+  }
+  key.push_back('\0');
+}
+
+ExtractServer::ExtractServer(const char *path)
+  : Path(path),
+    Cwd(Get_Cwd()),
+    Socket(-1)
+{
+  struct sockaddr_un addr = Get_Socket_Address(path);
+
+  /* The requests change the working directory.  */
+  if (Path[0] != '/') {
+    Path = Cwd + '/' + Path;
+  }
+
+  Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (Socket < 0) {
+    throw std::runtime_error("Unable to create socket: " +
+                             std::string(strerror(errno)));
+  }
+
+  /* Requests run as our user, in any directory the client wants, so only
+     our user may connect.  The socket is created with the umask, which is
+     the only portable way of setting its mode.  */
+  auto bind_private = [this, &addr](void) {
+    mode_t old_mask = umask(077);
+    int ret = bind(Socket, (struct sockaddr *) &addr, sizeof(addr));
+    int err = errno;
+    umask(old_mask);
+    errno = err;
+    return ret;
+  };
+
+  int ret = bind_private();
+  if (ret < 0 && errno == EADDRINUSE) {
+    /* Replace the socket if nobody is listening on it anymore.  */
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool stale = probe >= 0
+                 && connect(probe, (struct sockaddr *) &addr, sizeof(addr)) < 0
+                 && errno == ECONNREFUSED;
+    if (probe >= 0) {
+      close(probe);
+    }
+
+    if (!stale) {
+      close(Socket);
+      throw std::runtime_error("A server is already listening on " + Path);
+    }
+
+    unlink(path);
+    ret = bind_private();
+  }
+
+  if (ret < 0 || listen(Socket, 16) < 0) {
+    std::string err = strerror(errno);
+    close(Socket);
+    throw std::runtime_error("Unable to listen on " + Path + ": " + err);
+  }
+}
+
+ExtractServer::~ExtractServer(void)
+{
+  if (Socket >= 0) {
+    close(Socket);
+    unlink(Path.c_str());
+  }
+}
+
+int ExtractServer::Run(void)
+{
+  /* Writing to the stdout of a client which is gone must not kill us.  */
+  signal(SIGPIPE, SIG_IGN);
+
+  DiagsClass::Emit_Note("listening on " + Path);
+
+  while (true) {
+    int client = accept4(Socket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      DiagsClass::Emit_Error("Unable to accept connection: " +
+                             std::string(strerror(errno)));
+      return 1;
+    }
+
+    /* The mode of the socket may have been changed since, so check who is
+       connecting as well.  */
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0
+        || cred.uid != getuid()) {
+      DiagsClass::Emit_Warn("Refused a request from another user.");
+      close(client);
+      continue;
+    }
+
+    Handle_Client(client);
+    close(client);
+  }
+}
+
+void ExtractServer::Handle_Client(int client)
+{
+  Request_Header header;
+  int fds[2] = { -1, -1 };
+
+  /* Receive the header along with the stdout and stderr of the client.  */
+  struct iovec iov = { &header, sizeof(header) };
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  ssize_t n = recvmsg(client, &msg, MSG_CMSG_CLOEXEC);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+      && cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  }
+
+  auto close_fds = [&fds](void) {
+    for (int fd : fds) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  };
+
+  /* The header may have been split, but never the file descriptors.  */
+  if (n <= 0 || fds[0] < 0 || fds[1] < 0
+      || !Read_All(client, (char *) &header + n, sizeof(header) - n)
+      || memcmp(header.Magic, REQUEST_MAGIC, sizeof(REQUEST_MAGIC)) != 0
+      || header.Size > MAX_REQUEST_SIZE) {
+    close_fds();
+    return;
+  }
+
+  std::string payload(header.Size, '\0');
+  if (!Read_All(client, payload.data(), payload.size())) {
+    close_fds();
+    return;
+  }
+
+  /* The payload is the working directory of the client followed by its
+     arguments, all NUL terminated.  */
+  std::vector<char *> argv;
+  for (size_t i = 0; i < payload.size(); i += strlen(&payload[i]) + 1) {
+    argv.push_back(&payload[i]);
+  }
+  if (argv.size() < 2 || payload.back() != '\0') {
+    close_fds();
+    return;
+  }
+
+  std::string cwd = argv[0];
+  argv.erase(argv.begin());
+
+  /* Run the request writing to the stdout and stderr of the client.  */
+  llvm::outs().flush();
+  llvm::errs().flush();
+  std::cout.flush();
+  fflush(stdout);
+  fflush(stderr);
+
+  int saved_stdout = dup(STDOUT_FILENO);
+  int saved_stderr = dup(STDERR_FILENO);
+  dup2(fds[0], STDOUT_FILENO);
+  dup2(fds[1], STDERR_FILENO);
+  close_fds();
+
+  int32_t status;
+  if (chdir(cwd.c_str()) < 0) {
+    DiagsClass::Emit_Error("Unable to change to directory " + cwd + ": " +
+                           strerror(errno));
+    status = 1;
+  } else {
+    status = Run_Extraction(argv, cwd);
+  }
+
+  /* Make sure the output is complete before the client is told we are
+     done.  */
+  PrettyPrint::Close_Output_File();
+  llvm::outs().flush();
+  llvm::errs().flush();
+  std::cout.flush();
+  fflush(stdout);
+  fflush(stderr);
+
+  /* The client may be gone, which must not make the next requests fail.  */
+  llvm::outs().clear_error();
+  llvm::errs().clear_error();
+  std::cout.clear();
+  std::cerr.clear();
+
+  dup2(saved_stdout, STDOUT_FILENO);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stdout);
+  close(saved_stderr);
+
+  if (chdir(Cwd.c_str()) < 0) {
+    DiagsClass::Emit_Warn("Unable to go back to " + Cwd);
+  }
+
+  Write_All(client, &status, sizeof(status));
+}
+
+int ExtractServer::Run_Extraction(std::vector<char *> &argv,
+                                  const std::string &cwd)
+{
+  try {
+    ArgvParser args(argv.size(), argv.data());
+
+    if (args.Should_Print_Help()) {
+      args.Print_Usage_Message();
+      return 0;
+    }
+
+    if (args.Get_Functions_To_Extract().size() == 0) {
+      DiagsClass::Emit_Error("No function to extract.\n"
+                             "pass -DCE_EXTRACT_FUNCTIONS=func<1>,...,func<n> to determine which functions to extract.");
+      return 1;
+    }
+
+    /* Fail like Run_Passes does if the files can not be loaded.  */
+    InlineAnalysis *ia;
+    try {
+      ia = &Get_Inline_Analysis(args, cwd);
+    } catch (std::runtime_error &err) {
+      DiagsClass::Emit_Error(err.what());
+      return -1;
+    }
+
+    ResidentAST &unit = Get_Resident_AST(args, cwd);
+
+    return PassManager().Run_Passes(args, ia, &unit);
+  } catch (std::runtime_error &err) {
+    DiagsClass::Emit_Error(err.what());
+    return 1;
+  }
+}
+
+/* Find the element with `key` in `list` and move it to the front, or else
+   add a new one there, dropping the least recently used ones beyond `max`.  */
+template <typename T>
+static T &Lookup_LRU(std::list<T> &list, const std::string &key, size_t max)
+{
+  for (auto it = list.begin(); it != list.end(); ++it) {
+    if (it->Key == key) {
+      list.splice(list.begin(), list, it);
+      return list.front();
+    }
+  }
+
+  while (list.size() >= max) {
+    list.pop_back();
+  }
+
+  list.emplace_front();
+  list.front().Key = key;
+  return list.front();
+}
+
+InlineAnalysis &ExtractServer::Get_Inline_Analysis(ArgvParser &args,
+                                                   const std::string &cwd)
+{
+  std::string key;
+  Append_Key(key, cwd.c_str());
+  for (const std::string &path : args.Get_Debuginfo_Path()) {
+    Append_File_Key(key, path.c_str());
+  }
+  Append_Key(key, args.Get_Debuginfo_Cache_Path());
+  Append_File_Key(key, args.Get_Ipaclones_Path());
+  Append_File_Key(key, args.Get_Symvers_Path());
+  Append_File_Key(key, args.Get_Kernel_Index_Path());
+  Append_Key(key, args.Is_Kernel() ? "kernel" : "");
+
+  ResidentAnalysis &resident = Lookup_LRU(Analyses, key, MAX_RESIDENT_ANALYSES);
+  if (!resident.IA) {
+    try {
+      resident.IA = std::make_unique<InlineAnalysis>(args.Get_Debuginfo_Path(),
+                                                     args.Get_Ipaclones_Path(),
+                                                     args.Get_Symvers_Path(),
+                                                     args.Is_Kernel(),
+                                                     args.Get_Debuginfo_Cache_Path(),
+                                                     args.Get_Kernel_Index_Path());
+    } catch (...) {
+      Analyses.pop_front();
+      throw;
+    }
+  }
+
+  return *resident.IA;
+}
+
+ResidentAST &ExtractServer::Get_Resident_AST(ArgvParser &args,
+                                             const std::string &cwd)
+{
+  /* Diagnostics are configured when the AST is built, so an AST built
+     ignoring errors can not be used by requests that don't.  */
+  std::string key;
+  Append_Key(key, cwd.c_str());
+  Append_Key(key, args.Get_Ignore_Clang_Errors() ? "ignore-errors" : "");
+  for (const char *arg : args.Get_Args_To_Clang()) {
+    Append_Key(key, arg);
+  }
+
+  return Lookup_LRU(Units, key, MAX_RESIDENT_UNITS).Unit;
+}
+
+bool ExtractServer::Send_Request(const char *path, int argc, char **argv,
+                                 int &status)
+{
+  struct sockaddr_un addr = Get_Socket_Address(path);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    throw std::runtime_error("Unable to create socket: " +
+                             std::string(strerror(errno)));
+  }
+
+  if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    close(sock);
+    return false;
+  }
+
+  std::string payload = Get_Cwd();
+  payload.push_back('\0');
+  for (int i = 0; i < argc; i++) {
+    payload += argv[i];
+    payload.push_back('\0');
+  }
+
+  if (payload.size() > MAX_REQUEST_SIZE) {
+    close(sock);
+    throw std::runtime_error("Too many arguments to send to the server");
+  }
+
+  Request_Header header;
+  memcpy(header.Magic, REQUEST_MAGIC, sizeof(REQUEST_MAGIC));
+  header.Size = payload.size();
+
+  /* Send the header along with our stdout and stderr, which the server
+     writes to.  */
+  int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+  struct iovec iov = { &header, sizeof(header) };
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  int32_t answer;
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(header)
+      || !Write_All(sock, payload.data(), payload.size())
+      || !Read_All(sock, &answer, sizeof(answer))) {
+    close(sock);
+    throw std::runtime_error("The server at " + std::string(path) +
+                             " did not answer the request");
+  }
+
+  close(sock);
+  status = answer;
+  return true;
+}
@@ -0,0 +1,98 @@
+//===- ExtractServer.hh - Keep clang-extract resident between runs -*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Keep clang-extract resident between runs.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "ArgvParser.hh"
+#include "InlineAnalysis.hh"
+#include "Passes.hh"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** @brief Server which runs clang-extract requests sent over a Unix socket.
+ *
+ * Most of the time of an extraction goes to loading the debuginfo,
+ * ipa-clones and symvers, and to parsing the translation unit, which are
+ * the same from one run to the next while developing a livepatch.  The
+ * server is started with `clang-extract --serve <socket>` and keeps the
+ * InlineAnalysis and the ASTs of the last translation units in memory.  A
+ * request for a resident translation unit only reparses it, with the files
+ * which did not change kept in memory by CachingFileSystem.
+ *
+ * Requests are sent by `clang-extract --connect <socket> <ARGS>`, which
+ * takes the same arguments as clang-extract.  They are run one at a time, in
+ * the working directory of the client and writing to its stdout and stderr,
+ * and the client exits with the status of the request.  Only the user
+ * running the server may connect to it.
+ */
+class ExtractServer
+{
+  public:
+  /** Listen on the Unix socket at `path`.  A stale socket left by a server
+      which is gone is replaced.  */
+  ExtractServer(const char *path);
+  ~ExtractServer(void);
+
+  ExtractServer(const ExtractServer &) = delete;
+
+  /** Answer requests until the server is killed.  Only returns on error.  */
+  int Run(void);
+
+  /** Send the request to run clang-extract with `argv` to the server
+      listening at `path` and wait for it to set `status` to the exit status
+      of the request.  Returns false if no server is listening at `path`.  */
+  static bool Send_Request(const char *path, int argc, char **argv,
+                           int &status);
+
+  private:
+  /** Read the request from `client`, run it and send back its status.  */
+  void Handle_Client(int client);
+
+  /** Run clang-extract with `argv`, as main does.  */
+  int Run_Extraction(std::vector<char *> &argv, const std::string &cwd);
+
+  /** Get the InlineAnalysis of the files given in `args`, loading them if
+      they are not resident or changed since they were loaded.  */
+  InlineAnalysis &Get_Inline_Analysis(ArgvParser &args, const std::string &cwd);
+
+  /** Get where the AST of the translation unit given in `args` is kept.  */
+  ResidentAST &Get_Resident_AST(ArgvParser &args, const std::string &cwd);
+
+  struct ResidentAnalysis
+  {
+    std::string Key;
+    std::unique_ptr<InlineAnalysis> IA;
+  };
+
+  struct ResidentUnit
+  {
+    std::string Key;
+    ResidentAST Unit;
+  };
+
+  /** The resident objects, the most recently used first.  */
+  std::list<ResidentAnalysis> Analyses;
+  std::list<ResidentUnit> Units;
+
+  /** Path to the socket.  */
+  std::string Path;
+
+  /** Working directory of the server, restored after each request.  */
+  std::string Cwd;
+
+  /** The listening socket.  */
+  int Socket;
+};
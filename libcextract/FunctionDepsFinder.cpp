@@ -26,7 +26,7 @@ FunctionDependencyFinder::FunctionDependencyFinder(PassManager::Context *ctx)
     : AST(ctx->AST.get()),
       IT(AST, ctx->IncExpansionPolicy, ctx->HeadersToExpand, ctx->HeadersToNotExpand),
       KeepIncludes(ctx->KeepIncludes),
-      Visitor(AST)
+      Visitor(AST, ctx->OpaqueTypes)
 {
 }
 
@@ -320,3 +320,23 @@ bool FunctionDependencyFinder::Run_Analysis(std::vector<std::string> const &func
 
   return ret;
 }
+
+std::vector<std::string> FunctionDependencyFinder::Get_Functions_With_Skipped_Body(void)
+{
+  std::vector<std::string> names;
+
+  for (Decl *decl : Visitor.Get_Closure().Get_Set()) {
+    FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl);
+    if (fdecl && fdecl->hasSkippedBody()) {
+      names.push_back(fdecl->getNameAsString());
+    }
+  }
+
+  return names;
+}
+
+ClosureFingerprint FunctionDependencyFinder::Get_Fingerprint(InlineAnalysis &ia)
+{
+  return ClosureFingerprint(AST, Visitor.Get_Closure().Get_Set(), IT,
+                            KeepIncludes, ia);
+}
@@ -19,6 +19,7 @@
 #include "IncludeTree.hh"
 #include "PrettyPrint.hh"
 #include "Closure.hh"
+#include "ClosureFingerprint.hh"
 #include "Passes.hh"
 
 #include <clang/Tooling/Tooling.h>
@@ -63,6 +64,13 @@ class FunctionDependencyFinder
     /** Run the analysis on function `function`*/
     bool Run_Analysis(std::vector<std::string> const &function);
 
+    /** Get the names of the functions in the closure whose bodies were
+        skipped when parsing.  */
+    std::vector<std::string> Get_Functions_With_Skipped_Body(void);
+
+    /** Get the fingerprint of the closure.  */
+    ClosureFingerprint Get_Fingerprint(InlineAnalysis &ia);
+
   protected:
 
     /** Given a list of functions in `funcnames`, compute the closure of those
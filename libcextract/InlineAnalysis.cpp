@@ -21,13 +21,19 @@
 #include <stdlib.h>
 #include <cxxabi.h>
 #include <stdexcept>
+#include <cassert>
+#include <future>
+#include <memory>
 
 InlineAnalysis::InlineAnalysis(const std::vector<std::string> &elfs_path,
                                const char *ipaclones_path,
-                               const char *symvers_path, bool is_kernel)
+                               const char *symvers_path, bool is_kernel,
+                               const char *debuginfo_cache,
+                               const char *kernel_index)
   : ElfCache(nullptr),
     Ipa(nullptr),
     Symv(nullptr),
+    KernelIndex(nullptr),
     Kernel(is_kernel)
 {
   try {
@@ -38,19 +44,72 @@ InlineAnalysis::InlineAnalysis(const std::vector<std::string> &elfs_path,
       ElfCache = new ElfSymbolCache();
     }
 
-    /* Initialize the SymbolCache.  */
-    for (auto it = elfs_path.begin(); it != elfs_path.end(); ++it) {
-      const std::string &path = *it;
-      ElfObject elf(path);
-      ElfCache->Analyze_ELF(elf);
+    /* Every source is opened on its own thread, as each one may be a large
+       file to decompress or parse.  The futures are waited for even if one
+       of them throws, as they are destroyed when leaving this block.  */
+    struct LoadedElf
+    {
+      std::unique_ptr<ElfObject> Object;
+      std::unique_ptr<ElfSymbolExtract> Extract;
+    };
+
+    std::vector<std::future<LoadedElf>> elfs;
+    for (const std::string &path : elfs_path) {
+      elfs.push_back(std::async(std::launch::async, [&path, debuginfo_cache](void) {
+        LoadedElf elf;
+        /* Only compressed objects are slow enough to be worth caching.  */
+        if (!is_null_or_empty(debuginfo_cache)
+            && ElfSymbolExtract::Is_Compressed(path)) {
+          elf.Extract = std::make_unique<ElfSymbolExtract>(path, debuginfo_cache);
+        } else {
+          elf.Object = std::make_unique<ElfObject>(path);
+        }
+        return elf;
+      }));
     }
 
+    std::future<std::unique_ptr<IpaClones>> ipa;
     if (ipaclones_path) {
-      Ipa = new IpaClones(ipaclones_path);
+      ipa = std::async(std::launch::async, [ipaclones_path](void) {
+        return std::make_unique<IpaClones>(ipaclones_path);
+      });
     }
 
+    std::future<std::unique_ptr<Symvers>> symv;
     if (symvers_path) {
-      Symv = new Symvers(symvers_path);
+      symv = std::async(std::launch::async, [symvers_path](void) {
+        return std::make_unique<Symvers>(symvers_path);
+      });
+    }
+
+    std::future<std::unique_ptr<KernelSymbolIndex>> kidx;
+    if (kernel_index) {
+      kidx = std::async(std::launch::async, [kernel_index](void) {
+        return std::make_unique<KernelSymbolIndex>(kernel_index);
+      });
+    }
+
+    /* Initialize the SymbolCache.  The objects are added in the order they
+       were given, as later ones take precedence.  */
+    for (std::future<LoadedElf> &future : elfs) {
+      LoadedElf elf = future.get();
+      if (elf.Extract) {
+        ElfCache->Analyze_Extract(std::move(elf.Extract));
+      } else {
+        ElfCache->Analyze_ELF(std::move(elf.Object));
+      }
+    }
+
+    if (ipa.valid()) {
+      Ipa = ipa.get().release();
+    }
+
+    if (symv.valid()) {
+      Symv = symv.get().release();
+    }
+
+    if (kidx.valid()) {
+      KernelIndex = kidx.get().release();
     }
   } catch (std::runtime_error &e) {
     /* So what happens if this constructor throws an exception (like file not
@@ -73,101 +132,80 @@ InlineAnalysis::~InlineAnalysis(void)
     delete Ipa;
   if (Symv)
     delete Symv;
+  if (KernelIndex)
+    delete KernelIndex;
 }
 
-static int Action_Add_Node2(void *s, IpaCloneNode *n1, IpaCloneNode *n2)
+/* Get the names of the nodes in `nodes`.  */
+static std::set<std::string> Get_Names(const IpaClones &ipa,
+                                       const std::vector<uint32_t> &nodes)
 {
-  (void) n1;
-
-  std::set<std::string> *set = static_cast<std::set<std::string> *>(s);
-  set->insert(n2->Name);
+  std::set<std::string> set;
+  for (uint32_t node : nodes) {
+    set.insert(std::string(ipa.Get_Name(node)));
+  }
 
-  return 0;
+  return set;
 }
 
 std::set<std::string> InlineAnalysis::Get_Inline_Closure_Of_Symbol(const std::string &asm_name)
 {
-  std::set<std::string> set;
-
-  /* If we don't have the IPA information there is nothing we can do.  */
-  if (Ipa == nullptr) {
-    return set;
-  }
-
-  IpaClosure(*Ipa, (void*) &set, Action_Add_Node2).Find_Inlined_Symbols(asm_name);
-  return set;
+  return Get_Inline_Closure_Of_Symbols({asm_name});
 }
 
 std::set<std::string> InlineAnalysis::Get_Inline_Closure_Of_Symbols(const std::vector<std::string> &symbols)
 {
-  std::set<std::string> set;
   /* If we don't have the IPA information there is nothing we can do.  */
   if (Ipa == nullptr) {
-    return set;
+    return std::set<std::string>();
   }
 
-  IpaClosure closure(*Ipa, (void*) &set, Action_Add_Node2);
-  for (const std::string &sym : symbols) {
-    closure.Find_Inlined_Symbols(sym);
-  }
+  IpaClosure closure(*Ipa);
+  closure.Find_Inlined_Symbols(symbols);
 
-  return set;
+  return Get_Names(*Ipa, closure.Found);
 }
 
 std::set<std::string> InlineAnalysis::Get_Where_Symbol_Is_Inlined(const std::string &asm_name)
 {
-  std::set<std::string> set;
-  /* If we don't have the IPA information there is nothing we can do.  */
-  if (Ipa == nullptr) {
-    return set;
-  }
-
-  IpaClosure(*Ipa, (void *) &set, Action_Add_Node2)
-    .Find_Where_Symbol_Is_Inlined(asm_name);
-
-  return set;
+  return Get_Where_Symbols_Is_Inlined({asm_name});
 }
 
 std::set<std::string> InlineAnalysis::Get_Where_Symbols_Is_Inlined(const std::vector<std::string> &symbols)
 {
-  std::set<std::string> set;
-
   /* If we don't have the IPA information there is nothing we can do.  */
   if (Ipa == nullptr) {
-    return set;
+    return std::set<std::string>();
   }
 
-  IpaClosure closure(*Ipa, (void *) &set, Action_Add_Node2);
-  for (const std::string &sym : symbols) {
-    closure.Find_Where_Symbol_Is_Inlined(sym);
-  }
+  IpaClosure closure(*Ipa);
+  closure.Find_Where_Symbols_Are_Inlined(symbols);
 
-  return set;
+  return Get_Names(*Ipa, closure.Found);
 }
 
-static int Action_Graphviz(void *s, IpaCloneNode *n1, IpaCloneNode *n2)
+/* Print the edge from `n1` to `n2` in graphviz format.  */
+static void Print_Graphviz_Edge(FILE *file, std::string_view n1, std::string_view n2)
 {
-  FILE *file = static_cast<FILE*>(s);
-
-  const char *name1 = InlineAnalysis::Demangle_Symbol(n1->Name.c_str());
-  const char *name2 = InlineAnalysis::Demangle_Symbol(n2->Name.c_str());
+  const char *name1 = InlineAnalysis::Demangle_Symbol(n1.data());
+  const char *name2 = InlineAnalysis::Demangle_Symbol(n2.data());
   fprintf(file, "\n\"%s\" -> \"%s\"", name1, name2);
 
   free(name1);
   free(name2);
-  return 0;
 }
 
 
-void InlineAnalysis::Print_Node_Colors(const std::set<IpaCloneNode *> &set, FILE *fp)
+void InlineAnalysis::Print_Node_Colors(const std::vector<uint32_t> &nodes, FILE *fp)
 {
   if (!Have_Debuginfo()) {
     return;
   }
 
-  for (IpaCloneNode *node : set) {
-    const char *demangled = InlineAnalysis::Demangle_Symbol(node->Name.c_str());
-    std::pair<unsigned char, ElfSymtabType> infos = Get_Symbol_Info(node->Name);
+  for (uint32_t node : nodes) {
+    std::string_view name = Ipa->Get_Name(node);
+    const char *demangled = InlineAnalysis::Demangle_Symbol(name.data());
+    std::pair<unsigned char, ElfSymtabType> infos = Get_Symbol_Info(std::string(name));
     unsigned char syminfo = infos.first;
     ElfSymtabType symtab = infos.second;
     if (syminfo == 0) {
@@ -201,30 +239,21 @@ void InlineAnalysis::Get_Graphviz_Of_Inlines(const std::vector<std::string> &sym
   }
 
   fprintf(file, "strict digraph {");
-  IpaClosure closure(*Ipa, (void *) file, Action_Graphviz);
-  for (const std::string &sym : symbols) {
-    closure.Find_Where_Symbol_Is_Inlined(sym);
+  IpaClosure closure(*Ipa);
+  closure.Find_Where_Symbols_Are_Inlined(symbols);
+
+  for (uint32_t node : closure.Visited) {
+    for (uint32_t n : Ipa->Get_Inlined_Into(node)) {
+      Print_Graphviz_Edge(file, Ipa->Get_Name(node), Ipa->Get_Name(n));
+    }
   }
 
-  Print_Node_Colors(closure.Set, file);
+  Print_Node_Colors(closure.Visited, file);
 
   fprintf(file, "\n}");
   fclose(file);
 }
 
-static int Action_Graphviz_Reverse(void *s, IpaCloneNode *n1, IpaCloneNode *n2)
-{
-  FILE *file = static_cast<FILE*>(s);
-  const char *name1 = InlineAnalysis::Demangle_Symbol(n2->Name.c_str());
-  const char *name2 = InlineAnalysis::Demangle_Symbol(n1->Name.c_str());
-
-  fprintf(file, "\n\"%s\" -> \"%s\"", name1, name2);
-
-  free(name1);
-  free(name2);
-  return 0;
-}
-
 void InlineAnalysis::Get_Graphviz_Of_Inline_Closure(const std::vector<std::string> &symbols, const char *output_path)
 {
   FILE *file = fopen(output_path, "w");
@@ -235,12 +264,16 @@ void InlineAnalysis::Get_Graphviz_Of_Inline_Closure(const std::vector<std::strin
   }
 
   fprintf(file, "strict digraph {");
-  IpaClosure closure(*Ipa, (void *) file, Action_Graphviz_Reverse);
-  for (const std::string &sym : symbols) {
-    closure.Find_Inlined_Symbols(sym);
+  IpaClosure closure(*Ipa);
+  closure.Find_Inlined_Symbols(symbols);
+
+  for (uint32_t node : closure.Visited) {
+    for (uint32_t n : Ipa->Get_Inlines(node)) {
+      Print_Graphviz_Edge(file, Ipa->Get_Name(n), Ipa->Get_Name(node));
+    }
   }
 
-  Print_Node_Colors(closure.Set, file);
+  Print_Node_Colors(closure.Visited, file);
 
   fprintf(file, "\n}");
   fclose(file);
@@ -261,13 +294,36 @@ InlineAnalysis::Get_Symbol_Info(const std::string &sym)
 {
   /* Try the dynsym first, which means this symbol is most likely publically
      visible.  */
-  if (ElfCache == nullptr) {
-    /* If we don't have the ElfCache there is nothing we can do.  */
-    return std::make_pair(0, ElfSymtabType::TAB_NONE);
+  if (ElfCache) {
+    /* Forward this to ElfCXX.  */
+    auto infos = ElfCache->Get_Symbol_Info(sym);
+    if (infos.first > 0) {
+      return infos;
+    }
+  }
+
+  /* The symbol is not in the object being patched, so look for it in the
+     rest of the kernel.  */
+  if (KernelIndex) {
+    const KernelSymbolIndex::Definition *def =
+      KernelIndex->Find_Definition(sym, Get_Patched_Module());
+    if (def) {
+      return std::make_pair(def->Info, (ElfSymtabType) def->Symtab);
+    }
+  }
+
+  /* If we don't have the symbol there is nothing we can do.  */
+  return std::make_pair(0, ElfSymtabType::TAB_NONE);
+}
+
+std::string_view InlineAnalysis::Get_Patched_Module(void)
+{
+  if (ElfCache && !ElfCache->Get_Module_Name().empty()) {
+    return ElfCache->Get_Module_Name();
   }
 
-  /* Forward this to ElfCXX.  */
-  return ElfCache->Get_Symbol_Info(sym);
+  /* Objects without .gnu.linkonce.this_module are vmlinux.  */
+  return "vmlinux";
 }
 
 static const char *Bind(unsigned link, ElfSymtabType symtab)
@@ -302,7 +358,7 @@ static const char *Bind(unsigned link, ElfSymtabType symtab)
 ExternalizationType InlineAnalysis::Needs_Externalization(const std::string &sym)
 {
   if (Symv) {
-    const std::string &sym_mod = Symv->Get_Symbol_Module(sym);
+    std::string_view sym_mod = Symv->Get_Symbol_Module(sym);
     /* If the symbol comes from vmlinux, then we should use Weak
      * externalization, since the symbol is always present when loading the
      * livepatch. */
@@ -381,9 +437,8 @@ std::set<std::string> InlineAnalysis::Get_All_Symbols(void)
   }
 
   if (Ipa) {
-    for (auto node_map : *Ipa) {
-      const std::string &sym = node_map.first;
-      set.insert(sym);
+    for (uint32_t id = 0; id < Ipa->Get_Num_Nodes(); id++) {
+      set.insert(std::string(Ipa->Get_Name(id)));
     }
   }
 
@@ -392,13 +447,18 @@ std::set<std::string> InlineAnalysis::Get_All_Symbols(void)
 	    set.insert(sym);
   }
 
+  if (KernelIndex) {
+    for (auto &sym : KernelIndex->Get_All_Symbols())
+	    set.insert(sym);
+  }
+
   return set;
 }
 
 void InlineAnalysis::Print_Symbol_Set(const std::set<std::string> &symbol_set,
                                       bool csv, FILE *out)
 {
-  bool have_debuginfo = Have_Debuginfo();
+  bool have_debuginfo = Have_Debuginfo() || Have_Kernel_Index();
   size_t max_symbol_chars = 15;
   size_t max_symbol_chars_mangled = 15;
   size_t num_symbols = symbol_set.size();
@@ -490,7 +550,8 @@ void InlineAnalysis::Print_Symbol_Set(const std::set<std::string> &symbol_set,
         fprintf(out,"%s\t%s\n", type_str, bind_str);
       }
     } else if (Symv) {
-      fprintf(out, "%s\n", Symv->Get_Symbol_Module(s).c_str());
+      std::string_view mod = Symv->Get_Symbol_Module(s);
+      fprintf(out, "%.*s\n", (int) mod.size(), mod.data());
     } else {
       fprintf(out,"\n");
     }
@@ -516,15 +577,23 @@ const char *InlineAnalysis::Demangle_Symbol(const char *symbol)
  * Check if Kernel module was found on Symvers or ELF object. Returns empty is
  * the module was not found, or if the LP is not from a kernel source.
  */
-std::string InlineAnalysis::Get_Symbol_Module(std::string sym)
+std::string_view InlineAnalysis::Get_Symbol_Module(const std::string &sym)
 {
-  std::string mod;
   if (Symv) {
-    mod = Symv->Get_Symbol_Module(sym);
+    std::string_view mod = Symv->Get_Symbol_Module(sym);
     if (!mod.empty())
       return mod;
   }
 
+  /* Symbols which are not exported are found in the index of the kernel
+     build, which tells which object defines them.  */
+  if (KernelIndex) {
+    const KernelSymbolIndex::Definition *def =
+      KernelIndex->Find_Definition(sym, Get_Patched_Module());
+    if (def)
+      return KernelIndex->Get_Module_Name(def->Module);
+  }
+
   if (Have_Debuginfo())
     return ElfCache->Get_Symbol_Module(sym);
 
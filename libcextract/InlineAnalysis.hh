@@ -25,6 +25,7 @@
 
 #include "ElfCXX.hh"
 #include "IpaClonesParser.hh"
+#include "KernelSymbolIndex.hh"
 #include "SymversParser.hh"
 
 #include <set>
@@ -32,8 +33,6 @@
 #include <vector>
 #include <stdio.h>
 
-struct IpaCloneNode;
-
 enum ExternalizationType {
   NONE = 0,
   WEAK,
@@ -47,17 +46,24 @@ class InlineAnalysis
   /** Build the analysis class.  elf_path can be NULL if there is no debuginfo
       available, and ipaclone_path can be a directory full of many ipa-clones
       generated through LTO or not. Symvers can be NULL is we are creating a
-      userspace livepatch   */
+      userspace livepatch.  If debuginfo_cache is not NULL, the symbols of
+      compressed debuginfo files are cached in that directory.  kernel_index
+      can be the path to a KernelSymbolIndex of the whole kernel build, used
+      for symbols which are not in the debuginfo.  */
   InlineAnalysis(const std::vector<std::string> &elfs_path,
                  const char *ipaclone_path, const char *symvers_path,
-                 bool is_kernel);
+                 bool is_kernel, const char *debuginfo_cache = nullptr,
+                 const char *kernel_index = nullptr);
 
   InlineAnalysis(const char *elf_path, const char *ipaclone_path,
-                 const char *symvers_path, bool is_kernel)
+                 const char *symvers_path, bool is_kernel,
+                 const char *debuginfo_cache = nullptr,
+                 const char *kernel_index = nullptr)
     : InlineAnalysis(elf_path == nullptr ?
                      std::vector<std::string>() :
                      std::vector<std::string>({elf_path}),
-                     ipaclone_path, symvers_path, is_kernel)
+                     ipaclone_path, symvers_path, is_kernel, debuginfo_cache,
+                     kernel_index)
   {}
 
   ~InlineAnalysis(void);
@@ -137,9 +143,15 @@ class InlineAnalysis
     return Symv;
   }
 
+  /** Check if we have the index of the symbols of the kernel build.  */
+  inline bool Have_Kernel_Index(void)
+  {
+    return KernelIndex;
+  }
+
   inline bool Can_Decide_Visibility(void)
   {
-    return Have_Debuginfo() || Have_Symvers();
+    return Have_Debuginfo() || Have_Symvers() || Have_Kernel_Index();
   }
 
   /** Dump for debugging concerns.  */
@@ -162,14 +174,19 @@ class InlineAnalysis
     return Demangle_Symbol(symbol.c_str());
   }
 
-  std::string Get_Symbol_Module(std::string sym);
+  std::string_view Get_Symbol_Module(const std::string &sym);
 
   private:
+  /** Get the name of the module being patched, which is vmlinux if the
+      debuginfo is not of a module.  */
+  std::string_view Get_Patched_Module(void);
+
   /** Put color information in the graphviz .DOT file.  */
-  void Print_Node_Colors(const std::set<IpaCloneNode *> &set, FILE *fp);
+  void Print_Node_Colors(const std::vector<uint32_t> &nodes, FILE *fp);
 
   ElfSymbolCache *ElfCache;
   IpaClones *Ipa;
   Symvers *Symv;
+  KernelSymbolIndex *KernelIndex;
   bool Kernel;
 };
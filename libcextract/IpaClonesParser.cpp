@@ -24,6 +24,11 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <limits.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
 
 /* GCC can either:
     - Change the call ABI of a function to either reduce the stack
@@ -39,43 +44,145 @@
       are suffixed as `.part.%d` and is again not safe to call either.
       So we model those functions as being inlined, forcing clang-extract
       to issue a copy of it into the livepatch.  */
-static const char *Handle_GCC_Symbol_Quirks(char *symbol)
+static std::string_view Handle_GCC_Symbol_Quirks(std::string_view symbol)
 {
-  char *first_dot = strchr(symbol, '.');
-  if (first_dot == nullptr) {
+  size_t first_dot = symbol.find('.');
+  if (first_dot == std::string_view::npos) {
     return symbol;
   }
 
-  if (prefix(".part.", first_dot)) {
+  std::string_view suffix = symbol.substr(first_dot);
+
+  if (suffix.starts_with(".part.")) {
     /* Symbol generated by ipa-split.c pass.  Erase the .part.  */
-    *first_dot = '\0';
-    return symbol;
+    return symbol.substr(0, first_dot);
   }
 
-  if (prefix(".isra.", first_dot)) {
+  if (suffix.starts_with(".isra.")) {
     /* Symbol generated by ipa-isra.c pass.  Erase the .isra.  */
-    *first_dot = '\0';
-    return symbol;
+    return symbol.substr(0, first_dot);
   }
 
   return symbol;
 }
 
+/* Get the next field of `line`, which are separated by ';', and advance
+   `line` past it.  */
+static inline std::string_view Next_Field(std::string_view &line)
+{
+  size_t semicolon = line.find(';');
+  std::string_view field = line.substr(0, semicolon);
+
+  if (semicolon == std::string_view::npos) {
+    line = std::string_view();
+  } else {
+    line.remove_prefix(semicolon + 1);
+  }
+
+  return field;
+}
+
+/** Check if `line` describes an inline edge and get its callee and caller.
+
+    Based on the following function, extracted from GCC source:
+
+     void
+     dump_callgraph_transformation (const cgraph_node *original,
+                  const cgraph_node *clone,
+                  const char *suffix)
+     {
+       if (symtab->ipa_clones_dump_file)
+         {
+           fprintf (symtab->ipa_clones_dump_file,
+              "Callgraph clone;%s;%d;%s;%d;%d;%s;%d;%s;%d;%d;%s\n",
+              original->asm_name (), original->order,
+              DECL_SOURCE_FILE (original->decl),
+              DECL_SOURCE_LINE (original->decl),
+              DECL_SOURCE_COLUMN (original->decl), clone->asm_name (),
+              clone->order, DECL_SOURCE_FILE (clone->decl),
+              DECL_SOURCE_LINE (clone->decl), DECL_SOURCE_COLUMN (clone->decl),
+              suffix);
+
+           symtab->cloned_nodes.add (original);
+           symtab->cloned_nodes.add (clone);
+         }
+     }
+
+    Only the names and the suffix are used, so the other fields are skipped
+    without being converted.  */
+static bool Parse_Inline_Edge(std::string_view line, std::string_view &callee,
+                              std::string_view &caller)
+{
+  /* "Callgraph removal" lines have no edges.  */
+  if (Next_Field(line) != "Callgraph clone") {
+    return false;
+  }
+
+  std::string_view original_asm_name = Next_Field(line);
+
+  /* Skip order, file, line and column of the original.  */
+  for (int i = 0; i < 4; i++) {
+    Next_Field(line);
+  }
+
+  std::string_view clone_asm_name = Next_Field(line);
+
+  /* Skip order, file, line and column of the clone.  */
+  for (int i = 0; i < 4; i++) {
+    Next_Field(line);
+  }
+
+  std::string_view happened = Next_Field(line);
+
+  if (happened == "inlining to") {
+    caller = Handle_GCC_Symbol_Quirks(clone_asm_name);
+    callee = Handle_GCC_Symbol_Quirks(original_asm_name);
+
+    /* Inlining a symbol to itself makes no sense.  Yet this can happen if
+       they were actually two symbols that we merged into one on
+       Handle_GCC_Symbol_Quirks.  */
+    return callee != caller;
+  }
+
+  if (happened == "isra") {
+    caller = clone_asm_name;
+    callee = original_asm_name;
+    return true;
+  }
+
+  return false;
+}
+
 IpaClones::IpaClones(const char *path)
-    : Parser(path)
+    : Parser(path),
+      NumNodes(0),
+      NumEdges(0)
 {
   const char *object_path = this->parser_path.c_str();
 
   if (Is_Directory(object_path) == false) {
+    if (Is_Index_File(object_path)) {
+      Load_Index(object_path);
+      return;
+    }
+
     /* Single file.  We can pass it directly to Parse.  */
     Parse(path);
+    Build_Graph();
     return;
   }
 
-  Open_Recursive(object_path);
+  std::vector<std::string> files;
+  Open_Recursive(object_path, files);
+
+  /* readdir returns the files in whatever order the filesystem has them.
+     Sort them so the graph is built the same way on every run.  */
+  std::sort(files.begin(), files.end());
+  Parse(files);
+  Build_Graph();
 }
 
-void IpaClones::Open_Recursive(const char *path)
+void IpaClones::Open_Recursive(const char *path, std::vector<std::string> &files)
 {
   /* Else we have to parse the directory tree.  */
   DIR *directory = opendir(path);
@@ -113,159 +220,215 @@ void IpaClones::Open_Recursive(const char *path)
     const char *extension = strrchr(file, '.');
     if (extension && strcmp(extension, ".ipa-clones") == 0) {
       strcpy(buffer_after_slash, file);
-      Parse(buffer);
+      files.push_back(buffer);
       continue;
     }
 
     /* If path is a directory, then analyze it recursively.  */
     strcpy(buffer_after_slash, file);
     if (Is_Directory(buffer)) {
-      Open_Recursive(buffer);
+      Open_Recursive(buffer, files);
     }
   }
   closedir(directory);
 }
 
-const char *IpaClones::LexingState::Lex(void)
+void IpaClones::Parse(const char *path)
 {
-  char *str = strtok(CurrentStateString, ";");
-
-  /* Passing the nullptr to strtok on next iteration results in it calling
-     strtok into the correct offset of the original pointer.  For more info,
-     see `man strtok`.  */
-  CurrentStateString = nullptr;
-  return str;
+  Parse(path, Parsed);
 }
 
-IpaClones::IpaDecision IpaClones::LexingState::Get_Decision(const char *str)
+void IpaClones::Parse(const std::vector<std::string> &paths)
 {
-  if (!strcmp(str, "Callgraph removal")) {
-    return IPA_REMOVE;
+  /* Files are parsed in chunks, each one into its own partial graph.  The
+     partial graphs are then merged in the order of the chunks, so the result
+     does not depend on which thread parsed what.  */
+  const size_t chunk_size = 16;
+  size_t num_chunks = (paths.size() + chunk_size - 1) / chunk_size;
+
+  std::vector<PartialGraph> graphs(num_chunks);
+  std::vector<std::exception_ptr> errors(num_chunks);
+  std::atomic<size_t> next_chunk(0);
+
+  auto worker = [&](void) {
+    size_t chunk;
+    while ((chunk = next_chunk.fetch_add(1)) < num_chunks) {
+      size_t end = std::min(paths.size(), (chunk + 1) * chunk_size);
+      try {
+        for (size_t i = chunk * chunk_size; i < end; i++) {
+          Parse(paths[i].c_str(), graphs[chunk]);
+        }
+      } catch (...) {
+        errors[chunk] = std::current_exception();
+      }
+    }
+  };
+
+  unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min<size_t>(num_threads, num_chunks);
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
   }
+  worker();
 
-  if (!strcmp(str, "Callgraph clone")) {
-    return IPA_CLONE;
+  for (std::thread &t : threads) {
+    t.join();
   }
 
-  /* Should never happen.  */
-  __builtin_unreachable();
+  for (size_t i = 0; i < num_chunks; i++) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
+    }
+    Merge(graphs[i]);
+
+    /* Release the memory as soon as possible.  */
+    graphs[i] = PartialGraph();
+  }
 }
 
-IpaCloneNode *IpaClones::Get_Or_Create_Node(const std::string &name)
+void IpaClones::Merge(const PartialGraph &graph)
 {
-  IpaCloneNode *ret = Get_Node(name);
-  if (ret) {
-    return ret;
+  /* Look up every symbol only once.  */
+  std::vector<uint32_t> ids;
+  ids.reserve(graph.Names.Size());
+  for (uint32_t i = 0; i < graph.Names.Size(); i++) {
+    ids.push_back(Parsed.Names.Intern(graph.Names.Get(i)));
   }
 
-  /* Not found.  Create it.  */
-  IpaCloneNode node;
-  node.Name = name;
-  Nodes[name] = node;
+  for (const std::pair<uint32_t, uint32_t> &edge : graph.Edges) {
+    Parsed.Edges.push_back({ids[edge.first], ids[edge.second]});
+  }
+}
 
-  return &Nodes[name];
+std::span<const uint32_t> IpaClones::Own(std::vector<uint32_t> &&array)
+{
+  /* Moving a vector keeps its elements where they are, so the view stays
+     valid when ArrayStorage grows.  */
+  ArrayStorage.push_back(std::move(array));
+  return ArrayStorage.back();
 }
 
-void IpaClones::Parse(const char *path)
+/* Build the compressed sparse row of `edges`, which are pairs of (from, to)
+   ids.  `edges` is sorted and has its duplicates removed.  */
+static void Build_CSR(uint32_t num_nodes,
+                      std::vector<std::pair<uint32_t, uint32_t>> &edges,
+                      std::vector<uint32_t> &index, std::vector<uint32_t> &ids)
 {
-  FILE *file = fopen(path, "r");
-  if (file == nullptr) {
-    throw std::runtime_error("Unable to open ipa-clones file: " + std::string(path));
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  index.assign(num_nodes + 1, 0);
+  ids.reserve(edges.size());
+  for (const std::pair<uint32_t, uint32_t> &edge : edges) {
+    index[edge.first + 1]++;
+    ids.push_back(edge.second);
   }
 
-  char *line;
-
-  /** Based on the following function, extracted from GCC source:
-    *
-    *  void
-    *  dump_callgraph_transformation (const cgraph_node *original,
-    *               const cgraph_node *clone,
-    *               const char *suffix)
-    *  {
-    *    if (symtab->ipa_clones_dump_file)
-    *      {
-    *        fprintf (symtab->ipa_clones_dump_file,
-    *           "Callgraph clone;%s;%d;%s;%d;%d;%s;%d;%s;%d;%d;%s\n",
-    *           original->asm_name (), original->order,
-    *           DECL_SOURCE_FILE (original->decl),
-    *           DECL_SOURCE_LINE (original->decl),
-    *           DECL_SOURCE_COLUMN (original->decl), clone->asm_name (),
-    *           clone->order, DECL_SOURCE_FILE (clone->decl),
-    *           DECL_SOURCE_LINE (clone->decl), DECL_SOURCE_COLUMN (clone->decl),
-    *           suffix);
-    *
-    *        symtab->cloned_nodes.add (original);
-    *        symtab->cloned_nodes.add (clone);
-    *      }
-    *  }
-    */
-
-  while ((line = getline_easy(file)) != nullptr) {
-    LexingState lexer(line);
-    IpaDecision decision = IpaClones::LexingState::Get_Decision(lexer.Lex());
-
-// The IPA files contain things that we do not use but we need to parse them
-// anyway.  So disable the warning for those unused variables.
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-variable"
-    const char *original_asm_name = lexer.Lex();
-    long original_order = atol(lexer.Lex());
-    const char *original_filename = lexer.Lex();
-    unsigned original_line = atol(lexer.Lex());
-    unsigned original_column = atol(lexer.Lex());
-
-    if (decision == IPA_CLONE) {
-      const char *clone_asm_name = lexer.Lex();
-      long clone_order = atol(lexer.Lex());
-      const char *clone_filename = lexer.Lex();
-      unsigned clone_line = atol(lexer.Lex());
-      unsigned clone_column = atol(lexer.Lex());
-#pragma GCC diagnostic pop
-
-      const char *happened = lexer.Lex();
-
-      const char *cleaned_caller_name = nullptr;
-      const char *cleaned_callee_name = nullptr;
-
-      if (!strcmp(happened, "inlining to")) {
-        cleaned_caller_name = Handle_GCC_Symbol_Quirks((char*)clone_asm_name);
-        cleaned_callee_name = Handle_GCC_Symbol_Quirks((char*)original_asm_name);
-
-        /* Inlining a symbol to itself makes no sense.  Yet this can happen if
-           they were actually two symbols that we merged into one on
-           Handle_GCC_Symbol_Quirks.  */
-        if (strcmp(cleaned_callee_name, cleaned_caller_name) == 0) {
-          continue;
-        }
-      } else if (!strcmp(happened, "isra")) {
-        cleaned_caller_name = clone_asm_name;
-        cleaned_callee_name = original_asm_name;
-      }
+  for (uint32_t i = 0; i < num_nodes; i++) {
+    index[i + 1] += index[i];
+  }
+}
 
-      if (cleaned_caller_name && cleaned_callee_name) {
-        /* This node has been inlined into.  */
-        IpaCloneNode *callee = Get_Or_Create_Node(cleaned_callee_name);
-        IpaCloneNode *caller = Get_Or_Create_Node(cleaned_caller_name);
+void IpaClones::Build_Graph(void)
+{
+  StringTable &names = Parsed.Names;
+  NumNodes = names.Size();
+
+  /* Copy the names one after the other, so they are stored like in the
+     index file.  */
+  std::vector<uint32_t> name_offsets;
+  name_offsets.reserve(NumNodes + 1);
+  for (uint32_t id = 0; id < NumNodes; id++) {
+    name_offsets.push_back(NamesStorage.size());
+    NamesStorage.append(names.Get(id));
+    NamesStorage.push_back('\0');
+  }
+  name_offsets.push_back(NamesStorage.size());
 
-        callee->InlinedInto.insert(caller);
-        caller->Inlines.insert(callee);
-      }
+  if (NamesStorage.size() > UINT32_MAX) {
+    throw std::runtime_error("Too many symbols in ipa-clones files");
+  }
+
+  /* Keep the load factor at most 1/2, like StringTable does.  */
+  uint32_t num_slots = 64;
+  while (num_slots < 2 * (uint64_t) NumNodes) {
+    num_slots *= 2;
+  }
+
+  std::vector<uint32_t> slots(num_slots, INVALID);
+  for (uint32_t id = 0; id < NumNodes; id++) {
+    uint32_t slot = StringTable::Hash(names.Get(id)) & (num_slots - 1);
+    while (slots[slot] != INVALID) {
+      slot = (slot + 1) & (num_slots - 1);
+    }
+    slots[slot] = id;
+  }
+
+  /* Edges are (callee, caller), which are the InlinedInto edges.  Swap them
+     to get the Inlines edges.  */
+  std::vector<std::pair<uint32_t, uint32_t>> &edges = Parsed.Edges;
+  std::vector<uint32_t> inlined_into_index, inlined_into;
+  Build_CSR(NumNodes, edges, inlined_into_index, inlined_into);
+
+  for (std::pair<uint32_t, uint32_t> &edge : edges) {
+    std::swap(edge.first, edge.second);
+  }
+  std::vector<uint32_t> inlines_index, inlines;
+  Build_CSR(NumNodes, edges, inlines_index, inlines);
+
+  NumEdges = inlines.size();
+
+  NamesBlob = NamesStorage;
+  NameOffsets = Own(std::move(name_offsets));
+  Slots = Own(std::move(slots));
+  InlinesIndex = Own(std::move(inlines_index));
+  Inlines = Own(std::move(inlines));
+  InlinedIntoIndex = Own(std::move(inlined_into_index));
+  InlinedInto = Own(std::move(inlined_into));
+
+  /* Not needed anymore.  */
+  Parsed = PartialGraph();
+}
+
+void IpaClones::Parse(const char *path, PartialGraph &graph)
+{
+  std::unique_ptr<MappedFile> file;
+  try {
+    file = std::make_unique<MappedFile>(path);
+  } catch (const std::runtime_error &) {
+    throw std::runtime_error("Unable to open ipa-clones file: " + std::string(path));
+  }
+
+  /* Scan the file once, line by line, straight from the mapped memory.  */
+  std::string_view text = file->View();
+  while (!text.empty()) {
+    size_t newline = text.find('\n');
+    std::string_view line = text.substr(0, newline);
+    text.remove_prefix(newline == std::string_view::npos ? text.size()
+                                                          : newline + 1);
+
+    std::string_view callee, caller;
+    if (Parse_Inline_Edge(line, callee, caller)) {
+      /* This node has been inlined into.  */
+      graph.Edges.push_back({graph.Names.Intern(callee),
+                             graph.Names.Intern(caller)});
     }
   }
-  fclose(file);
 }
 
 void IpaClones::Dump(void)
 {
-  for (auto &p : Nodes) {
+  for (uint32_t id = 0; id < NumNodes; id++) {
     bool has_content = false;
-    std::cout << " " << p.first;
-    for (auto &q : p.second.InlinedInto) {
+    std::cout << " " << Get_Name(id);
+    for (uint32_t q : Get_Inlined_Into(id)) {
       if (has_content == false) {
         has_content = true;
         std::cout << " => ";
       }
-      std::cout << q->Name << "  ";
+      std::cout << Get_Name(q) << "  ";
     }
     std::cout << '\n';
   }
@@ -279,44 +442,265 @@ void IpaClones::Dump_Graphviz(const char *filename)
   }
 
   fprintf(file, "strict digraph {");
-  for (auto &p : Nodes) {
-    for (auto &q : p.second.InlinedInto) {
-      fprintf(file, "\n\"%s\" -> \"%s\"", p.first.c_str(), q->Name.c_str());
+  for (uint32_t id = 0; id < NumNodes; id++) {
+    for (uint32_t q : Get_Inlined_Into(id)) {
+      std::string_view from = Get_Name(id);
+      std::string_view to = Get_Name(q);
+      fprintf(file, "\n\"%.*s\" -> \"%.*s\"", (int) from.size(), from.data(),
+              (int) to.size(), to.data());
     }
   }
   fprintf(file, "\n}");
   fclose(file);
 }
 
-/** Find which symbols are inlined in the function represented by `node`.  */
-void IpaClosure::Find_Inlined_Symbols(IpaCloneNode *node)
+uint32_t IpaClones::Get_Node_Id(std::string_view name) const
 {
-  if (node == nullptr || Is_In_Set(node)) {
-    return;
+  uint32_t mask = Slots.size() - 1;
+  uint32_t slot = StringTable::Hash(name) & mask;
+
+  /* Bound the probes in case the index file is corrupted.  */
+  for (size_t probes = 0; probes < Slots.size(); probes++) {
+    uint32_t id = Slots[slot];
+    if (id == INVALID || id >= NumNodes) {
+      break;
+    }
+    if (Get_Name(id) == name) {
+      return id;
+    }
+    slot = (slot + 1) & mask;
   }
 
-  /** Mark node as analyzed.  */
-  Set.insert(node);
+  return INVALID;
+}
 
-  /** Proceed to other nodes in a DFS fashion.  */
-  for (IpaCloneNode *n : node->Inlines) {
-    Action(Opaque, node, n);
-    Find_Inlined_Symbols(n);
+/* The index file is made of the header below followed by these arrays, each
+   starting at an offset aligned to 8 bytes:
+
+   - Names: the NUL terminated names of the nodes, one after the other.
+   - NameOffsets: NumNodes + 1 uint32_t, where the name of node `i` starts at
+     Names + NameOffsets[i] and ends right before Names + NameOffsets[i + 1].
+   - Slots: NumSlots uint32_t, an open addressing hash table of node ids,
+     hashed with StringTable::Hash and probed linearly.  Empty slots have
+     StringTable::INVALID.  NumSlots is a power of two.
+   - InlinesIndex and Inlines: the compressed sparse row of the Inlines
+     edges.  The nodes inlined into node `i` are in Inlines[InlinesIndex[i]]
+     up to Inlines[InlinesIndex[i + 1]], sorted by id and without
+     duplicates.
+   - InlinedIntoIndex and InlinedInto: the same for the InlinedInto edges.
+
+   These are the arrays of IpaClones, so the graph is used right from the
+   mapping of the file.  Every number is stored in the byte order of the
+   machine which wrote the index, which is checked with ByteOrder when loading
+   it.  */
+struct IpaClones::IndexHeader
+{
+  char Magic[8];
+  uint32_t Version;
+  uint32_t ByteOrder;
+
+  uint32_t NumNodes;
+  uint32_t NumEdges;
+  uint32_t NumSlots;
+  uint32_t Reserved;
+
+  uint64_t NamesOffset;
+  uint64_t NamesSize;
+  uint64_t NameOffsetsOffset;
+  uint64_t SlotsOffset;
+  uint64_t InlinesIndexOffset;
+  uint64_t InlinesOffset;
+  uint64_t InlinedIntoIndexOffset;
+  uint64_t InlinedIntoOffset;
+};
+
+static const char INDEX_MAGIC[8] = { 'C', 'E', 'I', 'D', 'X', '\0', '\0', '\0' };
+
+/* Must be incremented every time the layout of the index changes.  */
+static const uint32_t INDEX_VERSION = 1;
+
+static const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+bool IpaClones::Is_Index_File(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
   }
+
+  char magic[sizeof(INDEX_MAGIC)];
+  bool is_index = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+                  && memcmp(magic, INDEX_MAGIC, sizeof(magic)) == 0;
+
+  fclose(file);
+  return is_index;
 }
 
-void IpaClosure::Find_Where_Symbol_Is_Inlined(IpaCloneNode *node)
+void IpaClones::Write_Index(const char *path)
 {
-  if (node == nullptr || Is_In_Set(node)) {
-    return;
+  IndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.Magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header.Version = INDEX_VERSION;
+  header.ByteOrder = INDEX_BYTE_ORDER;
+  header.NumNodes = NumNodes;
+  header.NumEdges = NumEdges;
+  header.NumSlots = Slots.size();
+  header.NamesSize = NamesBlob.size();
+
+  auto append_array = [](std::string &buffer, std::span<const uint32_t> array) {
+    return Append_Aligned(buffer, array.data(), array.size_bytes());
+  };
+
+  std::string buffer(sizeof(header), '\0');
+  header.NamesOffset = Append_Aligned(buffer, NamesBlob.data(), NamesBlob.size());
+  header.NameOffsetsOffset = append_array(buffer, NameOffsets);
+  header.SlotsOffset = append_array(buffer, Slots);
+  header.InlinesIndexOffset = append_array(buffer, InlinesIndex);
+  header.InlinesOffset = append_array(buffer, Inlines);
+  header.InlinedIntoIndexOffset = append_array(buffer, InlinedIntoIndex);
+  header.InlinedIntoOffset = append_array(buffer, InlinedInto);
+  memcpy(buffer.data(), &header, sizeof(header));
+
+  /* A server may have the index mapped, and truncating it would crash it.
+     Write to a temporary file and rename it instead.  */
+  std::string tmp_path = std::string(path) + ".tmp." + std::to_string(getpid());
+  FILE *file = fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    throw std::runtime_error("Unable to open index file " + tmp_path +
+                             " to write");
+  }
+
+  bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  ok = (fclose(file) == 0) && ok;
+  ok = ok && rename(tmp_path.c_str(), path) == 0;
+  if (!ok) {
+    unlink(tmp_path.c_str());
+    throw std::runtime_error("Unable to write index file " + std::string(path));
+  }
+}
+
+void IpaClones::Load_Index(const char *path)
+{
+  IndexFile = std::make_unique<MappedFile>(path, false);
+
+  const char *base = IndexFile->Data();
+  uint64_t size = IndexFile->Size();
+  const IndexHeader *header = (const IndexHeader *) base;
+
+  auto invalid = [path](const char *why) {
+    return std::runtime_error("Invalid index file " + std::string(path) +
+                              ": " + why);
+  };
+
+  if (size < sizeof(IndexHeader)
+      || memcmp(header->Magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+    throw invalid("bad header");
+  }
+  if (header->Version != INDEX_VERSION) {
+    throw invalid("unsupported version, please rebuild it");
+  }
+  if (header->ByteOrder != INDEX_BYTE_ORDER) {
+    throw invalid("written on a machine with different byte order");
+  }
+  if (header->NumSlots == 0 || (header->NumSlots & (header->NumSlots - 1))
+      || header->NumSlots <= header->NumNodes) {
+    throw invalid("bad hash table");
   }
 
-  /** Mark node as analyzed.  */
-  Set.insert(node);
+  /* Check that every array is within the file, so that a truncated file
+     can not make us read past the mapping.  The contents of the arrays are
+     not checked, as that would mean reading the whole file.  */
+  auto get_array = [&](uint64_t offset, uint64_t count) {
+    if (offset % 8 != 0 || offset > size
+        || count > (size - offset) / sizeof(uint32_t)) {
+      throw invalid("truncated or corrupted");
+    }
+    return std::span<const uint32_t>((const uint32_t *) (base + offset), count);
+  };
+
+  if (header->NamesOffset > size
+      || header->NamesSize > size - header->NamesOffset) {
+    throw invalid("truncated or corrupted");
+  }
 
-  /** Proceed to other nodes in a DFS fashion.  */
-  for (IpaCloneNode *n : node->InlinedInto) {
-    Action(Opaque, node, n);
-    Find_Where_Symbol_Is_Inlined(n);
+  NumNodes = header->NumNodes;
+  NumEdges = header->NumEdges;
+  NamesBlob = std::string_view(base + header->NamesOffset, header->NamesSize);
+  NameOffsets = get_array(header->NameOffsetsOffset, NumNodes + 1ULL);
+  Slots = get_array(header->SlotsOffset, header->NumSlots);
+  InlinesIndex = get_array(header->InlinesIndexOffset, NumNodes + 1ULL);
+  Inlines = get_array(header->InlinesOffset, NumEdges);
+  InlinedIntoIndex = get_array(header->InlinedIntoIndexOffset, NumNodes + 1ULL);
+  InlinedInto = get_array(header->InlinedIntoOffset, NumEdges);
+
+  if (NameOffsets[NumNodes] != NamesBlob.size()
+      || InlinesIndex[NumNodes] != NumEdges
+      || InlinedIntoIndex[NumNodes] != NumEdges) {
+    throw invalid("truncated or corrupted");
   }
 }
+
+IpaClosure::IpaClosure(const IpaClones &ipa)
+  : Ipa(ipa),
+    VisitedBits((ipa.Get_Num_Nodes() + 63) / 64, 0),
+    FoundBits((ipa.Get_Num_Nodes() + 63) / 64, 0)
+{
+}
+
+std::vector<uint32_t> IpaClosure::Get_Node_Ids(const std::vector<std::string> &names)
+{
+  std::vector<uint32_t> nodes;
+  nodes.reserve(names.size());
+
+  for (const std::string &name : names) {
+    uint32_t id = Ipa.Get_Node_Id(name);
+    if (id != IpaClones::INVALID) {
+      nodes.push_back(id);
+    }
+  }
+
+  return nodes;
+}
+
+void IpaClosure::Sweep(std::span<const uint32_t> nodes,
+                       std::span<const uint32_t> (IpaClones::*edges)(uint32_t) const)
+{
+  /* Visited is also the queue: every node before `head` has had its edges
+     followed.  Nodes visited in a previous sweep are not followed again.  */
+  size_t head = Visited.size();
+  uint32_t num_nodes = Ipa.Get_Num_Nodes();
+
+  for (uint32_t node : nodes) {
+    if (node < num_nodes && Mark(VisitedBits, node)) {
+      Visited.push_back(node);
+    }
+  }
+
+  while (head < Visited.size()) {
+    uint32_t node = Visited[head++];
+
+    for (uint32_t n : (Ipa.*edges)(node)) {
+      /* Edges to nodes which do not exist come from a corrupted index.  */
+      if (n >= num_nodes) {
+        continue;
+      }
+      if (Mark(FoundBits, n)) {
+        Found.push_back(n);
+      }
+      if (Mark(VisitedBits, n)) {
+        Visited.push_back(n);
+      }
+    }
+  }
+}
+
+void IpaClosure::Find_Inlined_Symbols(std::span<const uint32_t> nodes)
+{
+  Sweep(nodes, &IpaClones::Get_Inlines);
+}
+
+void IpaClosure::Find_Where_Symbols_Are_Inlined(std::span<const uint32_t> nodes)
+{
+  Sweep(nodes, &IpaClones::Get_Inlined_Into);
+}
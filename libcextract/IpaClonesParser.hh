@@ -26,29 +26,27 @@
 #pragma once
 
 #include "Parser.hh"
+#include "StringTable.hh"
+#include "NonLLVMMisc.hh"
 
 #include <set>
-#include <unordered_map>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <string.h>
 #include <stdlib.h>
 #include <memory>
 
-/** @brief Represent an cloned node.  See this as a callgraph, but we only
-  *  incide edges when there is an inline.
+/** @brief Parse .ipa-clone files and build an inline graph.
+  *
+  * The graph is immutable once built.  Each symbol is a node identified by
+  * a 32-bit id, and the edges of each direction are stored as a compressed
+  * sparse row: one array with the edges of every node one after the other,
+  * sorted by id and without duplicates, and one array with where the edges of
+  * each node start.  This is the same layout as the index file written by
+  * Write_Index, so an index is used directly from its mapping.
   */
-struct IpaCloneNode
-{
-  /** Name of the symbol.  */
-  std::string Name;
-  /** Where is this symbol inlined into?  */
-  std::set<IpaCloneNode *> InlinedInto;
-
-  /** Which symbols this symbol is inline into?  */
-  std::set<IpaCloneNode *> Inlines;
-};
-
-/** @brief Parse .ipa-clone files and build an inline graph.  */
 class IpaClones : public Parser
 {
   public:
@@ -65,158 +63,244 @@ class IpaClones : public Parser
     IPA_CLONE,
   };
 
-  /** Construct the IpaClones from a ipa-clones files.  */
+  /** Construct the IpaClones from a ipa-clones files, a directory with them
+      or an index file written by Write_Index.  */
   IpaClones(const char *path);
 
-  // IPA clones can point to a directory, so we need to handle paths at this
-  // point.
-  void Parse(const char *path);
-
   /** Construct the IpaClones from a ipa-clones files.  */
   inline IpaClones(const std::string &path)
     : IpaClones(path.c_str())
   { }
 
-  /** Get a node with matching ASM name.  ASM names are unique even for C++ so
-    * there should not be any clashes.  */
-  inline IpaCloneNode *Get_Node(const std::string &name)
-  {
-    std::unordered_map<std::string, IpaCloneNode>::iterator it = Nodes.find(name);
-    if (it != Nodes.end()) {
-      return &Nodes[name];
-    }
+  /** The graph arrays point into this object.  */
+  IpaClones(const IpaClones &) = delete;
+  IpaClones &operator=(const IpaClones &) = delete;
 
-    return nullptr;
-  }
+  /** Id of a node that does not exist.  */
+  static constexpr uint32_t INVALID = StringTable::INVALID;
+
+  /** Get the id of the node with matching ASM name, or INVALID if there is
+    * no such node.  ASM names are unique even for C++ so there should not be
+    * any clashes.  */
+  uint32_t Get_Node_Id(std::string_view name) const;
 
-  /** Get a node with matching ASM name.  ASM names are unique even for C++ so
-    * there should not be any clashes.  */
-  inline IpaCloneNode *Get_Node(const char *name)
+  /** Get the ASM name of the node `id`.  It is NUL terminated.  Empty if
+      there is no such node or the offsets of the name are out of bounds,
+      which only happens with a corrupted index file.  */
+  inline std::string_view Get_Name(uint32_t id) const
   {
-    return Get_Node(std::string(name));
+    if (id >= NumNodes) {
+      return {};
+    }
+    uint32_t start = NameOffsets[id];
+    uint32_t end = NameOffsets[id + 1];
+    if (start >= end || end > NamesBlob.size()) {
+      return {};
+    }
+    return std::string_view(NamesBlob.data() + start, end - start - 1);
   }
 
-  /** Get a node with matching ASM name, or create it if does not exists.  */
-  IpaCloneNode *Get_Or_Create_Node(const std::string &name);
-
-  /** Get a node with matching ASM name, or create it if does not exists.  */
-  inline IpaCloneNode *Get_Or_Create_Node(const char *name)
+  /** Get the ids of the symbols inlined into the node `id`.  */
+  inline std::span<const uint32_t> Get_Inlines(uint32_t id) const
   {
-    return Get_Or_Create_Node(std::string(name));
+    return Get_Edges(Inlines, InlinesIndex, id);
   }
 
-  /** Iterate through the set of all nodes.  */
-  inline std::unordered_map<std::string, IpaCloneNode>::iterator begin()
+  /** Get the ids of the symbols where the node `id` is inlined into.  */
+  inline std::span<const uint32_t> Get_Inlined_Into(uint32_t id) const
   {
-    return Nodes.begin();
+    return Get_Edges(InlinedInto, InlinedIntoIndex, id);
   }
-  inline std::unordered_map<std::string, IpaCloneNode>::iterator end()
+
+  /** Number of nodes.  Ids go from 0 to this number minus one.  */
+  inline uint32_t Get_Num_Nodes(void) const
   {
-    return Nodes.end();
+    return NumNodes;
   }
 
   void Dump(void);
   void Dump_Graphviz(const char *filename);
 
-  private:
+  /** Write the inline graph into an index file at `path`, which can be given
+      to the constructor instead of the ipa-clones files.  Loading the index
+      is much faster than parsing the ipa-clones files again.  */
+  void Write_Index(const char *path);
 
-  void Open_Recursive(const char *path);
+  /** Check if the file at `path` is an index written by Write_Index.  */
+  static bool Is_Index_File(const char *path);
 
-  /** Set of nodes.  */
-  std::unordered_map<std::string, IpaCloneNode> Nodes;
+  private:
 
-  /** Hold the state machine of the lexer, which is where in the string it is.  */
-  class LexingState
+  /** Get the edges of node `id` from the compressed sparse row given by
+      `edges` and `index`.  Empty if the row is out of bounds, which only
+      happens with a corrupted index file.  The ids in the row are not
+      checked.  */
+  static inline std::span<const uint32_t> Get_Edges(std::span<const uint32_t> edges,
+                                                    std::span<const uint32_t> index,
+                                                    uint32_t id)
   {
-    public:
-    inline LexingState(char *line)
-      : CurrentStateString(line),
-        OriginalPtr(line)
-    {
+    uint32_t start = index[id];
+    uint32_t end = index[id + 1];
+    if (start > end || end > edges.size()) {
+      return {};
     }
+    return edges.subspan(start, end - start);
+  }
 
-    inline ~LexingState(void)
-    {
-      free(OriginalPtr);
-    }
+  /** Layout of the index file header.  */
+  struct IndexHeader;
 
-    /** Next token in file.  */
-    const char *Lex(void);
+  /** Load the inline graph from the index file at `path`.  */
+  void Load_Index(const char *path);
 
-    /** Parse the decision string into a IpaDecision.  */
-    static IpaDecision Get_Decision(const char *);
+  /** Collect the path of every .ipa-clones file in the directory tree.  */
+  void Open_Recursive(const char *path, std::vector<std::string> &files);
 
-    /** Current state for strtok.  */
-    char *CurrentStateString;
+  /** Inline edges found in some ipa-clones files, with the symbol names
+      interned so each one is stored once no matter how many edges it has.  */
+  struct PartialGraph
+  {
+    StringTable Names;
 
-    /** Original string returned by getline.  */
-    char *OriginalPtr;
+    /** Pairs of (callee, caller) ids, in the order they were found.  */
+    std::vector<std::pair<uint32_t, uint32_t>> Edges;
   };
+
+  // IPA clones can point to a directory, so we need to handle paths at this
+  // point.
+  void Parse(const char *path);
+
+  /** Parse many ipa-clones files in parallel.  The resulting graph is the
+      same as parsing them one by one in the given order.  */
+  void Parse(const std::vector<std::string> &paths);
+
+  /** Parse the ipa-clones file at `path` into `graph`.  */
+  static void Parse(const char *path, PartialGraph &graph);
+
+  /** Add the edges of `graph` to the graph being parsed.  */
+  void Merge(const PartialGraph &graph);
+
+  /** Build the graph arrays from the graph that was parsed.  */
+  void Build_Graph(void);
+
+  /** Keep `array` alive as long as this object and get a view of it.  */
+  std::span<const uint32_t> Own(std::vector<uint32_t> &&array);
+
+  /** The graph being parsed.  Released once the graph is built.  */
+  PartialGraph Parsed;
+
+  /** Number of nodes and of edges in each direction.  */
+  uint32_t NumNodes;
+  uint32_t NumEdges;
+
+  /** The NUL terminated names of the nodes, one after the other.  The name
+      of node `i` starts at NameOffsets[i] and ends right before
+      NameOffsets[i + 1].  */
+  std::string_view NamesBlob;
+  std::span<const uint32_t> NameOffsets;
+
+  /** Open addressing hash table of node ids, hashed with StringTable::Hash
+      and probed linearly.  Empty slots have INVALID.  Its size is always a
+      power of two.  */
+  std::span<const uint32_t> Slots;
+
+  /** The Inlines edges of node `i` are Inlines[InlinesIndex[i]] up to
+      Inlines[InlinesIndex[i + 1]], and likewise for InlinedInto.  */
+  std::span<const uint32_t> InlinesIndex;
+  std::span<const uint32_t> Inlines;
+  std::span<const uint32_t> InlinedIntoIndex;
+  std::span<const uint32_t> InlinedInto;
+
+  /** Memory of the arrays above when the graph was parsed from ipa-clones
+      files.  */
+  std::string NamesStorage;
+  std::vector<std::vector<uint32_t>> ArrayStorage;
+
+  /** The index file, if the graph was loaded from one.  The arrays above
+      point into it.  */
+  std::unique_ptr<MappedFile> IndexFile;
 };
 
-/** Compute the closure of a symbol executing an Action on each edge.
+/** Compute the closure of a set of symbols on the inline graph.
   *
-  * On many analysis we need to do an DFS on the IPA-clones graph and execute
-  * a set of commands on each edge of the graph.  This class abstract this by
-  * giving a way to pass a function pointer and a opaque pointer to an object
-  * which can be used to populate with information.
+  * The graph is swept in breadth-first order from all the given symbols at
+  * once, marking the visited nodes on a bitset, so long inline chains do not
+  * recurse and a symbol reachable from many of the given ones is visited only
+  * once.  The results are node ids, which can be converted to names with
+  * IpaClones::Get_Name once the sweep is done.
+  *
+  * Example:
+  *
+  *   IpaClosure closure(ipa);
+  *   closure.Find_Where_Symbols_Are_Inlined(names);
+  *   for (uint32_t id : closure.Found) {
+  *     ...
+  *   }
   */
-struct IpaClosure
+class IpaClosure
 {
   public:
-  /** Build the object.  
+  /** Build the object.
     * @param ipa     The IPA clones object.
-    * @param opaque  Pointer to an opaque object handled by `action_function`.
-    * @param action_function Function which will do something with the `opaque` and
-    *                        nodes given to it.
     */
-  inline IpaClosure(IpaClones &ipa, void *opaque,
-                    int (*action_function)(void *, IpaCloneNode *, IpaCloneNode *))
-    : Ipa(ipa),
-      Opaque(opaque),
-      Action(action_function)
-  {
-  }
+  IpaClosure(const IpaClones &ipa);
 
-  /** Find which symbols are inlined in the function represented by `node`.  */
-  void Find_Inlined_Symbols(IpaCloneNode *node);
+  /** Find which symbols are inlined in the functions represented by `nodes`.  */
+  void Find_Inlined_Symbols(std::span<const uint32_t> nodes);
 
-  /** Find the other functions where the symbol represented by `node` is
+  /** Find the other functions where the symbols represented by `nodes` are
       inlined.  */
-  void Find_Where_Symbol_Is_Inlined(IpaCloneNode *node);
+  void Find_Where_Symbols_Are_Inlined(std::span<const uint32_t> nodes);
 
-  /** Find which symbols are inlined in the function with mangled name `name`.  */
-  inline void Find_Inlined_Symbols(const std::string &name)
+  /** Find which symbols are inlined in the functions with mangled names
+      `names`.  */
+  inline void Find_Inlined_Symbols(const std::vector<std::string> &names)
   {
-    IpaCloneNode *node = Ipa.Get_Node(name);
-    Find_Inlined_Symbols(node);
+    std::vector<uint32_t> nodes = Get_Node_Ids(names);
+    Find_Inlined_Symbols(nodes);
   }
 
-  /** Find the other functions where the symbol with mangled name `name` is
-      inlined.  */
-  inline void Find_Where_Symbol_Is_Inlined(const std::string &name)
+  /** Find the other functions where the symbols with mangled names `names`
+      are inlined.  */
+  inline void Find_Where_Symbols_Are_Inlined(const std::vector<std::string> &names)
   {
-    IpaCloneNode *node = Ipa.Get_Node(name);
-    Find_Where_Symbol_Is_Inlined(node);
+    std::vector<uint32_t> nodes = Get_Node_Ids(names);
+    Find_Where_Symbols_Are_Inlined(nodes);
   }
 
-  /** Set of marked symbols.  */
-  std::set<IpaCloneNode *> Set;
+  /** Symbols found, in the order they were found.  These are the nodes
+      reached through at least one edge, which may include the given nodes
+      if there is a cycle.  */
+  std::vector<uint32_t> Found;
+
+  /** Nodes visited, in the order they were visited.  These are the given
+      nodes which exist in the graph followed by the symbols found.  */
+  std::vector<uint32_t> Visited;
 
   private:
+  /** Sweep the graph from `nodes`, following the edges given by `edges`.  */
+  void Sweep(std::span<const uint32_t> nodes,
+             std::span<const uint32_t> (IpaClones::*edges)(uint32_t) const);
 
-  /** Is symbol marked? (already analyzed).  */
-  inline bool Is_In_Set(IpaCloneNode *x)
+  /** Get the ids of the nodes with names `names`.  Names without nodes are
+      ignored.  */
+  std::vector<uint32_t> Get_Node_Ids(const std::vector<std::string> &names);
+
+  /** Set the bit of `id` in `bits`.  Returns false if it was already set.  */
+  static inline bool Mark(std::vector<uint64_t> &bits, uint32_t id)
   {
-    return Set.find(x) != Set.end();
+    uint64_t mask = 1ULL << (id % 64);
+    if (bits[id / 64] & mask) {
+      return false;
+    }
+    bits[id / 64] |= mask;
+    return true;
   }
 
   /** Reference to the IpaClones object used to build this object.  */
-  IpaClones &Ipa;
-
-  /** Opaque pointer that is always passed to Action.  */
-  void *Opaque;
+  const IpaClones &Ipa;
 
-  /** Action function that will always be executed on each edge.  */
-  int (*Action)(void *opaque, IpaCloneNode *, IpaCloneNode *);
+  /** Bitsets of the nodes in Visited and in Found.  */
+  std::vector<uint64_t> VisitedBits;
+  std::vector<uint64_t> FoundBits;
 };
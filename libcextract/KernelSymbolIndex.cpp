@@ -0,0 +1,566 @@
+//===- KernelSymbolIndex.cpp - Index the symbols of a kernel build -*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Index the symbols defined by vmlinux and every module of a kernel build.
+//
+//===----------------------------------------------------------------------===//
+
+#include "KernelSymbolIndex.hh"
+#include "ElfCXX.hh"
+#include "NonLLVMMisc.hh"
+#include "StringTable.hh"
+#include <stdio.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+static_assert(sizeof(KernelSymbolIndex::Definition) == 4,
+              "Definition is stored as is in the index file");
+
+/* The index file is made of the header below followed by these arrays, each
+   starting at an offset aligned to 8 bytes:
+
+   - ModuleNames and ModuleOffsets: the NUL terminated names of the modules,
+     and NumModules + 1 uint32_t telling where each one starts.
+   - Names and NameOffsets: the same for the NumSymbols symbols.
+   - Slots: NumSlots uint32_t, an open addressing hash table of symbol ids,
+     hashed with StringTable::Hash and probed linearly.  Empty slots have
+     StringTable::INVALID.  NumSlots is a power of two.
+   - DefinitionsIndex and Definitions: the compressed sparse row of the
+     definitions of each symbol.
+
+   Every number is stored in the byte order of the machine which wrote the
+   index, which is checked with ByteOrder when loading it.  */
+struct KernelSymbolIndex::Header
+{
+  char Magic[8];
+  uint32_t Version;
+  uint32_t ByteOrder;
+
+  uint32_t NumModules;
+  uint32_t NumSymbols;
+  uint32_t NumDefinitions;
+  uint32_t NumSlots;
+
+  uint64_t ModuleNamesOffset;
+  uint64_t ModuleNamesSize;
+  uint64_t ModuleOffsetsOffset;
+  uint64_t NamesOffset;
+  uint64_t NamesSize;
+  uint64_t NameOffsetsOffset;
+  uint64_t SlotsOffset;
+  uint64_t DefinitionsIndexOffset;
+  uint64_t DefinitionsOffset;
+};
+
+static const char INDEX_MAGIC[8] = { 'C', 'E', 'K', 'I', 'D', 'X', '\0', '\0' };
+
+/* Must be incremented every time the layout of the index changes.  */
+static const uint32_t INDEX_VERSION = 1;
+
+static const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+/** Symbols defined by one object, as scanned by a worker.  */
+struct ScannedObject
+{
+  std::string Module;
+
+  StringTable Names;
+
+  /* Definition of each name, indexed by its id in Names.  Module is not
+     set.  */
+  std::vector<KernelSymbolIndex::Definition> Definitions;
+};
+
+/* Collect the path of every kernel module in the directory tree.  */
+static void Find_Modules(const char *path, std::vector<std::string> &files)
+{
+  DIR *directory = opendir(path);
+  if (directory == nullptr) {
+    throw std::runtime_error("Path seems invalid: " + std::string(path));
+  }
+
+  std::string prefix(path);
+  if (prefix.back() != '/') {
+    prefix.push_back('/');
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(directory)) != nullptr) {
+    const char *file = entry->d_name;
+    if (strcmp(file, ".") == 0 || strcmp(file, "..") == 0) {
+      /* Skip the current and previous directory to avoid infinite loop.  */
+      continue;
+    }
+
+    std::string file_path = prefix + file;
+
+    /* Modules may be compressed, which ElfObject handles.  */
+    std::string_view name(file);
+    if (name.ends_with(".ko") || name.ends_with(".ko.gz")
+        || name.ends_with(".ko.zst")) {
+      files.push_back(file_path);
+      continue;
+    }
+
+    if (Is_Directory(file_path.c_str())) {
+      Find_Modules(file_path.c_str(), files);
+    }
+  }
+  closedir(directory);
+}
+
+/* Get the name of the module at `path` from its file name, for modules which
+   do not have .gnu.linkonce.this_module.  */
+static std::string Module_Name_From_Path(const std::string &path)
+{
+  std::string name = get_basename(path.c_str());
+  size_t ko = name.find(".ko");
+  if (ko != std::string::npos) {
+    name.resize(ko);
+  }
+
+  /* Like kbuild does.  */
+  std::replace(name.begin(), name.end(), '-', '_');
+  return name;
+}
+
+/* Scan the symbols defined by the object at `path`.  */
+static void Scan_Object(const std::string &path, ScannedObject &object)
+{
+  ElfObject eo(path);
+  object.Module = Module_Name_From_Path(path);
+
+  for (auto it = eo.section_begin(); it != eo.section_end(); ++it) {
+    ElfSection &section = *it;
+    ElfW(Word) type = section.Get_Section_Type();
+
+    if (type == SHT_PROGBITS) {
+      /* See ElfSymbolCache::Analyze_ELF.  */
+      Elf_Data *data = section.Get_Data();
+      const char *name = section.Get_Name();
+      if (name && !strcmp(name, ".gnu.linkonce.this_module")
+          && data && data->d_buf && data->d_size > 24) {
+        const char *mod = (const char *) data->d_buf + 24;
+        object.Module = std::string(mod, strnlen(mod, data->d_size - 24));
+      }
+      continue;
+    }
+
+    if (type != SHT_SYMTAB && type != SHT_DYNSYM) {
+      continue;
+    }
+
+    /* Sections stripped from debuginfo files have no data.  */
+    Elf_Data *data = section.Get_Data();
+    if (data == nullptr || data->d_buf == nullptr
+        || section.Get_Entry_Size() == 0) {
+      continue;
+    }
+
+    size_t n = section.Get_Num_Symbols();
+    for (size_t i = 1; i < n; i++) {
+      ElfSymbol symbol = section.Get_Symbol(i);
+      GElf_Sym *sym = symbol.Get_Wrapped_Object();
+      unsigned char sym_type = symbol.Get_Type();
+
+      /* Only symbols this object defines.  */
+      if (sym->st_shndx == SHN_UNDEF || sym_type == STT_FILE
+          || sym_type == STT_SECTION) {
+        continue;
+      }
+
+      const char *name = symbol.Get_Name();
+      if (is_null_or_empty(name)) {
+        continue;
+      }
+
+      KernelSymbolIndex::Definition def = { 0, symbol.Get_Info(), (uint8_t) type };
+      uint32_t id = object.Names.Intern(name);
+      if (id == object.Definitions.size()) {
+        object.Definitions.push_back(def);
+        continue;
+      }
+
+      /* Many static symbols may have the same name.  Prefer the one visible
+         to other objects, and .dynsym over .symtab as ElfSymbolCache does.  */
+      KernelSymbolIndex::Definition &old = object.Definitions[id];
+      bool old_local = ElfSymbol::Bind_Of(old.Info) == STB_LOCAL;
+      bool new_local = ElfSymbol::Bind_Of(def.Info) == STB_LOCAL;
+      if ((old_local && !new_local)
+          || (old_local == new_local && type == SHT_DYNSYM)) {
+        old = def;
+      }
+    }
+  }
+}
+
+void KernelSymbolIndex::Build(const char *tree, const char *output)
+{
+  std::vector<std::string> files;
+  Find_Modules(tree, files);
+
+  /* readdir returns the files in whatever order the filesystem has them.
+     Sort them so the index is built the same way on every run.  */
+  std::sort(files.begin(), files.end());
+
+  std::string vmlinux = std::string(tree) + "/vmlinux";
+  if (access(vmlinux.c_str(), R_OK) == 0) {
+    files.insert(files.begin(), vmlinux);
+  }
+
+  if (files.empty()) {
+    throw std::runtime_error("No vmlinux or .ko files found in " + std::string(tree));
+  }
+
+  /* vmlinux is by far the largest object, and it is scanned first, so the
+     modules are scanned while it is.  */
+  std::vector<ScannedObject> objects(files.size());
+  std::vector<std::exception_ptr> errors(files.size());
+  std::atomic<size_t> next_object(0);
+
+  auto worker = [&](void) {
+    size_t i;
+    while ((i = next_object.fetch_add(1)) < files.size()) {
+      try {
+        Scan_Object(files[i], objects[i]);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+
+  unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min<size_t>(num_threads, files.size());
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  /* Merge the objects in the order they were found.  */
+  StringTable modules;
+  StringTable names;
+  std::vector<std::pair<uint32_t, Definition>> defs;
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
+    }
+
+    ScannedObject &object = objects[i];
+    uint32_t module = modules.Intern(object.Module);
+    if (module > UINT16_MAX) {
+      throw std::runtime_error("Too many modules in " + std::string(tree));
+    }
+
+    for (uint32_t id = 0; id < object.Names.Size(); id++) {
+      Definition def = object.Definitions[id];
+      def.Module = module;
+      defs.push_back({names.Intern(object.Names.Get(id)), def});
+    }
+
+    /* Release the memory as soon as possible.  */
+    object = ScannedObject();
+  }
+
+  /* Group the definitions by symbol, keeping the order of the objects.  The
+     same module may be found twice in a tree, so drop the repeated ones.  */
+  std::stable_sort(defs.begin(), defs.end(),
+                   [](const auto &a, const auto &b) { return a.first < b.first; });
+  defs.erase(std::unique(defs.begin(), defs.end(),
+                         [](const auto &a, const auto &b) {
+                           return a.first == b.first
+                                  && a.second.Module == b.second.Module;
+                         }),
+             defs.end());
+
+  uint32_t num_symbols = names.Size();
+  std::vector<uint32_t> defs_index(num_symbols + 1, 0);
+  std::vector<Definition> definitions;
+  definitions.reserve(defs.size());
+  for (const auto &def : defs) {
+    defs_index[def.first + 1]++;
+    definitions.push_back(def.second);
+  }
+  for (uint32_t i = 0; i < num_symbols; i++) {
+    defs_index[i + 1] += defs_index[i];
+  }
+
+  auto build_blob = [](const StringTable &table, std::string &blob,
+                       std::vector<uint32_t> &offsets) {
+    for (uint32_t id = 0; id < table.Size(); id++) {
+      offsets.push_back(blob.size());
+      blob.append(table.Get(id));
+      blob.push_back('\0');
+    }
+    offsets.push_back(blob.size());
+
+    if (blob.size() > UINT32_MAX) {
+      throw std::runtime_error("Too many symbols in the kernel build");
+    }
+  };
+
+  std::string module_names, symbol_names;
+  std::vector<uint32_t> module_offsets, name_offsets;
+  build_blob(modules, module_names, module_offsets);
+  build_blob(names, symbol_names, name_offsets);
+
+  /* Keep the load factor at most 1/2, like StringTable does.  */
+  uint32_t num_slots = 64;
+  while (num_slots < 2 * (uint64_t) num_symbols) {
+    num_slots *= 2;
+  }
+
+  std::vector<uint32_t> slots(num_slots, StringTable::INVALID);
+  for (uint32_t id = 0; id < num_symbols; id++) {
+    uint32_t slot = StringTable::Hash(names.Get(id)) & (num_slots - 1);
+    while (slots[slot] != StringTable::INVALID) {
+      slot = (slot + 1) & (num_slots - 1);
+    }
+    slots[slot] = id;
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.Magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header.Version = INDEX_VERSION;
+  header.ByteOrder = INDEX_BYTE_ORDER;
+  header.NumModules = modules.Size();
+  header.NumSymbols = num_symbols;
+  header.NumDefinitions = definitions.size();
+  header.NumSlots = num_slots;
+  header.ModuleNamesSize = module_names.size();
+  header.NamesSize = symbol_names.size();
+
+  auto append_array = [](std::string &buffer, const std::vector<uint32_t> &array) {
+    return Append_Aligned(buffer, array.data(), array.size() * sizeof(uint32_t));
+  };
+
+  std::string buffer(sizeof(header), '\0');
+  header.ModuleNamesOffset = Append_Aligned(buffer, module_names.data(),
+                                            module_names.size());
+  header.ModuleOffsetsOffset = append_array(buffer, module_offsets);
+  header.NamesOffset = Append_Aligned(buffer, symbol_names.data(),
+                                      symbol_names.size());
+  header.NameOffsetsOffset = append_array(buffer, name_offsets);
+  header.SlotsOffset = append_array(buffer, slots);
+  header.DefinitionsIndexOffset = append_array(buffer, defs_index);
+  header.DefinitionsOffset = Append_Aligned(buffer, definitions.data(),
+                                            definitions.size() * sizeof(Definition));
+  memcpy(buffer.data(), &header, sizeof(header));
+
+  /* A server may have the index mapped, and truncating it would crash it.
+     Write to a temporary file and rename it instead.  */
+  std::string tmp_path = std::string(output) + ".tmp." + std::to_string(getpid());
+  FILE *file = fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    throw std::runtime_error("Unable to open index file " + tmp_path +
+                             " to write");
+  }
+
+  bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  ok = (fclose(file) == 0) && ok;
+  ok = ok && rename(tmp_path.c_str(), output) == 0;
+  if (!ok) {
+    unlink(tmp_path.c_str());
+    throw std::runtime_error("Unable to write index file " + std::string(output));
+  }
+}
+
+bool KernelSymbolIndex::Is_Index_File(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  char magic[sizeof(INDEX_MAGIC)];
+  bool is_index = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+                  && memcmp(magic, INDEX_MAGIC, sizeof(magic)) == 0;
+
+  fclose(file);
+  return is_index;
+}
+
+KernelSymbolIndex::KernelSymbolIndex(const char *path)
+  : File(std::make_unique<MappedFile>(path, false))
+{
+  const char *base = File->Data();
+  uint64_t size = File->Size();
+  const Header *header = (const Header *) base;
+
+  auto invalid = [path](const char *why) {
+    return std::runtime_error("Invalid kernel symbol index " + std::string(path) +
+                              ": " + why);
+  };
+
+  if (size < sizeof(Header)
+      || memcmp(header->Magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+    throw invalid("bad header");
+  }
+  if (header->Version != INDEX_VERSION) {
+    throw invalid("unsupported version, please rebuild it");
+  }
+  if (header->ByteOrder != INDEX_BYTE_ORDER) {
+    throw invalid("written on a machine with different byte order");
+  }
+  if (header->NumSlots == 0 || (header->NumSlots & (header->NumSlots - 1))
+      || header->NumSlots <= header->NumSymbols) {
+    throw invalid("bad hash table");
+  }
+
+  /* Check that every array is within the file, so that a truncated file
+     can not make us read past the mapping.  The contents of the arrays are
+     not checked, as that would mean reading the whole file.  */
+  auto in_file = [size](uint64_t offset, uint64_t count, size_t elem_size) {
+    return offset % 8 == 0 && offset <= size
+           && count <= (size - offset) / elem_size;
+  };
+  auto get_array = [&](uint64_t offset, uint64_t count) {
+    if (!in_file(offset, count, sizeof(uint32_t))) {
+      throw invalid("truncated or corrupted");
+    }
+    return std::span<const uint32_t>((const uint32_t *) (base + offset), count);
+  };
+
+  if (!in_file(header->ModuleNamesOffset, header->ModuleNamesSize, 1)
+      || !in_file(header->NamesOffset, header->NamesSize, 1)
+      || !in_file(header->DefinitionsOffset, header->NumDefinitions,
+                  sizeof(Definition))) {
+    throw invalid("truncated or corrupted");
+  }
+
+  uint32_t num_symbols = header->NumSymbols;
+  ModuleNames = std::string_view(base + header->ModuleNamesOffset,
+                                 header->ModuleNamesSize);
+  ModuleOffsets = get_array(header->ModuleOffsetsOffset, header->NumModules + 1ULL);
+  Names = std::string_view(base + header->NamesOffset, header->NamesSize);
+  NameOffsets = get_array(header->NameOffsetsOffset, num_symbols + 1ULL);
+  Slots = get_array(header->SlotsOffset, header->NumSlots);
+  DefinitionsIndex = get_array(header->DefinitionsIndexOffset, num_symbols + 1ULL);
+  Definitions = std::span<const Definition>(
+                  (const Definition *) (base + header->DefinitionsOffset),
+                  header->NumDefinitions);
+
+  if (ModuleOffsets.back() != ModuleNames.size()
+      || NameOffsets.back() != Names.size()
+      || DefinitionsIndex.back() != Definitions.size()) {
+    throw invalid("truncated or corrupted");
+  }
+}
+
+KernelSymbolIndex::~KernelSymbolIndex(void)
+{
+}
+
+std::string_view KernelSymbolIndex::Get_String(std::string_view blob,
+                                               std::span<const uint32_t> offsets,
+                                               uint32_t id)
+{
+  uint32_t start = offsets[id];
+  uint32_t end = offsets[id + 1];
+
+  /* Drop the NUL terminator.  */
+  if (start >= end || end > blob.size()) {
+    return {};
+  }
+  return blob.substr(start, end - start - 1);
+}
+
+std::string_view KernelSymbolIndex::Get_Module_Name(uint16_t id) const
+{
+  if (id + 1U >= ModuleOffsets.size()) {
+    return {};
+  }
+  return Get_String(ModuleNames, ModuleOffsets, id);
+}
+
+uint32_t KernelSymbolIndex::Get_Symbol_Id(std::string_view sym) const
+{
+  uint32_t mask = Slots.size() - 1;
+  uint32_t slot = StringTable::Hash(sym) & mask;
+
+  /* Bound the probes in case the file is corrupted.  */
+  for (size_t probes = 0; probes < Slots.size(); probes++) {
+    uint32_t id = Slots[slot];
+    if (id == StringTable::INVALID || id + 1ULL >= NameOffsets.size()) {
+      break;
+    }
+    if (Get_String(Names, NameOffsets, id) == sym) {
+      return id;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  return UINT32_MAX;
+}
+
+std::span<const KernelSymbolIndex::Definition>
+KernelSymbolIndex::Get_Definitions(std::string_view sym) const
+{
+  uint32_t id = Get_Symbol_Id(sym);
+  if (id == UINT32_MAX) {
+    return {};
+  }
+
+  uint32_t start = DefinitionsIndex[id];
+  uint32_t end = DefinitionsIndex[id + 1];
+  if (start > end || end > Definitions.size()) {
+    return {};
+  }
+  return Definitions.subspan(start, end - start);
+}
+
+const KernelSymbolIndex::Definition *
+KernelSymbolIndex::Find_Definition(std::string_view sym,
+                                   std::string_view module) const
+{
+  std::span<const Definition> defs = Get_Definitions(sym);
+  if (defs.empty()) {
+    return nullptr;
+  }
+
+  for (const Definition &def : defs) {
+    if (Get_Module_Name(def.Module) == module) {
+      return &def;
+    }
+  }
+
+  /* A local symbol of some other object is not visible to `module`.  */
+  for (const Definition &def : defs) {
+    if (ElfSymbol::Bind_Of(def.Info) != STB_LOCAL) {
+      return &def;
+    }
+  }
+
+  return nullptr;
+}
+
+std::vector<std::string> KernelSymbolIndex::Get_All_Symbols(void) const
+{
+  std::vector<std::string> vec;
+  vec.reserve(NameOffsets.size() - 1);
+
+  for (uint32_t id = 0; id + 1 < NameOffsets.size(); id++) {
+    vec.push_back(std::string(Get_String(Names, NameOffsets, id)));
+  }
+
+  return vec;
+}
@@ -0,0 +1,111 @@
+//===- KernelSymbolIndex.hh - Index the symbols of a kernel build -*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Index the symbols defined by vmlinux and every module of a kernel build.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+
+class MappedFile;
+
+/** @brief Index of the symbols defined by vmlinux and the kernel modules.
+ *
+ * The debuginfo given to clang-extract is of the object being patched, so a
+ * symbol defined by some other module can not be attributed to it.  This
+ * index is built once per kernel build, by scanning vmlinux and all the .ko
+ * files of the build tree in parallel, and tells for every symbol which
+ * objects define it, with which binding and on which symbol table.
+ *
+ * The index is a file which is used right from its mapping, so loading it
+ * costs nothing no matter how many modules the kernel has.
+ */
+class KernelSymbolIndex
+{
+  public:
+  /** Load the index from the file at `path`.  */
+  KernelSymbolIndex(const char *path);
+  ~KernelSymbolIndex(void);
+
+  KernelSymbolIndex(const KernelSymbolIndex &) = delete;
+
+  /** A definition of a symbol by some object.  */
+  struct Definition
+  {
+    /* Id of the object, see Get_Module_Name.  */
+    uint16_t Module;
+
+    /* The ELF `info` of the symbol, which packs its type and binding.  */
+    uint8_t Info;
+
+    /* The symbol table where it was found, SHT_SYMTAB or SHT_DYNSYM.  */
+    uint8_t Symtab;
+  };
+
+  /** Scan vmlinux and the .ko files in the kernel build tree at `tree`, and
+      write the index of the symbols they define to `output`.  */
+  static void Build(const char *tree, const char *output);
+
+  /** Check if the file at `path` is an index.  */
+  static bool Is_Index_File(const char *path);
+
+  /** Get every definition of `sym`, in the order the objects were scanned,
+      which is vmlinux first.  Empty if no object defines `sym`.  */
+  std::span<const Definition> Get_Definitions(std::string_view sym) const;
+
+  /** Get the definition of `sym` that code of `module` most likely refers to:
+      the one in `module` itself, else the first one which is not local.
+      Returns nullptr if no such definition exists, e.g. if `sym` is only
+      defined as local symbols of other objects.  */
+  const Definition *Find_Definition(std::string_view sym,
+                                    std::string_view module) const;
+
+  /** Get the name of the module with id `id`, e.g. `vmlinux`.  */
+  std::string_view Get_Module_Name(uint16_t id) const;
+
+  /** Get the name of every symbol.  */
+  std::vector<std::string> Get_All_Symbols(void) const;
+
+  private:
+  struct Header;
+
+  /** Get the id of `sym`, or UINT32_MAX if no object defines it.  */
+  uint32_t Get_Symbol_Id(std::string_view sym) const;
+
+  /** Get the string `id` of a blob of NUL terminated strings.  */
+  static std::string_view Get_String(std::string_view blob,
+                                     std::span<const uint32_t> offsets,
+                                     uint32_t id);
+
+  /** The mapped index file.  */
+  std::unique_ptr<MappedFile> File;
+
+  /** Names of the modules, and where each one starts.  */
+  std::string_view ModuleNames;
+  std::span<const uint32_t> ModuleOffsets;
+
+  /** Names of the symbols, and where each one starts.  */
+  std::string_view Names;
+  std::span<const uint32_t> NameOffsets;
+
+  /** Open addressing hash table of symbol ids.  */
+  std::span<const uint32_t> Slots;
+
+  /** The definitions of symbol `i` are from Definitions[DefinitionsIndex[i]]
+      up to Definitions[DefinitionsIndex[i + 1]].  */
+  std::span<const uint32_t> DefinitionsIndex;
+  std::span<const Definition> Definitions;
+};
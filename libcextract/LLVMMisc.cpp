@@ -16,6 +16,7 @@
 
 #include "LLVMMisc.hh"
 #include "NonLLVMMisc.hh"
+#include "SourceScanner.hh"
 
 /** Check if Decl is a builtin.  */
 bool Is_Builtin_Decl(const Decl *decl)
@@ -140,102 +141,6 @@ DeclaratorDecl *Get_With_Body_Or_Itself(DeclaratorDecl *decl)
   return with_body ? with_body : decl;
 }
 
-/* Get the TopLevel Decl that contains the location loc.  */
-Decl *Get_Toplevel_Decl_At_Location(ASTUnit *ast, const SourceLocation &loc)
-{
-  SourceManager &SM = ast->getSourceManager();
-  /* We don't have a way of accessing the TopLevel vector directly, hence we
-     do this.  */
-  char *p = (char *) &(*ast->top_level_begin());
-  char *q = (char *) &(*ast->top_level_end());
-
-  int n = (((ptrdiff_t)(q - p))/sizeof(Decl *));
-
-  Decl **array = (Decl **)p;
-
-  /* Do binary search.  */
-  int low = 0;
-  int high = n-1;
-  while (low <= high) {
-    int mid = low + (high - low)/2;
-
-    Decl *decl = array[mid];
-    /* Get rid of some weird macro locations.  We want the location where
-       it was expanded.  */
-    SourceRange decl_range(SM.getExpansionLoc(decl->getBeginLoc()),
-                           SM.getExpansionLoc(decl->getEndLoc()));
-
-    if (decl_range.fullyContains(loc)) {
-      return decl;
-    }
-
-    if (SM.isBeforeInTranslationUnit(decl_range.getBegin(), loc)) {
-      low = mid + 1;
-    } else {
-      high = mid - 1;
-    }
-  }
-
-  return nullptr;
-}
-
-ArrayRef<Decl *> Get_Toplev_Decls_With_Same_Beginloc(ASTUnit *ast, const SourceLocation &loc)
-{
-  SourceManager &SM = ast->getSourceManager();
-  /* We don't have a way of accessing the TopLevel vector directly, hence we
-     do this.  */
-  char *p = (char *) &(*ast->top_level_begin());
-  char *q = (char *) &(*ast->top_level_end());
-
-  int n = (((ptrdiff_t)(q - p))/sizeof(Decl *));
-
-  Decl **array = (Decl **)p;
-
-  /* Do binary search.  */
-  int low = 0;
-  int high = n-1;
-  while (low <= high) {
-    int mid = low + (high - low)/2;
-
-    Decl *decl = array[mid];
-    /* Get rid of some weird macro locations.  We want the location where
-       it was expanded.  */
-    SourceLocation begin = SM.getExpansionLoc(decl->getBeginLoc());
-
-    if (begin == loc) {
-      /* Go back to the first declaration.  */
-      int last_l = mid;
-      for (int l = mid; l >= 0; --l) {
-        if (SM.getExpansionLoc(array[l]->getBeginLoc()) == loc) {
-          last_l = l;
-        } else {
-          break;
-        }
-      }
-
-      /* Go forward to the last declaration.  */
-      int last_h = mid;
-      for (int h = mid; h < n; ++h) {
-        if (SM.getExpansionLoc(array[h]->getBeginLoc()) == loc) {
-          last_h = h;
-        } else {
-          break;
-        }
-      }
-
-      return ArrayRef(&array[last_l], &array[last_h+1]);
-    }
-
-    if (SM.isBeforeInTranslationUnit(begin, loc)) {
-      low = mid + 1;
-    } else {
-      high = mid - 1;
-    }
-  }
-
-  return ArrayRef<Decl *>(nullptr, size_t(0));
-}
-
 std::string Build_CE_Location_Comment(SourceManager &sm, const SourceLocation &loc)
 {
   PresumedLoc presumed = sm.getPresumedLoc(loc);
@@ -316,52 +221,31 @@ bool Is_Decl_Equivalent_To(Decl *a, Decl *b)
   return a_str == b_str;
 }
 
-#define TOKEN_VECTOR " ().,;+-*/^|&{}[]<>^&|!\r\n\t"
-
 /** Check if string has unmatched #if, #ifdef, #ifndef.  */
 bool Has_Balanced_Ifdef(const StringRef &string)
 {
-  /* Create a temporary buffer for strtok and copy the string.  */
-  size_t len = string.size();
-  char buf[len + 1];
-  memcpy(buf, string.data(), len);
-  buf[len] = '\0';
-
   /* Count the number of parenthesis problem. ifdef, ifndef, if increases,
      endif decreases.  */
   int balance = 0;
 
-  /* Tokenize.  */
-  char *tok = strtok(buf, TOKEN_VECTOR);
-  while (tok != nullptr) {
-    /* There is the silly case in which #ifdef is written as `#  ifdef`.  */
-    if (*tok == '#') {
-      /* Now check if it got into the same token or if we need to pull another
-         token.  */
-      if (tok[1] == '\0') {
-        tok = strtok(nullptr, TOKEN_VECTOR);
-      } else {
-        tok++;
-      }
+  SourceScanner scanner(string);
+  std::string_view directive;
+  size_t offset;
 
-      assert(tok != nullptr && "tok is null! why?");
-
-      /* Case 1: #ifdef, #ifndef, and #if has "if" as prefix.  */
-      if (prefix("if", tok)) {
-        balance++;
-      }
+  while (scanner.Next_Directive(directive, offset)) {
+    /* Case 1: #ifdef, #ifndef, and #if has "if" as prefix.  */
+    if (directive.starts_with("if")) {
+      balance++;
+    }
 
-      /* Case 2: #endif.  Decrease the balance counter.  */
-      else if (strcmp("endif", tok) == 0) {
-        balance--;
-        if (balance < 0) {
-          /* Impossible.  This means there is an #endif for no matching #if.  */
-          return false;
-        }
+    /* Case 2: #endif.  Decrease the balance counter.  */
+    else if (directive == "endif") {
+      balance--;
+      if (balance < 0) {
+        /* Impossible.  This means there is an #endif for no matching #if.  */
+        return false;
       }
     }
-
-    tok = strtok(nullptr, TOKEN_VECTOR);
   }
 
   return balance == 0;
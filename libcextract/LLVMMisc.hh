@@ -83,12 +83,6 @@ DeclaratorDecl *Get_With_Body(DeclaratorDecl *decl);
 /** Get version of declarator with body or itself.  */
 DeclaratorDecl *Get_With_Body_Or_Itself(DeclaratorDecl *decl);
 
-/* Get the TopLevel Decl that contains the location loc.  */
-Decl *Get_Toplevel_Decl_At_Location(ASTUnit *ast, const SourceLocation &loc);
-
-/* Get Toplevel decls with same beginloc.  */
-ArrayRef<Decl *> Get_Toplev_Decls_With_Same_Beginloc(ASTUnit *ast, const SourceLocation &loc);
-
 /** Build a clang-extract location comment.  */
 std::string Build_CE_Location_Comment(SourceManager &sm, const SourceLocation &loc);
 
@@ -25,8 +25,10 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 
 #include <iostream>
+#include <stdexcept>
 
 /** @brief Handle some quirks of getline.  */
 char *getline_easy(FILE *file)
@@ -59,6 +61,15 @@ bool Is_Directory(const char *path)
   }
 }
 
+uint64_t Append_Aligned(std::string &buffer, const void *data, size_t size)
+{
+  buffer.resize((buffer.size() + 7) & ~(size_t) 7, '\0');
+
+  uint64_t offset = buffer.size();
+  buffer.append((const char *) data, size);
+  return offset;
+}
+
 std::vector<std::string> Extract_Args(const char *str)
 {
   std::vector<std::string> arg_list;
@@ -152,3 +163,43 @@ const char *get_basename(const char *path)
 #endif
   return base ? base+1 : path;
 }
+
+MappedFile::MappedFile(const char *path, bool sequential)
+  : Ptr(nullptr),
+    Len(0)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open file: " + std::string(path));
+  }
+
+  struct stat s;
+  if (fstat(fd, &s) < 0) {
+    close(fd);
+    throw std::runtime_error("Unable to stat file: " + std::string(path));
+  }
+
+  /* Mapping an empty file fails, and there is nothing to map anyway.  */
+  if (s.st_size > 0) {
+    void *map = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Unable to mmap file: " + std::string(path));
+    }
+
+    madvise(map, s.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+    Ptr = (const char *) map;
+    Len = s.st_size;
+  }
+
+  /* The mapping stays valid after the file is closed.  */
+  close(fd);
+}
+
+MappedFile::~MappedFile(void)
+{
+  if (Ptr) {
+    munmap((void *) Ptr, Len);
+  }
+}
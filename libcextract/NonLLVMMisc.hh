@@ -22,8 +22,10 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
 
@@ -67,6 +69,10 @@ char *getline_easy(FILE *file);
 /** Check if given path is a directory.  */
 bool Is_Directory(const char *path);
 
+/** Append `size` bytes of `data` to `buffer` at an offset aligned to 8 bytes,
+    and return that offset.  Used to write files which are later mapped.  */
+uint64_t Append_Aligned(std::string &buffer, const void *data, size_t size);
+
 /** Extract arguments that are specified after the '=' sign separated by ','.  */
 std::vector<std::string> Extract_Args(const char *str);
 
@@ -92,5 +98,42 @@ class FileHandling
   static enum FileType Get_File_Type(int fd);
 };
 
+/** @brief A whole file mapped read-only into memory.
+  *
+  * Avoids reading large files line by line into heap allocated buffers.  The
+  * file is unmapped when the object is destroyed.
+  */
+class MappedFile
+{
+  public:
+  /** Map the file at `path`.  Throws if the file can not be mapped.  If
+      `sequential` is true the kernel is told that the file will be read from
+      start to end, else that it will be accessed at random.  */
+  MappedFile(const char *path, bool sequential = true);
+  ~MappedFile(void);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  inline const char *Data(void) const
+  {
+    return Ptr;
+  }
+
+  inline size_t Size(void) const
+  {
+    return Len;
+  }
+
+  inline std::string_view View(void) const
+  {
+    return std::string_view(Ptr, Len);
+  }
+
+  private:
+  const char *Ptr;
+  size_t Len;
+};
+
 /** Get basename of a string.  Works like the gnu version.  */
 const char *get_basename(const char *filename);
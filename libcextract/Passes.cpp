@@ -27,9 +27,15 @@
 #include "Error.hh"
 #include "HeaderGenerate.hh"
 #include "LLVMMisc.hh"
+#include "CachingFileSystem.hh"
+#include "ClosureFingerprint.hh"
 
+#include "clang/AST/ASTConsumer.h"
 #include "clang/Frontend/ASTUnit.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
 
 #include <iostream>
 
@@ -50,8 +56,85 @@ void Print_AST(ASTUnit *ast)
   */
 extern IntrusiveRefCntPtr<llvm::vfs::FileSystem> _Hack_VFS;
 
+/** Create the filesystem of the passes: the real filesystem, through the
+    cache shared by every parse, with an in-memory one on top of it.  */
+static void Create_VFS(PassManager::Context *ctx)
+{
+  /* Create a virtual file system.  */
+  ctx->OFS = IntrusiveRefCntPtr<vfs::OverlayFileSystem>(new vfs::OverlayFileSystem(CachingFileSystem::Get_Instance()));
+  ctx->MFS = IntrusiveRefCntPtr<vfs::InMemoryFileSystem>(new vfs::InMemoryFileSystem);
+
+  /* Push an additional memory filesystem on top of the overlay filesystem
+     which will hold temporary modified files.  */
+  ctx->OFS->pushOverlay(ctx->MFS);
+}
+
+/** Consumer which tells the parser to skip the body of every function which
+    is not named in ParsedBodies.  As ASTUnit only tracks the top level decls
+    when it creates the action itself, the consumer also records them into
+    the ASTUnit.  */
+class SkipBodiesConsumer : public ASTConsumer
+{
+  public:
+  SkipBodiesConsumer(ASTUnit &unit,
+                     const std::unordered_set<std::string> &parsed_bodies)
+    : Unit(unit),
+      ParsedBodies(parsed_bodies)
+  {
+  }
+
+  virtual bool HandleTopLevelDecl(DeclGroupRef group) override
+  {
+    for (Decl *decl : group) {
+      Unit.addTopLevelDecl(decl);
+    }
+    return true;
+  }
+
+  virtual bool shouldSkipFunctionBody(Decl *decl) override
+  {
+    FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl);
+    if (fdecl == nullptr || !fdecl->getDeclName().isIdentifier()) {
+      return false;
+    }
+
+    return ParsedBodies.find(fdecl->getName().str()) == ParsedBodies.end();
+  }
+
+  private:
+  /* The ASTUnit being built, where the top level decls go.  */
+  ASTUnit &Unit;
+
+  /* Kept by copy, as the ASTUnit keeps the consumer after parsing.  */
+  std::unordered_set<std::string> ParsedBodies;
+};
+
+/** Action which parses the input into `unit` with a SkipBodiesConsumer.  */
+class SkipBodiesAction : public ASTFrontendAction
+{
+  public:
+  SkipBodiesAction(ASTUnit &unit,
+                   const std::unordered_set<std::string> &parsed_bodies)
+    : Unit(unit),
+      ParsedBodies(parsed_bodies)
+  {
+  }
+
+  protected:
+  virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &,
+                                                         StringRef) override
+  {
+    return std::make_unique<SkipBodiesConsumer>(Unit, ParsedBodies);
+  }
+
+  private:
+  ASTUnit &Unit;
+  const std::unordered_set<std::string> &ParsedBodies;
+};
+
 bool Build_ASTUnit(PassManager::Context *ctx,
-                   IntrusiveRefCntPtr<vfs::FileSystem> fs /*= nullptr*/)
+                   IntrusiveRefCntPtr<vfs::FileSystem> fs /*= nullptr*/,
+                   const std::unordered_set<std::string> *parsed_bodies /*= nullptr*/)
 {
   ctx->AST.reset();
 
@@ -60,14 +143,7 @@ bool Build_ASTUnit(PassManager::Context *ctx,
   std::shared_ptr<PCHContainerOperations> PCHContainerOps;
 
   if (!fs) {
-    /* Create a virtual file system.  */
-    ctx->OFS = IntrusiveRefCntPtr<vfs::OverlayFileSystem>(new vfs::OverlayFileSystem(vfs::getRealFileSystem()));
-    ctx->MFS = IntrusiveRefCntPtr<vfs::InMemoryFileSystem>(new vfs::InMemoryFileSystem);
-
-    /* Push an additional memory filesystem on top of the overlay filesystem
-       which will hold temporary modified files.  */
-    ctx->OFS->pushOverlay(ctx->MFS);
-
+    Create_VFS(ctx);
     fs = ctx->OFS;
   }
 
@@ -90,6 +166,11 @@ bool Build_ASTUnit(PassManager::Context *ctx,
 
   PCHContainerOps = std::make_shared<PCHContainerOperations>();
 
+  /* The parser only asks the consumer whether to skip a body when told to
+     skip function bodies.  */
+  if (parsed_bodies) {
+    CInvok->getFrontendOpts().SkipFunctionBodies = true;
+  }
 
   /* Hacked function call, see ASTUnitHack.cpp.  */
   auto AU = ASTUnit::create(ClangCompat_ASTUP(CInvok,
@@ -99,11 +180,16 @@ bool Build_ASTUnit(PassManager::Context *ctx,
                                               false));
   std::unique_ptr<ASTUnit> *ErrAST = nullptr;
 
+  std::unique_ptr<SkipBodiesAction> action;
+  if (parsed_bodies) {
+    action = std::make_unique<SkipBodiesAction>(*AU, *parsed_bodies);
+  }
+
   ASTUnit::LoadFromCompilerInvocationAction(ClangCompat_ASTULFCIAP(
                                             CInvok, PCHContainerOps,
                                             diagopts,
                                             Diags,
-                                            nullptr, AU.get(),
+                                            action.get(), AU.get(),
                                             /*Persistent=*/true,
                                             /*ResourceFilesPath=*/StringRef(),
                                             /*OnlyLocalDecls=*/false,
@@ -167,6 +253,26 @@ static std::string Get_Output_Path(PassManager::Context *ctx)
   return output_path;
 }
 
+/** Parse the code with the changes the externalizer committed to the
+    filesystem, and set its new SourceManager to the PrettyPrint class.  The
+    resident AST must keep seeing the files on disk, so build a new one if
+    this is still it.  */
+static bool Parse_Externalized_Code(PassManager::Context *ctx)
+{
+  if (ctx->Resident && ctx->AST == ctx->Resident->AST) {
+    if (!Build_ASTUnit(ctx, ctx->OFS)) {
+      return false;
+    }
+  } else {
+    ctx->AST->Reparse(std::make_shared<PCHContainerOperations>(),
+                      {}, ctx->OFS);
+    PrettyPrint::Set_AST(ctx->AST.get());
+  }
+
+  const DiagnosticsEngine &de = ctx->AST->getDiagnostics();
+  return !de.hasErrorOccurred();
+}
+
 /** BuildASTPass: Built the AST object and store it into the Context object.
  *
  * This may be the first pass of the pass queue, as the AST object is used by
@@ -247,10 +353,71 @@ class BuildASTPass : public Pass
     return true;
   }
 
+  /** Check if the bodies of the functions which are not in the closure can
+      be skipped.  The first pass to use the AST must be the ClosurePass which
+      parses its output again, so that every later pass sees every body of
+      the output.  A resident AST is reused for any set of functions.  */
+  bool Should_Skip_Function_Bodies(PassManager::Context *ctx)
+  {
+    return ctx->SkipFunctionBodies && !ctx->Resident &&
+           !ctx->ExternalizationDisabled && ctx->FuncExtractNames.size() > 0;
+  }
+
+  /** Take the AST from ctx->Resident if it was built with the same
+      arguments, else build it and keep it there.  */
+  bool Build_Resident_AST(PassManager::Context *ctx)
+  {
+    ResidentAST *resident = ctx->Resident;
+    std::vector<std::string> args(ctx->ClangArgs.begin(), ctx->ClangArgs.end());
+
+    /* The passes add their temporary code to a filesystem of their own, so
+       that the resident AST always sees the files on disk.  */
+    Create_VFS(ctx);
+
+    if (resident->AST && resident->ClangArgs == args) {
+      /* Reparsing picks up any change to the files, and throws away the
+         changes the passes of the previous run did to the AST.  There is no
+         precompiled preamble: the decls and locations loaded from it are not
+         handled by the passes, e.g. they are not top level decls of the
+         ASTUnit.  The files themselves are not read again if they did not
+         change, as CachingFileSystem keeps them.  */
+      if (!resident->AST->Reparse(std::make_shared<PCHContainerOperations>(),
+                                  {}, resident->OFS)) {
+        ctx->AST = resident->AST;
+        PrettyPrint::Set_AST(ctx->AST.get());
+        return true;
+      }
+    }
+
+    resident->AST.reset();
+    resident->ClangArgs = std::move(args);
+    resident->OFS = IntrusiveRefCntPtr<vfs::OverlayFileSystem>(
+                      new vfs::OverlayFileSystem(CachingFileSystem::Get_Instance()));
+
+    if (!Build_ASTUnit(ctx, resident->OFS)) {
+      return false;
+    }
+
+    resident->AST = ctx->AST;
+    return true;
+  }
+
   virtual bool Run_Pass(PassManager::Context *ctx)
   {
-    if (!Build_ASTUnit(ctx))
+    if (ctx->Resident) {
+      if (!Build_Resident_AST(ctx))
+        return false;
+    } else if (Should_Skip_Function_Bodies(ctx)) {
+      /* Only the bodies of the functions to extract are parsed at first.
+         The first ClosurePass parses the ones the closure needs.  */
+      ctx->ParsedBodies.insert(ctx->FuncExtractNames.begin(),
+                               ctx->FuncExtractNames.end());
+      ctx->SkippedBodiesArgs = ctx->ClangArgs;
+      if (!Build_ASTUnit(ctx, nullptr, &ctx->ParsedBodies))
+        return false;
+    } else if (!Build_ASTUnit(ctx)) {
       return false;
+    }
 
     /* Remove any unwanted arguments from command line.  */
     Update_Clang_Args(ctx);
@@ -378,22 +545,115 @@ class ClosurePass : public Pass
              ctx->FuncExtractNames.size() > 0;
     }
 
+    /** Parse the input again with the bodies of the functions in the closure
+        which were skipped, until the closure has no skipped body.  The
+        closure only grows with more bodies, so it ends up being the same as
+        if every body was parsed.  */
+    bool Parse_Closure_Bodies(PassManager::Context *ctx)
+    {
+      /* Parse with the arguments the AST was built with, and not with the
+         ones for parsing the output.  */
+      std::swap(ctx->ClangArgs, ctx->SkippedBodiesArgs);
+
+      bool ok = true;
+      while (ok) {
+        FunctionDependencyFinder fdf(ctx);
+        if (fdf.Run_Analysis(ctx->FuncExtractNames) == false) {
+          ok = false;
+          break;
+        }
+
+        size_t num_parsed = ctx->ParsedBodies.size();
+        for (const std::string &name : fdf.Get_Functions_With_Skipped_Body()) {
+          ctx->ParsedBodies.insert(name);
+        }
+
+        if (ctx->ParsedBodies.size() == num_parsed) {
+          break;
+        }
+
+        ok = Build_ASTUnit(ctx, ctx->OFS, &ctx->ParsedBodies);
+
+        /* The bodies just parsed may have errors.  */
+        const DiagnosticsEngine &de = ctx->AST->getDiagnostics();
+        if (ok && ctx->IgnoreClangErrors == false && de.hasErrorOccurred()) {
+          ok = false;
+        }
+      }
+
+      std::swap(ctx->ClangArgs, ctx->SkippedBodiesArgs);
+      ctx->SkippedBodiesArgs.clear();
+      ctx->ParsedBodies.clear();
+
+      return ok;
+    }
+
     virtual bool Run_Pass(PassManager::Context *ctx)
     {
-      ctx->CodeOutput = std::string();
-      raw_string_ostream code_stream(ctx->CodeOutput);
+      if (!ctx->SkippedBodiesArgs.empty() && !Parse_Closure_Bodies(ctx)) {
+        return false;
+      }
+
+      /* Print directly into a vector which is later adopted by the in-memory
+         filesystem, avoiding copying the (possibly very large) output.  */
+      SmallVector<char, 0> code;
+      raw_svector_ostream code_stream(code);
 
       PrettyPrint::Set_Output_Ostream(&code_stream);
 
-      /* Compute closure and output the code.  */
+      /* Compute closure and output the code.  In case the externalizer left
+         its changes pending, the closure is computed in the AST before the
+         changes and they are applied to the code as it is printed.  The
+         closure may have a few more decls than needed then, but they are
+         removed when computing the closure again below.  */
+      const std::vector<std::string> &names = ctx->PendingTM
+                                              ? ctx->FuncExtractNamesInAST
+                                              : ctx->FuncExtractNames;
+      PrettyPrint::Set_Text_Modifications(ctx->PendingTM.get());
       FunctionDependencyFinder fdf(ctx);
-      if (fdf.Run_Analysis(ctx->FuncExtractNames) == false) {
+      bool closure_ok = fdf.Run_Analysis(names);
+      if (closure_ok && ctx->FingerprintPath && !ctx->Fingerprint) {
+        if (Is_Output_Up_To_Date(ctx, fdf)) {
+          /* Nothing is printed, so don't leave the PrettyPrint pointing to
+             the changes or to `code_stream`, which is about to go away.  */
+          PrettyPrint::Set_Text_Modifications(nullptr);
+          PrettyPrint::Set_Output_Ostream(&llvm::outs());
+          ctx->PendingTM.reset();
+          ctx->OutputUpToDate = true;
+          return true;
+        }
+      }
+      if (closure_ok) {
+        fdf.Print();
+      }
+
+      /* Some decl touched by the changes had to be dumped from the AST, which
+         does not have them.  Parse the changes, as if they were not left
+         pending, and print again.  */
+      if (closure_ok && PrettyPrint::Text_Modifications_Lost()) {
+        PrettyPrint::Set_Text_Modifications(nullptr);
+        ctx->PendingTM.reset();
+
+        if (!Parse_Externalized_Code(ctx)) {
+          return false;
+        }
+
+        code.clear();
+        FunctionDependencyFinder fdf_parsed(ctx);
+        closure_ok = fdf_parsed.Run_Analysis(ctx->FuncExtractNames);
+        if (closure_ok) {
+          fdf_parsed.Print();
+        }
+      }
+      PrettyPrint::Set_Text_Modifications(nullptr);
+      ctx->PendingTM.reset();
+
+      if (closure_ok == false) {
         return false;
       }
-      fdf.Print();
 
-      /* Add the temporary string with code to the filesystem.  */
-      ctx->MFS->addFile(ctx->InputPath, 0, MemoryBuffer::getMemBufferCopy(ctx->CodeOutput));
+      /* Add the temporary code to the filesystem.  */
+      Add_Code_To_MFS(ctx, code);
 
       //Print_AST(ctx->AST.get());
 
@@ -424,7 +684,7 @@ class ClosurePass : public Pass
         std::string output_path = Get_Output_Path(ctx);
         PrettyPrint::Set_Output_To(output_path);
       } else {
-        ctx->CodeOutput = std::string();
+        code.clear();
         PrettyPrint::Set_Output_Ostream(&code_stream);
       }
 
@@ -435,13 +695,110 @@ class ClosurePass : public Pass
       }
       fdf2.Print();
 
-      /* Add the temporary string with code to the filesystem.  */
-      ctx->MFS->addFile(ctx->InputPath, 0, MemoryBuffer::getMemBufferCopy(ctx->CodeOutput));
+      /* Add the temporary code to the filesystem.  */
+      if (!PrintToFile) {
+        PrettyPrint::Set_Output_Ostream(&llvm::outs());
+        Add_Code_To_MFS(ctx, code);
+      }
 
       const DiagnosticsEngine &de2 = ctx->AST->getDiagnostics();
       return !de2.hasErrorOccurred();
     }
 
+    /** Compute the fingerprint of the closure computed by `fdf`, and compare
+        it with the one at ctx->FingerprintPath.  Returns true if they match
+        and every file the run would write exists.  */
+    bool Is_Output_Up_To_Date(PassManager::Context *ctx,
+                              FunctionDependencyFinder &fdf)
+    {
+      ctx->Fingerprint = std::make_unique<ClosureFingerprint>(
+                           fdf.Get_Fingerprint(ctx->IA));
+      ctx->Fingerprint->Add_Member("options", Get_Options_Text(ctx));
+
+      ClosureFingerprint stored;
+      if (!stored.Load(ctx->FingerprintPath)) {
+        return false;
+      }
+
+      std::vector<std::string> differences =
+                                    ctx->Fingerprint->Get_Differences(stored);
+      for (const std::string &difference : differences) {
+        DiagsClass::Emit_Note(std::string(ctx->FingerprintPath) + ": " +
+                              difference);
+      }
+
+      if (!differences.empty()) {
+        return false;
+      }
+
+      /* The passes after this one are skipped as well, so check for the
+         files they write too.  */
+      std::vector<std::string> outputs = { Get_Output_Path(ctx) };
+      if (!is_null_or_empty(ctx->DscOutputPath)) {
+        outputs.push_back(ctx->DscOutputPath);
+      }
+      if (!is_null_or_empty(ctx->OutputFunctionPrototypeHeader)) {
+        outputs.push_back(ctx->OutputFunctionPrototypeHeader);
+      }
+
+      for (const std::string &output : outputs) {
+        if (!llvm::sys::fs::exists(output)) {
+          DiagsClass::Emit_Note(output + " is missing");
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    /** Get the options which change the output other than through the
+        closure.  */
+    std::string Get_Options_Text(PassManager::Context *ctx)
+    {
+      std::string text;
+      auto add_list = [&text](const char *name,
+                              const std::vector<std::string> &list) {
+        text += name;
+        for (const std::string &elem : list) {
+          text += " " + elem;
+        }
+        text += '\n';
+      };
+
+      add_list("extract", ctx->FuncExtractNames);
+      add_list("externalize", ctx->Externalize);
+      add_list("expand", ctx->HeadersToExpand);
+      add_list("not-expand", ctx->HeadersToNotExpand);
+
+      text += "policy " + std::to_string((int) ctx->IncExpansionPolicy) + '\n';
+      text += "flags " + std::to_string(ctx->KeepIncludes) +
+                         std::to_string(ctx->RenameSymbols) +
+                         std::to_string(ctx->Kernel) +
+                         std::to_string(ctx->Ibt) +
+                         std::to_string(ctx->AllowLateExternalizations) +
+                         std::to_string(ctx->OpaqueTypes) + '\n';
+      text += "object " + ctx->PatchObject + '\n';
+      text += "dsc " + std::string(ctx->DscOutputPath ? ctx->DscOutputPath : "") + '\n';
+      text += "header " + std::string(ctx->OutputFunctionPrototypeHeader
+                                      ? ctx->OutputFunctionPrototypeHeader
+                                      : "") + '\n';
+      return text;
+    }
+
+    /** Hand the printed code to the in-memory filesystem.  The vector is
+        moved into the MemoryBuffer, so `code` is left empty.  */
+    void Add_Code_To_MFS(PassManager::Context *ctx, SmallVector<char, 0> &code)
+    {
+      /* The code is only kept around for dumping.  */
+      if (ctx->DumpPasses) {
+        ctx->CodeOutput = std::string(code.data(), code.size());
+      }
+
+      ctx->MFS->addFile(ctx->InputPath, 0,
+                        std::make_unique<SmallVectorMemoryBuffer>(
+                          std::move(code), ctx->InputPath));
+    }
+
     virtual void Dump_Result(PassManager::Context *ctx)
     {
       std::error_code ec;
@@ -526,6 +883,11 @@ class FunctionExternalizerPass : public Pass
 
     virtual bool Run_Pass(PassManager::Context *ctx)
     {
+      /* Remember how the functions are named in the current AST.  */
+      if (ctx->ExternalizeInAST) {
+        ctx->FuncExtractNamesInAST = ctx->FuncExtractNames;
+      }
+
       /* Issue externalization.  */
       SymbolExternalizer externalizer(ctx->AST.get(), ctx->IA, ctx->Ibt,
                                       ctx->AllowLateExternalizations,
@@ -551,14 +913,15 @@ class FunctionExternalizerPass : public Pass
         ctx->CodeOutput = externalizer.Get_Modifications_To_Main_File();
       }
 
-      /* Parse the temporary code to apply the changes by the externalizer
-         and set its new SourceManager to the PrettyPrint class.  */
-      ctx->AST->Reparse(std::make_shared<PCHContainerOperations>(),
-                        {}, ctx->OFS);
-      PrettyPrint::Set_AST(ctx->AST.get());
+      if (ctx->ExternalizeInAST) {
+        /* Don't reparse the code.  The next ClosurePass applies the changes
+           when printing the code, and the output it parses is where errors
+           will show up.  */
+        ctx->PendingTM = externalizer.Take_Text_Modifications();
+        return true;
+      }
 
-      const DiagnosticsEngine &de = ctx->AST->getDiagnostics();
-      return !de.hasErrorOccurred();
+      return Parse_Externalized_Code(ctx);
     }
 
     virtual void Dump_Result(PassManager::Context *ctx)
@@ -596,14 +959,19 @@ class FunctionExternalizerPass : public Pass
 class GenerateDscPass : public Pass
 {
   public:
-    GenerateDscPass()
+    GenerateDscPass(bool after_output)
+      : AfterOutput(after_output)
     {
       PassName = "GenerateDscPass";
     }
 
     virtual bool Gate(PassManager::Context *ctx)
     {
-      return !is_null_or_empty(ctx->DscOutputPath);
+      /* The .dsc file needs the externalized symbols in the AST.  In case
+         they are only applied when printing the code, run it on the AST of
+         the output instead.  */
+      return !is_null_or_empty(ctx->DscOutputPath)
+             && AfterOutput == ctx->ExternalizeInAST;
     }
 
     virtual bool Run_Pass(PassManager::Context *ctx)
@@ -621,6 +989,8 @@ class GenerateDscPass : public Pass
     {
       /* The dump is the generated file itself.  */
     }
+
+    bool AfterOutput;
 };
 
 
@@ -676,7 +1046,7 @@ public:
           std::string o;
           llvm::raw_string_ostream outstr(o);
 
-          std::string sym_mod = ctx->IA.Get_Symbol_Module(entry.OldName);
+          std::string_view sym_mod = ctx->IA.Get_Symbol_Module(entry.OldName);
           if (sym_mod.empty())
             sym_mod = "vmlinux";
 
@@ -742,8 +1112,9 @@ PassManager::PassManager()
     new ClosurePass(/*PrintToFile=*/false),
     new FunctionExternalizeFinderPass(),
     new FunctionExternalizerPass(),
-    new GenerateDscPass(),
+    new GenerateDscPass(/*AfterOutput=*/false),
     new ClosurePass(/*PrintToFile=*/true),
+    new GenerateDscPass(/*AfterOutput=*/true),
     new IbtTailGeneratePass(),
     new HeaderGenerationPass(),
   };
@@ -757,11 +1128,16 @@ PassManager::~PassManager()
   }
 }
 
-int PassManager::Run_Passes(ArgvParser &args)
+int PassManager::Run_Passes(ArgvParser &args, InlineAnalysis *ia,
+                            ResidentAST *resident)
 {
+  /* The files may have changed since the last run in this process.  */
+  CachingFileSystem::Get_Instance()->Invalidate_Status();
+
   /* Build context object to avoid using global variables.  */
   try {
-    Context ctx(args);
+    Context ctx(args, ia, resident);
+    bool all_passes_success = true;
 
     /* Run the pass list.  */
     for (Pass *pass : Passes) {
@@ -777,6 +1153,22 @@ int PassManager::Run_Passes(ArgvParser &args)
           std::cerr << '\n' << "Error on pass: " << pass->PassName << '\n';
           return -1;
         }
+        all_passes_success &= pass_success;
+
+        /* Nothing to do if the output is up to date.  */
+        if (ctx.OutputUpToDate) {
+          DiagsClass::Emit_Note("Output is up to date with " +
+                                std::string(ctx.FingerprintPath));
+          break;
+        }
+      }
+    }
+
+    /* Only keep the fingerprint of outputs without errors.  */
+    if (ctx.Fingerprint && !ctx.OutputUpToDate && all_passes_success) {
+      if (!ctx.Fingerprint->Save(ctx.FingerprintPath)) {
+        DiagsClass::Emit_Warn("Unable to write fingerprint to " +
+                              std::string(ctx.FingerprintPath));
       }
     }
   } catch (std::runtime_error &err) {
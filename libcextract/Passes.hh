@@ -19,12 +19,32 @@
 #include "InlineAnalysis.hh"
 #include "SymbolExternalizer.hh"
 #include "ExpansionPolicy.hh"
+#include "ClosureFingerprint.hh"
 #include "clang/Frontend/ASTUnit.h"
 
+#include <unordered_set>
+
 using namespace clang;
 
 class Pass;
 
+/** An ASTUnit kept in memory across runs of the passes by the extraction
+    server, so that the next request for the same translation unit only
+    reparses it.  See ExtractServer.  */
+struct ResidentAST
+{
+  /** The arguments the ASTUnit was built with, which must match the ones of
+      the request for it to be reused.  */
+  std::vector<std::string> ClangArgs;
+
+  /** The ASTUnit, or nullptr if it was not built yet.  */
+  std::shared_ptr<ASTUnit> AST;
+
+  /** The filesystem the ASTUnit was built with.  It only sees the real
+      filesystem, as the passes add their temporary code to their own.  */
+  IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> OFS;
+};
+
 /** @brief Pass manager class: run multiple passes
  *
  * This class encapsulates the engine to run a list of passes. The
@@ -36,15 +56,19 @@ class PassManager {
     PassManager();
     ~PassManager();
 
-    /** Run all passes.  */
-    int Run_Passes(ArgvParser &args);
+    /** Run all passes.  If `ia` is not nullptr it is used instead of
+        building a new InlineAnalysis, and if `resident` is not nullptr the
+        AST is taken from it and kept there.  */
+    int Run_Passes(ArgvParser &args, InlineAnalysis *ia = nullptr,
+                   ResidentAST *resident = nullptr);
 
     /** Context object in which holds the global state of the pass manager.
         It is also used to communicate between the passes.  */
     class Context
     {
       public:
-        Context(ArgvParser &args)
+        Context(ArgvParser &args, InlineAnalysis *ia = nullptr,
+                ResidentAST *resident = nullptr)
           : FuncExtractNames(args.Get_Functions_To_Extract()),
             Externalize(args.Get_Symbols_To_Externalize()),
             OutputFile(args.Get_Output_File()),
@@ -56,25 +80,38 @@ class PassManager {
             Kernel(args.Is_Kernel()),
             Ibt(args.Has_Ibt()),
             AllowLateExternalizations(args.Get_Allow_Late_Externalization()),
+            ExternalizeInAST(args.Should_Externalize_In_AST()),
+            SkipFunctionBodies(args.Should_Skip_Function_Bodies()),
+            OpaqueTypes(args.Should_Use_Opaque_Types()),
             PatchObject(args.Get_PatchObject()),
             HeadersToExpand(args.Get_Headers_To_Expand()),
             HeadersToNotExpand(args.Get_Headers_To_Not_Expand()),
             ClangArgs(args.Get_Args_To_Clang()),
             Debuginfos(args.Get_Debuginfo_Path()),
+            DebuginfoCachePath(args.Get_Debuginfo_Cache_Path()),
             IpaclonesPath(args.Get_Ipaclones_Path()),
             SymversPath(args.Get_Symvers_Path()),
+            KernelIndexPath(args.Get_Kernel_Index_Path()),
             DscOutputPath(args.Get_Dsc_Output_Path()),
             OutputFunctionPrototypeHeader(args.Get_Output_Path_To_Prototype_Header()),
+            FingerprintPath(args.Get_Fingerprint_Path()),
             IncExpansionPolicy(IncludeExpansionPolicy::Get_Overriding(
                                args.Get_Include_Expansion_Policy(), Kernel)),
             NamesLog(),
             PassNum(0),
-            IA(Debuginfos, IpaclonesPath, SymversPath, args.Is_Kernel())
+            OutputUpToDate(false),
+            Resident(resident),
+            OwnedIA(ia ? nullptr :
+                    std::make_unique<InlineAnalysis>(Debuginfos, IpaclonesPath,
+                                                     SymversPath, args.Is_Kernel(),
+                                                     DebuginfoCachePath,
+                                                     KernelIndexPath)),
+            IA(ia ? *ia : *OwnedIA)
         {
         }
 
-        /** The Abstract Syntax Tree.  */
-        std::unique_ptr<ASTUnit> AST;
+        /** The Abstract Syntax Tree.  Shared with Resident, if any.  */
+        std::shared_ptr<ASTUnit> AST;
 
         /** The Overlay File System between the real filesystem and the
             in-memory file system.  */
@@ -116,6 +153,18 @@ class PassManager {
         /** If we can late externalize variables.  */
         bool AllowLateExternalizations;
 
+        /** If the externalization changes are applied when printing the AST
+            rather than by reparsing it.  */
+        bool ExternalizeInAST;
+
+        /** If the bodies of the functions which are not in the closure are
+            skipped when parsing the input.  */
+        bool SkipFunctionBodies;
+
+        /** If records that are only used through pointers are opaque to the
+            closure.  See DeclClosureVisitor::Is_Opaque_Record.  */
+        bool OpaqueTypes;
+
         /** Object that will be patched. */
         std::string PatchObject;
 
@@ -131,18 +180,27 @@ class PassManager {
         /* Path to Debuginfo, if exists.  */
         std::vector<std::string> &Debuginfos;
 
+        /* Directory where debuginfo symbols are cached, if given.  */
+        const char *DebuginfoCachePath;
+
         /* Path to Ipaclones, if exists.  */
         const char *IpaclonesPath;
 
         /* Path to Symvers, if exists.  */
         const char *SymversPath;
 
+        /* Path to the index of the symbols of the kernel build, if exists.  */
+        const char *KernelIndexPath;
+
         /* Path to libpulp .dsc file for output.  */
         const char *DscOutputPath;
 
         /* Output path to a file containing foward declarations of all functions.  */
         const char *OutputFunctionPrototypeHeader;
 
+        /* Path to the fingerprint of the closure of the output, if any.  */
+        const char *FingerprintPath;
+
         /* Policy used to expand includes.  */
         IncludeExpansionPolicy::Policy IncExpansionPolicy;
 
@@ -152,16 +210,48 @@ class PassManager {
         /** Current pass number in the passes list.  */
         int PassNum;
 
+        /** Fingerprint of the closure, computed by the first ClosurePass if
+            FingerprintPath is given.  */
+        std::unique_ptr<ClosureFingerprint> Fingerprint;
+
+        /** Set when the output is up to date with the fingerprint, which
+            stops the passes.  */
+        bool OutputUpToDate;
+
         /** Path to input file.  */
         std::string InputPath;
 
-        /** Generated code by the pass.  */
+        /** Generated code by the pass.  Only kept when dumping the passes.  */
         std::string CodeOutput;
 
+        /** Text modifications done by the externalizer which were not parsed
+            into the AST yet.  Only set when ExternalizeInAST is true, until
+            the next ClosurePass prints the code with them.  */
+        std::unique_ptr<TextModifications> PendingTM;
+
+        /** Names of the functions to extract as they are in the AST while
+            there are PendingTM, as FuncExtractNames may have been renamed.  */
+        std::vector<std::string> FuncExtractNamesInAST;
+
+        /** Names of the functions whose bodies are parsed while the AST has
+            skipped bodies.  See SkipFunctionBodies.  */
+        std::unordered_set<std::string> ParsedBodies;
+
+        /** The arguments the AST with skipped bodies was built with, as
+            ClangArgs are updated for parsing the output.  Empty once the AST
+            has every body the closure needs.  */
+        std::vector<const char *> SkippedBodiesArgs;
+
+        /** Where the AST of the input is kept across runs, or nullptr.  */
+        ResidentAST *Resident;
+
+        /** The InlineAnalysis, unless it was given by the caller.  */
+        std::unique_ptr<InlineAnalysis> OwnedIA;
+
         /* InlineAnalysis object that will persists through the entire analysis.
            Avoid rebuilding it as it may require parsing several very large
            files, thus becoming very slow.  */
-        InlineAnalysis IA;
+        InlineAnalysis &IA;
     };
 
   private:
@@ -194,5 +284,8 @@ class Pass {
     const char *PassName;
 };
 
+/** Build the AST of ctx->ClangArgs into ctx->AST.  If `parsed_bodies` is
+    given, the body of every function not named in it is skipped.  */
 bool Build_ASTUnit(PassManager::Context *ctx,
-                   IntrusiveRefCntPtr<vfs::FileSystem> fs = nullptr);
+                   IntrusiveRefCntPtr<vfs::FileSystem> fs = nullptr,
+                   const std::unordered_set<std::string> *parsed_bodies = nullptr);
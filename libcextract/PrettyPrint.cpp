@@ -18,10 +18,15 @@
 #include "TopLevelASTIterator.hh"
 #include "NonLLVMMisc.hh"
 #include "LLVMMisc.hh"
+#include "SymbolExternalizer.hh"
 
 #include <clang/AST/Attr.h>
 #include <llvm/Support/Regex.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 /** Public methods.  */
 
 #define Out (*Out)
@@ -42,6 +47,7 @@ static void Attr_Order_Fix(Decl *decl)
        with the first one.  */
     for (unsigned i = 0; i < Attrs.size(); ++i) {
       if (isa<AsmLabelAttr>(Attrs[i])) {
+        PrettyPrint::Render_Deferred();
         auto temp = Attrs[i];
         Attrs[i] = Attrs[0];
         Attrs[0] = temp;
@@ -80,6 +86,7 @@ void PrettyPrint::Print_Decl(Decl *decl, bool keep_includes)
     /* FIXME: Why isCompleteDefinitionRequired does not work for EnumDecls?  */
     if (t && ((!e && t->isCompleteDefinitionRequired() == false)
               || (!keep_includes && regex.match(Get_Source_Text(t->getSourceRange()))))) {
+      Render_Deferred();
 
       /* FIXME: The Print_Decl_Raw class will attempt to write this declaration
          as the user wrote, that means WITH a body.  To avoid this, we set
@@ -97,6 +104,7 @@ void PrettyPrint::Print_Decl(Decl *decl, bool keep_includes)
     /* FIXME: Why isCompleteDefinitionRequired does not work for EnumDecls?  */
     if (t && !e && t->isCompleteDefinitionRequired() == false) {
       /* We don't need the full defintion.  Hide the body for Print_Decl_Raw.  */
+      Render_Deferred();
       t->setCompleteDefinition(false);
       full_def_removed = true;
     }
@@ -186,12 +194,13 @@ void PrettyPrint::Print_Decl_Raw(Decl *decl)
            from source location.  */
         TagDecl *tagdecl = typedecl->getAnonDeclWithTypedefName();
         if (tagdecl && tagdecl->getName() == "") {
+          Check_Text_Modifications_Lost(typedecl);
           Out << "typedef ";
-          tagdecl->getDefinition()->print(Out, PPolicy);
+          Print_Decl_Tree_Or_Defer(tagdecl->getDefinition(), PPolicy);
           Out << " " << typedecl->getName();
         } else {
           Attr_Order_Fix(decl);
-          decl->print(Out, PPolicy);
+          Print_Decl_Tree_Or_Defer(decl, PPolicy);
         }
       } else {
         MacroInfo *noinline_info = nullptr;
@@ -211,7 +220,7 @@ void PrettyPrint::Print_Decl_Raw(Decl *decl)
           }
         }
         Attr_Order_Fix(decl);
-        decl->print(Out, LangOpts);
+        Print_Decl_Tree_Or_Defer(decl, LangOpts);
         if (noinline_info) {
           /* Redeclare the macro to the previous value.  */
           PrettyPrint::Print_MacroInfo(noinline_info);
@@ -231,17 +240,92 @@ void PrettyPrint::Print_Decl_Raw(Decl *decl)
          #endif, and not the #ifdef.  In case its not balanced we fallback to
          AST dumping.  */
       if (Has_Balanced_Ifdef(decl_source)) {
-        Out << decl_source;
+        Print_Source_Text(decl_range, decl_source);
       } else {
         /* In case its not balanced, fallback to AST dump.  */
         Attr_Order_Fix(decl);
-        decl->print(Out, LangOpts);
+        Print_Decl_Tree_Or_Defer(decl, LangOpts);
       }
     }
   } else {
     /* Else, we fallback to AST Dumping.  */
     Attr_Order_Fix(decl);
-    decl->print(Out, LangOpts);
+    Print_Decl_Tree_Or_Defer(decl, LangOpts);
+  }
+}
+
+void PrettyPrint::Print_Decl_Tree_Or_Defer(Decl *decl,
+                                           const PrintingPolicy &policy)
+{
+  Check_Text_Modifications_Lost(decl);
+
+  /* Printing the location of an anonymous tag queries the SourceManager,
+     which deferred chunks must not do.  Don't print it in either case so the
+     output does not depend on whether it is chunked.  */
+  PrintingPolicy no_tag_locations(policy);
+  no_tag_locations.AnonymousTagLocations = false;
+
+  if (Chunked) {
+    Chunked->Defer_Decl_Print(decl, no_tag_locations);
+  } else {
+    decl->print(Out, no_tag_locations);
+  }
+}
+
+void PrettyPrint::Render_Deferred(void)
+{
+  if (Chunked) {
+    Chunked->Render();
+  }
+}
+
+void PrettyPrint::Print_Source_Text(const SourceRange &range, StringRef text)
+{
+  if (Edits) {
+    SourceManager &SM = AST->getSourceManager();
+    SourceLocation end = clang::Lexer::getLocForEndOfToken(range.getEnd(), 0,
+                                                           SM, LangOpts);
+    Print_Source_Text(CharSourceRange::getCharRange(range.getBegin(), end), text);
+    return;
+  }
+
+  Out << text;
+}
+
+void PrettyPrint::Print_Source_Text(const CharSourceRange &range, StringRef text)
+{
+  if (Edits) {
+    std::string modified;
+    if (Edits->Get_Modified_Text(range, modified)) {
+      Out << modified;
+      return;
+    }
+  }
+
+  Out << text;
+}
+
+bool PrettyPrint::Has_Text_Modifications(const CharSourceRange &range)
+{
+  return Edits && range.isValid() && Edits->Is_Modified(range);
+}
+
+void PrettyPrint::Check_Text_Modifications_Lost(Decl *decl)
+{
+  if (Edits == nullptr || EditsLost) {
+    return;
+  }
+
+  SourceRange range = decl->getSourceRange();
+  if (range.getBegin().isInvalid() || range.getEnd().isInvalid()) {
+    /* Modifications are always in the source, so it has none.  */
+    return;
+  }
+
+  SourceLocation furthest = Get_Expanded_Loc(decl);
+  if (Has_Text_Modifications(CharSourceRange::getTokenRange(range.getBegin(),
+                                                            furthest))) {
+    EditsLost = true;
   }
 }
 
@@ -249,9 +333,11 @@ void PrettyPrint::Debug_Decl(Decl *decl)
 {
 #undef Out
   auto o = Out;
-  Out = &llvm::outs();
+  auto c = Chunked;
+  Set_Output_Ostream(&llvm::outs());
   Print_Decl(decl);;
   Out = o;
+  Chunked = c;
 #define Out (*Out)
 }
 
@@ -269,7 +355,10 @@ void PrettyPrint::Print_Stmt(Stmt *stmt)
 
 void PrettyPrint::Print_Macro_Def(MacroDefinitionRecord *rec)
 {
-  Out << "#define " << Get_Source_Text(rec->getSourceRange()) << "\n";
+  SourceRange range = rec->getSourceRange();
+  Out << "#define ";
+  Print_Source_Text(range, Get_Source_Text(range));
+  Out << "\n";
 }
 
 void PrettyPrint::Debug_Macro_Def(MacroDefinitionRecord *rec)
@@ -304,7 +393,9 @@ void PrettyPrint::Debug_InclusionDirective(InclusionDirective *include)
 void PrettyPrint::Print_MacroInfo(MacroInfo *info)
 {
   SourceRange range(info->getDefinitionLoc(), info->getDefinitionEndLoc());
-  Out << "#define " << Get_Source_Text(range) << '\n';
+  Out << "#define ";
+  Print_Source_Text(range, Get_Source_Text(range));
+  Out << '\n';
 }
 
 void PrettyPrint::Print_Attr(Attr *attr)
@@ -325,7 +416,11 @@ void PrettyPrint::Print_Raw(const std::string &string)
 
 void PrettyPrint::Print_RawComment(SourceManager &sm, RawComment *comment)
 {
-  Out << comment->getRawText(sm) << '\n';
+  /* Text may have been inserted before the decl, which is where its comment
+     begins.  */
+  Print_Source_Text(CharSourceRange::getCharRange(comment->getSourceRange()),
+                    comment->getRawText(sm));
+  Out << '\n';
 }
 
 /** Private stuff.  */
@@ -523,9 +618,20 @@ SourceLocation PrettyPrint::Get_Expanded_Loc(Decl *decl)
 void PrettyPrint::Set_Output_To(const std::string &path)
 {
   std::error_code ec;
-  static llvm::raw_fd_ostream out(path, ec);
 
-  Set_Output_Ostream(&out);
+  /* Close the file of a previous call first.  */
+  Set_Output_Ostream(&llvm::outs());
+  OutFile = std::make_unique<llvm::raw_fd_ostream>(path, ec);
+
+  Set_Output_Ostream(OutFile.get());
+}
+
+void PrettyPrint::Close_Output_File(void)
+{
+  if (Out == OutFile.get()) {
+    Set_Output_Ostream(&llvm::outs());
+  }
+  OutFile.reset();
 }
 
 StringRef PrettyPrint::Get_Filename_From_Loc(const SourceLocation &loc)
@@ -541,12 +647,147 @@ OptionalFileEntryRef PrettyPrint::Get_FileEntry(const SourceLocation &loc)
 
 /* See PrettyPrint.hh for what they do.  */
 raw_ostream *PrettyPrint::Out = &llvm::outs();
+std::unique_ptr<llvm::raw_fd_ostream> PrettyPrint::OutFile;
+ChunkedOutput *PrettyPrint::Chunked = nullptr;
+TextModifications *PrettyPrint::Edits = nullptr;
+bool PrettyPrint::EditsLost = false;
 LangOptions PrettyPrint::LangOpts;
 PrintingPolicy PrettyPrint::PPolicy(LangOpts);
 ASTUnit *PrettyPrint::AST;
 
 
 
+/** --- ChunkedOutput class code.  */
+
+ChunkedOutput::ChunkedOutput(unsigned num_threads)
+  : Rendered(0),
+    NumThreads(num_threads),
+    Next(0),
+    BatchEnd(0),
+    Batches(0),
+    Busy(0),
+    Stop(false),
+    Pos(0)
+{
+  /* Writes go straight into the current text chunk.  */
+  SetUnbuffered();
+}
+
+ChunkedOutput::~ChunkedOutput(void)
+{
+  {
+    std::lock_guard<std::mutex> guard(Lock);
+    Stop = true;
+  }
+  BatchReady.notify_all();
+
+  for (std::thread &t : Workers) {
+    t.join();
+  }
+}
+
+void ChunkedOutput::write_impl(const char *ptr, size_t size)
+{
+  if (Chunks.empty() || Chunks.back().DeferredDecl != nullptr) {
+    Chunks.emplace_back(nullptr, PrettyPrint::PPolicy);
+  }
+
+  Chunks.back().Text.append(ptr, size);
+  Pos += size;
+}
+
+uint64_t ChunkedOutput::current_pos(void) const
+{
+  return Pos;
+}
+
+void ChunkedOutput::Defer_Decl_Print(Decl *decl, const PrintingPolicy &policy)
+{
+  Deferred.push_back(Chunks.size());
+  Chunks.emplace_back(decl, policy);
+}
+
+void ChunkedOutput::Render_Batch(void)
+{
+  unsigned i;
+  while ((i = Next.fetch_add(1)) < BatchEnd) {
+    Chunk &chunk = Chunks[Deferred[i]];
+    llvm::raw_string_ostream out(chunk.Text);
+    chunk.DeferredDecl->print(out, chunk.Policy);
+  }
+}
+
+void ChunkedOutput::Worker_Loop(void)
+{
+  unsigned seen = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(Lock);
+      BatchReady.wait(guard, [&] { return Stop || Batches != seen; });
+      if (Stop) {
+        return;
+      }
+      seen = Batches;
+    }
+
+    Render_Batch();
+
+    std::lock_guard<std::mutex> guard(Lock);
+    if (--Busy == 0) {
+      BatchDone.notify_one();
+    }
+  }
+}
+
+void ChunkedOutput::Render(void)
+{
+  unsigned end = Deferred.size();
+  unsigned count = end - Rendered;
+
+  Next = Rendered;
+  BatchEnd = end;
+  Rendered = end;
+
+  /* Not worth waking the workers.  */
+  if (NumThreads <= 1 || count <= 1) {
+    Render_Batch();
+    return;
+  }
+
+  if (Workers.empty()) {
+    for (unsigned i = 1; i < NumThreads; i++) {
+      Workers.emplace_back(&ChunkedOutput::Worker_Loop, this);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(Lock);
+    Batches++;
+    Busy = Workers.size();
+  }
+  BatchReady.notify_all();
+
+  Render_Batch();
+
+  std::unique_lock<std::mutex> guard(Lock);
+  BatchDone.wait(guard, [this] { return Busy == 0; });
+}
+
+void ChunkedOutput::Write_To(raw_ostream &out)
+{
+  /* Let the target grow only once.  */
+  uint64_t size = 0;
+  for (Chunk &chunk : Chunks) {
+    size += chunk.Text.size();
+  }
+  out.reserveExtraSpace(size);
+
+  for (Chunk &chunk : Chunks) {
+    out << chunk.Text;
+  }
+}
+
 /** --- New RecursivePrint class code.  */
 
 RecursivePrint::RecursivePrint(ASTUnit *ast,
@@ -664,8 +905,15 @@ void RecursivePrint::Print_Decl(Decl *decl)
     RawComment *comment = ctx.getRawCommentForDeclNoCache(decl);
     if (decl->getBeginLoc().isValid()) {
       if (!Have_Location_Comment(sm, comment)) {
-        std::string comment = Build_CE_Location_Comment(sm, decl->getBeginLoc());
-        PrettyPrint::Print_Raw(comment);
+        /* The comment is not output, but text may have been inserted before
+           the decl, which is where the comment begins.  */
+        if (comment && PrettyPrint::Has_Text_Modifications(
+                         CharSourceRange::getCharRange(comment->getSourceRange()))) {
+          PrettyPrint::Print_RawComment(sm, comment);
+        }
+
+        std::string loc_comment = Build_CE_Location_Comment(sm, decl->getBeginLoc());
+        PrettyPrint::Print_Raw(loc_comment);
       } else {
         /* Just output what it had.  */
         PrettyPrint::Print_RawComment(sm, comment);
@@ -702,6 +950,11 @@ void RecursivePrint::Print_Macro_Undef(MacroDirective *directive)
 
 void RecursivePrint::Print(void)
 {
+  /* Record the output in chunks so the AST dumps can be done in parallel.  */
+  raw_ostream *out = PrettyPrint::Out;
+  ChunkedOutput chunks(std::thread::hardware_concurrency());
+  PrettyPrint::Set_Output_Chunked(&chunks);
+
   while (!ASTIterator.End()) {
     Decl *decl;
 
@@ -728,4 +981,9 @@ void RecursivePrint::Print(void)
         break;
     }
   }
+
+  chunks.Render();
+
+  PrettyPrint::Set_Output_Ostream(out);
+  chunks.Write_To(*out);
 }
@@ -16,6 +16,11 @@
 #pragma once
 
 #include <unordered_set>
+#include <deque>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <clang/Tooling/Tooling.h>
 #include <llvm/Support/raw_ostream.h>
 
@@ -26,6 +31,102 @@
 using namespace clang;
 
 class RecursivePrint;
+class TextModifications;
+
+/** @brief Output stream split into chunks which are rendered in parallel.
+ *
+ * Dumping the AST of a declaration with clang's DeclPrinter is the slowest
+ * part of printing a large file.  When PrettyPrint outputs into this stream,
+ * such dumps are recorded as deferred chunks rather than printed, and any
+ * other text goes into plain text chunks.  Once all entities were visited,
+ * `Render` dump the deferred chunks in worker threads, each one into its
+ * own buffer, and `Write_To` concatenates them in the order they were
+ * recorded.
+ *
+ * Everything that queries the SourceManager (which has internal caches) is
+ * done when the chunk is recorded, hence the workers only read the AST.  For
+ * the same reason, PrettyPrint never prints the location of anonymous tags.
+ * PrettyPrint also mutates the AST while printing, e.g. to hide the body of a
+ * struct, so the chunks deferred so far must be rendered before that,
+ * otherwise they would see the mutation.  As this happens many times per
+ * file, the worker threads are started once and wait for the next batch.
+ */
+class ChunkedOutput : public raw_ostream
+{
+  public:
+  ChunkedOutput(unsigned num_threads);
+  ~ChunkedOutput(void);
+
+  /** Record a chunk that will be filled by printing `decl` using `policy`.  */
+  void Defer_Decl_Print(Decl *decl, const PrintingPolicy &policy);
+
+  /** Render the chunks deferred since the last call.  */
+  void Render(void);
+
+  /** Write every chunk into `out` in the order they were recorded.  */
+  void Write_To(raw_ostream &out);
+
+  private:
+  void write_impl(const char *ptr, size_t size) override;
+  uint64_t current_pos(void) const override;
+
+  /** Print deferred chunks of the current batch until there are none left.  */
+  void Render_Batch(void);
+
+  /** Loop of the worker threads.  */
+  void Worker_Loop(void);
+
+  struct Chunk
+  {
+    Chunk(Decl *decl, const PrintingPolicy &policy)
+      : DeferredDecl(decl),
+        Policy(policy)
+    {}
+
+    /* Text of this chunk.  */
+    std::string Text;
+
+    /* Decl to be printed into Text, or nullptr if this is a text chunk.  */
+    Decl *DeferredDecl;
+    PrintingPolicy Policy;
+  };
+
+  /* A deque so that appending does not move the chunks.  */
+  std::deque<Chunk> Chunks;
+
+  /* Index of deferred chunks in Chunks.  */
+  std::vector<unsigned> Deferred;
+
+  /* Number of chunks in Deferred already rendered.  */
+  unsigned Rendered;
+
+  /* Maximum number of threads used by Render.  */
+  unsigned NumThreads;
+
+  /* Worker threads, started by the first Render that needs them.  The
+     thread calling Render also works on the batch.  */
+  std::vector<std::thread> Workers;
+
+  /* Next chunk in Deferred to be rendered, and the end of the batch.  */
+  std::atomic<unsigned> Next;
+  unsigned BatchEnd;
+
+  /* Protects the fields below.  */
+  std::mutex Lock;
+  std::condition_variable BatchReady;
+  std::condition_variable BatchDone;
+
+  /* Number of batches posted so far.  */
+  unsigned Batches;
+
+  /* Number of workers still in the current batch.  */
+  unsigned Busy;
+
+  /* Whether the workers should exit.  */
+  bool Stop;
+
+  uint64_t Pos;
+};
 
 /** @brief Wrapper class to printing clang AST nodes.
  *
@@ -95,8 +196,39 @@ class PrettyPrint
   static void Set_Output_Ostream(llvm::raw_ostream *out)
   {
     Out = out;
+    Chunked = nullptr;
+  }
+
+  /** Set text modifications to be applied to the source text being output.
+      Used when the changes were not parsed into the AST yet.  */
+  static void Set_Text_Modifications(TextModifications *tm)
+  {
+    Edits = tm;
+    EditsLost = false;
   }
 
+  /** Check if a decl touched by the text modifications had to be output as
+      an AST dump since they were set, which does not have them applied.  The
+      output is wrong in that case, and the changes must be parsed first.  */
+  static bool Text_Modifications_Lost(void)
+  {
+    return EditsLost;
+  }
+
+  /** Check if the text modifications touch `range`.  */
+  static bool Has_Text_Modifications(const CharSourceRange &range);
+
+  /** Set output to a ChunkedOutput, which defers the AST dumps.  */
+  static void Set_Output_Chunked(ChunkedOutput *out)
+  {
+    Out = out;
+    Chunked = out;
+  }
+
+  /** Render the deferred AST dumps, if any.  Must be called before mutating
+      the AST while printing.  */
+  static void Render_Deferred(void);
+
   /** Gets the portion of the code that corresponds to given SourceRange, including the
       last token. Returns expanded macros.
 
@@ -126,6 +258,9 @@ class PrettyPrint
   /** Set output to file.  */
   static void Set_Output_To(const std::string &path);
 
+  /** Flush and close the file opened by Set_Output_To, if any.  */
+  static void Close_Output_File(void);
+
   static StringRef Get_Filename_From_Loc(const SourceLocation &loc);
 
   static SourceLocation Get_Expanded_Loc(Decl *decl);
@@ -139,10 +274,36 @@ class PrettyPrint
 
   static bool Is_Range_Valid(const SourceRange &loc);
 
+  /** Print the AST dump of decl, or defer it if output is chunked.  */
+  static void Print_Decl_Tree_Or_Defer(Decl *decl, const PrintingPolicy &policy);
+
+  /** Output `text`, which is the source text of `range`, with the pending
+      text modifications applied if there are any.  */
+  static void Print_Source_Text(const SourceRange &range, StringRef text);
+
+  /** Same as above, but for a range which end is not a token.  */
+  static void Print_Source_Text(const CharSourceRange &range, StringRef text);
+
+  /** Flag the text modifications as lost if they touch `decl`, which is
+      about to be output as an AST dump.  */
+  static void Check_Text_Modifications_Lost(Decl *decl);
+
   /** Output object to where this class will output to.  Current default is the
       same as llvm::outs().  */
   static raw_ostream *Out;
 
+  /** The file opened by Set_Output_To.  */
+  static std::unique_ptr<llvm::raw_fd_ostream> OutFile;
+
+  /** Same as Out when output is a ChunkedOutput, else nullptr.  */
+  static ChunkedOutput *Chunked;
+
+  /** Text modifications not yet parsed into the AST, or nullptr.  */
+  static TextModifications *Edits;
+
+  /** Set when a decl touched by Edits was output as an AST dump.  */
+  static bool EditsLost;
+
   /** Language options used by clang's internal PrettyPrinter.  We use the
       default options for now.  */
   static LangOptions LangOpts;
@@ -156,6 +317,7 @@ class PrettyPrint
   static ASTUnit *AST;
 
   friend class RecursivePrint;
+  friend class ChunkedOutput;
 };
 
 /** Since writing PrettyPrint::Print_Decl can be bothering and result in
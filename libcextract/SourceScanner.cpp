@@ -0,0 +1,290 @@
+//===- SourceScanner.cpp - Scan source text for identifiers and directives *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Scan source text for identifiers and preprocessor directives.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SourceScanner.hh"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define SCANNER_X86
+# include <immintrin.h>
+#endif
+
+typedef SourceScanner::BlockMasks BlockMasks;
+
+static inline bool Is_Ident_Char(unsigned char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '$' || c >= 0x80;
+}
+
+/** Classify `n` bytes, n <= BLOCK_SIZE, one by one.  Used for the tail of
+    the text and on machines without a vectorized classifier.  */
+static BlockMasks Classify_Scalar(const char *p, size_t n)
+{
+  BlockMasks m = { 0, 0, 0 };
+
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = p[i];
+    if (Is_Ident_Char(c)) {
+      m.Ident |= 1U << i;
+    } else if (c == '"' || c == '\'' || c == '/') {
+      m.Skip |= 1U << i;
+    } else if (c == '#') {
+      m.Hash |= 1U << i;
+    }
+  }
+
+  return m;
+}
+
+/* The SSE2 classifier is only built when the target always has SSE2, e.g.
+   not on i586.  The AVX2 one is checked for at runtime.  */
+#if defined(SCANNER_X86) && defined(__SSE2__)
+/* Check if each byte of v is in [lo, hi] as unsigned.  */
+static inline __m128i In_Range_SSE2(__m128i v, char lo, char hi)
+{
+  __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+  __m128i limit = _mm_set1_epi8((char)(hi - lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(t, limit), t);
+}
+
+static BlockMasks Classify_Block_SSE2(const char *p)
+{
+  BlockMasks m = { 0, 0, 0 };
+
+  for (int half = 0; half < 2; half++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * half));
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+    __m128i ident = _mm_or_si128(In_Range_SSE2(lower, 'a', 'z'),
+                                 In_Range_SSE2(v, '0', '9'));
+    ident = _mm_or_si128(ident, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    ident = _mm_or_si128(ident, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+
+    __m128i skip = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    skip = _mm_or_si128(skip, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+    __m128i hash = _mm_cmpeq_epi8(v, _mm_set1_epi8('#'));
+
+    /* Non-ASCII bytes have the high bit set, and movemask gets exactly it.  */
+    uint32_t ident_mask = (uint32_t)(_mm_movemask_epi8(ident) |
+                                     _mm_movemask_epi8(v));
+
+    m.Ident |= ident_mask << (16 * half);
+    m.Skip  |= (uint32_t)_mm_movemask_epi8(skip) << (16 * half);
+    m.Hash  |= (uint32_t)_mm_movemask_epi8(hash) << (16 * half);
+  }
+
+  return m;
+}
+#endif
+
+#ifdef SCANNER_X86
+__attribute__((target("avx2")))
+static inline __m256i In_Range_AVX2(__m256i v, char lo, char hi)
+{
+  __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+  __m256i limit = _mm256_set1_epi8((char)(hi - lo));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(t, limit), t);
+}
+
+__attribute__((target("avx2")))
+static BlockMasks Classify_Block_AVX2(const char *p)
+{
+  __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+
+  __m256i ident = _mm256_or_si256(In_Range_AVX2(lower, 'a', 'z'),
+                                  In_Range_AVX2(v, '0', '9'));
+  ident = _mm256_or_si256(ident, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+  ident = _mm256_or_si256(ident, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+
+  __m256i skip = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                                 _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+  skip = _mm256_or_si256(skip, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+  __m256i hash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('#'));
+
+  BlockMasks m;
+  m.Ident = (uint32_t)(_mm256_movemask_epi8(ident) | _mm256_movemask_epi8(v));
+  m.Skip  = (uint32_t)_mm256_movemask_epi8(skip);
+  m.Hash  = (uint32_t)_mm256_movemask_epi8(hash);
+
+  return m;
+}
+#endif
+
+/** Select the best classifier for this machine.  */
+static BlockMasks (*Get_Block_Classifier(void))(const char *)
+{
+#ifdef SCANNER_X86
+  /* This runs from a static initializer, possibly before the one of
+     libgcc which fills the CPU features.  */
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return Classify_Block_AVX2;
+  }
+#endif
+#if defined(SCANNER_X86) && defined(__SSE2__)
+  return Classify_Block_SSE2;
+#else
+  return nullptr;
+#endif
+}
+
+static BlockMasks (*const Classify_Block)(const char *) = Get_Block_Classifier();
+
+BlockMasks SourceScanner::Classify(void)
+{
+  size_t remaining = std::min(Text.size() - Pos, BLOCK_SIZE);
+
+  if (Classify_Block && remaining >= BLOCK_SIZE) {
+    return Classify_Block(Text.data() + Pos);
+  }
+
+  return Classify_Scalar(Text.data() + Pos, remaining);
+}
+
+bool SourceScanner::Skip_To(uint32_t BlockMasks::*a, uint32_t BlockMasks::*b)
+{
+  while (Pos < Text.size()) {
+    BlockMasks m = Classify();
+    uint32_t bits = m.*a | m.*b;
+    if (bits) {
+      Pos += __builtin_ctz(bits);
+      return true;
+    }
+
+    Pos += BLOCK_SIZE;
+  }
+
+  Pos = Text.size();
+  return false;
+}
+
+void SourceScanner::Skip_Identifier(void)
+{
+  while (Pos < Text.size()) {
+    /* Bytes past the end are not identifiers, so this always stops at the
+       end of the text.  */
+    uint32_t non_ident = ~Classify().Ident;
+    if (non_ident) {
+      Pos += __builtin_ctz(non_ident);
+      return;
+    }
+
+    Pos += BLOCK_SIZE;
+  }
+
+  Pos = Text.size();
+}
+
+void SourceScanner::Skip_Literal_Or_Comment(void)
+{
+  char c = Text[Pos++];
+
+  if (c == '/') {
+    if (Pos < Text.size() && Text[Pos] == '/') {
+      /* Line comment.  */
+      size_t end = Text.find('\n', Pos);
+      Pos = (end == std::string_view::npos) ? Text.size() : end;
+    } else if (Pos < Text.size() && Text[Pos] == '*') {
+      /* Block comment.  */
+      size_t end = Text.find("*/", Pos + 1);
+      Pos = (end == std::string_view::npos) ? Text.size() : end + 2;
+    }
+
+    /* Else it is just a division.  */
+    return;
+  }
+
+  /* A string or char literal.  */
+  char quote = c;
+  while (Pos < Text.size()) {
+    c = Text[Pos];
+    if (c == '\\') {
+      Pos += 2;
+    } else if (c == quote) {
+      Pos++;
+      return;
+    } else if (c == '\n') {
+      /* Unterminated literal.  Do not let it eat the rest of the text.  */
+      return;
+    } else {
+      Pos++;
+    }
+  }
+
+  Pos = Text.size();
+}
+
+bool SourceScanner::Next_Identifier(std::string_view &id, size_t &offset)
+{
+  while (Skip_To(&BlockMasks::Ident, &BlockMasks::Skip)) {
+    if (!Is_Ident_Char(Text[Pos])) {
+      Skip_Literal_Or_Comment();
+      continue;
+    }
+
+    size_t start = Pos;
+    Skip_Identifier();
+
+    id = Text.substr(start, Pos - start);
+    offset = start;
+    return true;
+  }
+
+  return false;
+}
+
+bool SourceScanner::Next_Directive(std::string_view &name, size_t &offset)
+{
+  while (Skip_To(&BlockMasks::Hash, &BlockMasks::Skip)) {
+    if (Text[Pos] != '#') {
+      Skip_Literal_Or_Comment();
+      continue;
+    }
+
+    size_t hash = Pos++;
+
+    /* The `##` operator is not a directive, whatever comes before it.  Skip
+       both '#' so that the second one is not taken as a directive either.  */
+    if (Pos < Text.size() && Text[Pos] == '#') {
+      Pos++;
+      continue;
+    }
+
+    /* A '#' glued to an identifier is not a directive.  */
+    if (hash > 0 && Is_Ident_Char(Text[hash - 1])) {
+      continue;
+    }
+
+    /* There is the silly case in which #ifdef is written as `#  ifdef`.  */
+    while (Pos < Text.size() && (Text[Pos] == ' ' || Text[Pos] == '\t')) {
+      Pos++;
+    }
+
+    size_t start = Pos;
+    Skip_Identifier();
+    if (Pos == start) {
+      /* Not a directive.  */
+      continue;
+    }
+
+    name = Text.substr(start, Pos - start);
+    offset = hash;
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,91 @@
+//===- SourceScanner.hh - Scan source text for identifiers and directives *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Scan source text for identifiers and preprocessor directives.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <string_view>
+#include <stdint.h>
+#include <stddef.h>
+
+/** @brief Scanner of identifiers and preprocessor directives in source text.
+ *
+ * Works directly on the text given to it, without copying or modifying it,
+ * so it can be used on very large macro expansions or function bodies.  The
+ * text is classified in blocks of 32 bytes using SSE2 or AVX2 when available,
+ * else it falls back to a scalar classifier.  String and char literals, as
+ * well as comments, are skipped.
+ *
+ * Example:
+ *
+ *   SourceScanner scanner(text);
+ *   std::string_view id;
+ *   size_t offset;
+ *   while (scanner.Next_Identifier(id, offset)) {
+ *     ...
+ *   }
+ */
+class SourceScanner
+{
+  public:
+  SourceScanner(std::string_view text)
+    : Text(text),
+      Pos(0)
+  {
+  }
+
+  /** Find the next identifier.  Its offset in the text is stored in `offset`.
+      Returns false when there are no more identifiers.  */
+  bool Next_Identifier(std::string_view &id, size_t &offset);
+
+  /** Find the next preprocessor directive and store its name in `name`, e.g.
+      `ifdef` for `#  ifdef X`, and the offset of the `#` in `offset`.  Returns
+      false when there are no more directives.  */
+  bool Next_Directive(std::string_view &name, size_t &offset);
+
+  /** Masks of a block of text, one bit per byte.  */
+  struct BlockMasks
+  {
+    /* Bytes that can be part of an identifier: [A-Za-z0-9_$] and non-ASCII.  */
+    uint32_t Ident;
+
+    /* Bytes that may start a string or char literal, or a comment.  */
+    uint32_t Skip;
+
+    /* '#' bytes.  */
+    uint32_t Hash;
+  };
+
+  /** Size of the block classified at once.  */
+  static constexpr size_t BLOCK_SIZE = 32;
+
+  private:
+  /** Classify the block starting at Pos.  Bytes past the end of the text are
+      classified as nothing.  */
+  BlockMasks Classify(void);
+
+  /** Advance Pos to the next byte that is in the class `a` or in the class
+      `b`.  Returns false if the end was reached.  */
+  bool Skip_To(uint32_t BlockMasks::*a, uint32_t BlockMasks::*b);
+
+  /** Advance Pos to the end of the identifier starting at Pos.  */
+  void Skip_Identifier(void);
+
+  /** Advance Pos past the literal or comment starting at Pos.  */
+  void Skip_Literal_Or_Comment(void);
+
+  /** Text being scanned.  */
+  std::string_view Text;
+
+  /** Current position in Text.  */
+  size_t Pos;
+};
@@ -0,0 +1,127 @@
+//===- StringTable.cpp - Intern strings into an arena ----------*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Intern strings into an arena, giving each distinct string an integer id.
+//
+//===----------------------------------------------------------------------===//
+
+#include "StringTable.hh"
+
+#include <string.h>
+
+/* Size of each arena block.  Strings larger than that get their own block.  */
+static const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+
+StringTable::StringTable(void)
+  : Blocks(),
+    BlockUsed(0),
+    BlockSize(0),
+    Strings(),
+    Hashes(),
+    Slots(64, INVALID)
+{
+}
+
+uint64_t StringTable::Hash(std::string_view str)
+{
+  /* FNV-1a.  Symbol names are short, so this is as fast as anything else
+     and, unlike std::hash, it is stable across implementations.  */
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : str) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+size_t StringTable::Find_Slot(std::string_view str, uint64_t hash) const
+{
+  size_t mask = Slots.size() - 1;
+  size_t slot = hash & mask;
+
+  while (true) {
+    uint32_t id = Slots[slot];
+    if (id == INVALID || (Hashes[id] == hash && Strings[id] == str)) {
+      return slot;
+    }
+    slot = (slot + 1) & mask;
+  }
+}
+
+uint32_t StringTable::Find(std::string_view str) const
+{
+  return Slots[Find_Slot(str, Hash(str))];
+}
+
+uint32_t StringTable::Intern(std::string_view str)
+{
+  uint64_t hash = Hash(str);
+  size_t slot = Find_Slot(str, hash);
+
+  if (Slots[slot] != INVALID) {
+    return Slots[slot];
+  }
+
+  uint32_t id = Strings.size();
+  Strings.push_back(std::string_view(Store(str), str.size()));
+  Hashes.push_back(hash);
+  Slots[slot] = id;
+
+  /* Keep the load factor below 1/2 so probing sequences stay short.  */
+  if (Strings.size() * 2 > Slots.size()) {
+    Grow();
+  }
+
+  return id;
+}
+
+void StringTable::Grow(void)
+{
+  std::vector<uint32_t> slots(Slots.size() * 2, INVALID);
+  size_t mask = slots.size() - 1;
+
+  for (uint32_t id = 0; id < Strings.size(); id++) {
+    size_t slot = Hashes[id] & mask;
+    while (slots[slot] != INVALID) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = id;
+  }
+
+  Slots = std::move(slots);
+}
+
+const char *StringTable::Store(std::string_view str)
+{
+  size_t size = str.size() + 1;
+
+  if (size > ARENA_BLOCK_SIZE) {
+    /* Too large.  Give it a block of its own and keep using the current
+       one, which is always the last.  */
+    Blocks.insert(Blocks.begin(), std::make_unique<char[]>(size));
+    char *dest = Blocks.front().get();
+    str.copy(dest, str.size());
+    dest[str.size()] = '\0';
+    return dest;
+  }
+
+  if (BlockUsed + size > BlockSize) {
+    Blocks.push_back(std::make_unique<char[]>(ARENA_BLOCK_SIZE));
+    BlockUsed = 0;
+    BlockSize = ARENA_BLOCK_SIZE;
+  }
+
+  char *dest = Blocks.back().get() + BlockUsed;
+  str.copy(dest, str.size());
+  dest[str.size()] = '\0';
+  BlockUsed += size;
+
+  return dest;
+}
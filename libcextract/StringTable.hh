@@ -0,0 +1,85 @@
+//===- StringTable.hh - Intern strings into an arena -----------*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Intern strings into an arena, giving each distinct string an integer id.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+
+/** @brief Table of interned strings.
+ *
+ * Each distinct string is copied once into large memory blocks and gets an
+ * id, which is the order in which it was first interned.  Strings are looked
+ * up on an open addressing hash table of ids, so interning a string that is
+ * already in the table allocates nothing.  Stored strings are NUL terminated
+ * and never move, so the views returned by Get can be used as C strings for
+ * as long as the table lives.
+ */
+class StringTable
+{
+  public:
+  StringTable(void);
+
+  StringTable(StringTable &&) = default;
+  StringTable &operator=(StringTable &&) = default;
+
+  /** Get the id of `str`, adding it to the table if it is not there.  */
+  uint32_t Intern(std::string_view str);
+
+  /** Get the id of `str`, or INVALID if it is not in the table.  */
+  uint32_t Find(std::string_view str) const;
+
+  /** Get the string with id `id`.  */
+  inline std::string_view Get(uint32_t id) const
+  {
+    return Strings[id];
+  }
+
+  /** Number of strings in the table.  */
+  inline uint32_t Size(void) const
+  {
+    return Strings.size();
+  }
+
+  /** Hash function used by the table.  */
+  static uint64_t Hash(std::string_view str);
+
+  static constexpr uint32_t INVALID = UINT32_MAX;
+
+  private:
+  /** Copy `str` into the arena, NUL terminated.  */
+  const char *Store(std::string_view str);
+
+  /** Double the number of slots.  */
+  void Grow(void);
+
+  /** Find the slot of `str`, which is either empty or has its id.  */
+  size_t Find_Slot(std::string_view str, uint64_t hash) const;
+
+  /** Memory blocks where the strings are stored.  */
+  std::vector<std::unique_ptr<char[]>> Blocks;
+
+  /** How much of the last block is used, and its size.  */
+  size_t BlockUsed;
+  size_t BlockSize;
+
+  /** The interned strings and their hashes, indexed by id.  */
+  std::vector<std::string_view> Strings;
+  std::vector<uint64_t> Hashes;
+
+  /** Hash table of ids.  Its size is always a power of two.  */
+  std::vector<uint32_t> Slots;
+};
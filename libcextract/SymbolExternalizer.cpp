@@ -18,14 +18,14 @@
 #include "Error.hh"
 #include "ClangCompat.hh"
 #include "LLVMMisc.hh"
-#include "IntervalTree.hh"
 #include "Closure.hh"
+#include "SourceScanner.hh"
+#include "CachingFileSystem.hh"
 
 #include <unordered_set>
+#include <map>
 #include <iostream>
 
-#include "clang/Rewrite/Core/Rewriter.h"
-
 /* Ban symbols that we are sure to cause problems.  */
 
 /* Although SourceManager has "translateFile" method, it seems unreliable
@@ -34,10 +34,6 @@
    FileEntry => FileID that we are sure to have modifications.  */
 #pragma GCC poison translateFile
 
-/* Tokenize away the function-like macro stuff or expression, we only want
-   the identifier.  */
-#define TOKEN_VECTOR " ().,;+-*/^|&{}[]<>^&|!\r\n\t"
-
 /* Return the ranges for all identifiers on the ids vector */
 template <typename T>
 static std::vector<std::pair<std::string, SourceRange>>
@@ -46,30 +42,20 @@ Get_Range_Of_Identifier(const SourceRange &range, const T &ids)
   std::vector< std::pair < std::string, SourceRange> > ret = {};
   StringRef string = PrettyPrint::Get_Source_Text(range);
 
-  /* Create temporary buff, strtok modifies it.  */
-  unsigned len = string.size();
-  char buf[len + 1];
-  memcpy(buf, string.data(), len);
-  buf[len] = '\0';
+  SourceScanner scanner(string);
+  std::string_view tok;
+  size_t offset;
 
-  char *tok = strtok(buf, TOKEN_VECTOR);
-  while (tok != nullptr) {
+  while (scanner.Next_Identifier(tok, offset)) {
     if (ids.find(StringRef(tok)) != ids.end()) {
-      /* Found.  */
-      ptrdiff_t distance = (ptrdiff_t)(tok - buf);
-      assert(distance >= 0);
-
-      /* Compute the distance from the original SourceRange of the
+      /* Found.  Compute the distance from the original SourceRange of the
          MacroExpansion.  */
-      int32_t offset = (int32_t) distance;
-      SourceLocation start = range.getBegin().getLocWithOffset(offset);
-      SourceLocation end = start.getLocWithOffset(strlen(tok)-1);
+      SourceLocation start = range.getBegin().getLocWithOffset((int32_t) offset);
+      SourceLocation end = start.getLocWithOffset(tok.size()-1);
 
       /* Add to the list of output.  */
       ret.push_back(std::make_pair(std::string(tok), SourceRange(start, end)));
     }
-
-    tok = strtok(nullptr, TOKEN_VECTOR);
   }
 
   return ret;
@@ -88,9 +74,6 @@ Get_Range_Of_Identifier(const SourceRange &range, const StringRef &id)
 using namespace clang;
 using namespace llvm;
 
-/* IntervalTree.  */
-using namespace Intervals;
-
 static SourceRange Get_Range_For_Rewriter(const ASTUnit *ast, const SourceRange &range)
 {
   const SourceManager &sm = ast->getSourceManager();
@@ -137,7 +120,7 @@ class ExternalizerVisitor: public RecursiveASTVisitor<ExternalizerVisitor>
      * interested in the symbols that are present in the hash. If the symbol
      * found is not in the hash, just continue to the next symbol.
      */
-    SymbolUpdateStatus *sym = SE.getSymbolsUpdateStatus(decl->getName());
+    SymbolUpdateStatus *sym = SE.getSymbolsUpdateStatus(decl->getIdentifier());
     if (sym == nullptr)
       return VISITOR_CONTINUE;
 
@@ -223,8 +206,7 @@ class ExternalizerVisitor: public RecursiveASTVisitor<ExternalizerVisitor>
 
     ValueDecl *decl = expr->getDecl();
 
-    const StringRef &sym_name = decl->getName();
-    SymbolUpdateStatus *sym = SE.getSymbolsUpdateStatus(sym_name);
+    SymbolUpdateStatus *sym = SE.getSymbolsUpdateStatus(decl->getIdentifier());
 
     /*
      * Only execute the code in the visitor if we have already externalized the
@@ -233,6 +215,8 @@ class ExternalizerVisitor: public RecursiveASTVisitor<ExternalizerVisitor>
     if (sym == nullptr)
       return VISITOR_CONTINUE;
 
+    const StringRef &sym_name = decl->getName();
+
     /* Get the first effective use, which means an DeclRefExpr of a decl that
        will not be removed by the Closure.  */
     if (sym->FirstUse == nullptr) {
@@ -240,7 +224,8 @@ class ExternalizerVisitor: public RecursiveASTVisitor<ExternalizerVisitor>
       ASTUnit *ast = SE.AST;
       SourceManager &sm = ast->getSourceManager();
       SourceLocation loc = sm.getExpansionLoc(expr->getLocation());
-      Decl *topdecl = Get_Toplevel_Decl_At_Location(ast, loc);
+      Decl *topdecl = SE.ClosureVisitor.Get_Toplevel_Decl_Index()
+                                       .Get_Decl_At_Location(loc);
 
       /* If the declaration is reachable from the functions we want to extract,
          then we mark it as FirstUse.  */
@@ -329,7 +314,11 @@ TextModifications::Delta::Delta(const SourceRange &to_change,
                                 const std::string &new_text, int prio)
       : ToChange(to_change),
         NewText(new_text),
-        Priority(prio)
+        Priority(prio),
+        Order(0),
+        File(),
+        Begin(0),
+        End(0)
 {
   static int curr_id = 0;
   ID = curr_id++;
@@ -341,21 +330,43 @@ void TextModifications::Sort(void)
     return a.Priority > b.Priority;
   };
 
-  /* Sort by descending priority (larger comes first).  */
-  std::sort(DeltaList.begin(), DeltaList.end(), comparator);
+  /* Sort by descending priority (larger comes first).  Keep the order in
+     which deltas were issued for the same priority.  */
+  std::stable_sort(DeltaList.begin(), DeltaList.end(), comparator);
 }
 
 void TextModifications::Insert(Delta &delta)
 {
+  /* Key the delta by its file and offsets.  The length is computed the same
+     way clang's Rewriter would do for the char range.  */
+  SourceLocation begin = delta.ToChange.getBegin();
+  assert(begin.isFileID() && "Delta must begin in a file");
+
+  std::pair<FileID, unsigned> decomposed = SM.getDecomposedLoc(begin);
+  StringRef source_text = Lexer::getSourceText(CharSourceRange::getCharRange(
+                                               delta.ToChange),
+                                               SM, LO);
+  delta.File = decomposed.first;
+  delta.Begin = decomposed.second;
+  delta.End = decomposed.second + source_text.size();
+
   /* Insert into the vector.  */
   DeltaList.push_back(delta);
 }
 
+void TextModifications::Insert_Text(const SourceLocation &loc, StringRef text)
+{
+  std::pair<FileID, unsigned> decomposed = SM.getDecomposedLoc(loc);
+
+  Insert_Into_FileEntryMap(loc);
+  InsertionList.push_back({decomposed.first, decomposed.second, text.str()});
+}
+
 void TextModifications::Solve(void)
 {
-  /* Interval Tree to compute intersections of changes.  We can't have
-     intersections so if we find those we try to solve them.  */
-  IntervalTree<SourceLocation, const Delta&> interval_tree;
+  /* Accepted intervals of each file, mapping its begin to its end offset.
+     We can't have intersections so if we find those we try to solve them.  */
+  std::unordered_map<unsigned, std::map<unsigned, const Delta *>> accepted;
   std::vector<Delta> new_arr;
 
   /* Sort so that the highest priorities comes first.  */
@@ -369,14 +380,25 @@ void TextModifications::Solve(void)
      remove the one with smaller priority (the one that is later on the
      vector because we sorted it).
 
-     Use an Interval Tree to reduce the complexity from O(n(n-1)/2) to
-     O(n log n).  */
+     Accepted intervals never intersect, so the only candidate to intersect
+     with `a` is the accepted interval with the largest begin that is not
+     after the end of `a`.  */
   for (int i = 0; i < n; i++) {
     const Delta &a = DeltaList[i];
-    auto overlap = interval_tree.findOverlappingIntervals(a.ToChange);
-    /* Check if we already have this range in the tree.  */
-    if (overlap.size() > 0) {
-      const Delta &b = overlap[0].value;
+    std::map<unsigned, const Delta *> &file_map =
+        accepted[a.File.getHashValue()];
+
+    const Delta *overlap = nullptr;
+    auto it = file_map.upper_bound(a.End);
+    if (it != file_map.begin()) {
+      const Delta *b = std::prev(it)->second;
+      if (b->End >= a.Begin) {
+        overlap = b;
+      }
+    }
+
+    if (overlap) {
+      const Delta &b = *overlap;
 
       if (a.Priority <= b.Priority || a == b) {
         // Ignore.
@@ -390,11 +412,25 @@ void TextModifications::Solve(void)
         throw std::runtime_error("SymbolExternalizer can not continue.");
       }
     } else {
-      interval_tree.insert(Interval<SourceLocation, const Delta&>(a.ToChange, a));
+      file_map[a.Begin] = &a;
       new_arr.push_back(a);
+      new_arr.back().Order = new_arr.size() - 1;
     }
   }
-  DeltaList = new_arr;
+
+  /* Now sort the surviving deltas by their position in the files.  */
+  auto by_offset = [](const Delta &a, const Delta &b) {
+    return std::make_pair(a.File, a.Begin) < std::make_pair(b.File, b.Begin);
+  };
+  std::sort(new_arr.begin(), new_arr.end(), by_offset);
+  DeltaList = std::move(new_arr);
+
+  /* Insertions in the same location must be kept in the order they were
+     issued.  */
+  auto ins_by_offset = [](const Insertion &a, const Insertion &b) {
+    return std::make_pair(a.File, a.Offset) < std::make_pair(b.File, b.Offset);
+  };
+  std::stable_sort(InsertionList.begin(), InsertionList.end(), ins_by_offset);
 }
 
 bool TextModifications::Insert_Into_FileEntryMap(const SourceLocation &loc)
@@ -455,26 +491,174 @@ void TextModifications::Commit(void)
   int n = DeltaList.size();
 
   for (int i = 0; i < n; i++) {
-    // Commit Change.
     Delta &a = DeltaList[i];
 
     /* Try to insert into the FileEntryMap for commiting the change to the buffer
        later.  */
     Insert_Into_FileEntryMap(a.ToChange);
+  }
+
+  if (DumpingEnabled) {
+    /* Dump the files after each change, in the order of priority they were
+       accepted.  */
+    std::vector<const Delta *> by_order(n);
+    for (int i = 0; i < n; i++) {
+      by_order[DeltaList[i].Order] = &DeltaList[i];
+    }
+
+    for (int i = 0; i < n; i++) {
+      Dump(i, *by_order[i]);
+    }
+  }
+}
+
+bool TextModifications::Is_Modified(FileID id)
+{
+  auto delta_cmp = [](const Delta &a, FileID id) { return a.File < id; };
+  auto ins_cmp = [](const Insertion &a, FileID id) { return a.File < id; };
+
+  auto d = std::lower_bound(DeltaList.begin(), DeltaList.end(), id, delta_cmp);
+  auto i = std::lower_bound(InsertionList.begin(), InsertionList.end(), id, ins_cmp);
+
+  return (d != DeltaList.end() && d->File == id) ||
+         (i != InsertionList.end() && i->File == id);
+}
+
+bool TextModifications::Is_Modified(const CharSourceRange &range)
+{
+  std::string text;
+  return Get_Modified_Text(range, text);
+}
+
+void TextModifications::Get_Pieces(FileID id, std::vector<StringRef> &pieces,
+                                   unsigned max_order)
+{
+  Get_Pieces(id, 0, SM.getBufferData(id).size(), pieces, max_order);
+}
+
+bool TextModifications::Get_Pieces(FileID id, unsigned begin, unsigned end,
+                                   std::vector<StringRef> &pieces,
+                                   unsigned max_order)
+{
+  StringRef buffer = SM.getBufferData(id);
+
+  auto delta_cmp = [](const Delta &a, std::pair<FileID, unsigned> key) {
+    return std::make_pair(a.File, a.Begin) < key;
+  };
+  auto ins_cmp = [](const Insertion &a, std::pair<FileID, unsigned> key) {
+    return std::make_pair(a.File, a.Offset) < key;
+  };
 
-    /* Get the text we want to change.  We only do this to know its length.  */
-    StringRef source_text = Lexer::getSourceText(CharSourceRange::getCharRange(
-                                                 a.ToChange),
-                                                 SM, LO);
-    unsigned len = source_text.size();
+  auto d = std::lower_bound(DeltaList.begin(), DeltaList.end(),
+                            std::make_pair(id, begin), delta_cmp);
+  auto i = std::lower_bound(InsertionList.begin(), InsertionList.end(),
+                            std::make_pair(id, begin), ins_cmp);
 
-    /* ReplaceText(SourceRange, StringRef) version is unreliable in llvm-16.  */
-    assert(RW.ReplaceText(a.ToChange.getBegin(), len, a.NewText) == false);
+  unsigned pos = begin;
 
-    if (DumpingEnabled) {
-      Dump(i, a);
+  /* A delta which begins before the range but ends inside of it was already
+     output with what comes before the range.  Skip the text it replaces.  */
+  if (d != DeltaList.begin() && std::prev(d)->File == id
+      && std::prev(d)->End > begin && std::prev(d)->Order < max_order) {
+    pos = std::min(std::prev(d)->End, end);
+  }
+
+  /* Modifications at `end` belong to what comes after the range, except at
+     the end of the file.  */
+  bool to_eof = end >= buffer.size();
+  bool modified = pos != begin;
+
+  /* Sweep both lists in offset order.  On the same offset, insertions come
+     before replacements, as in clang's Rewriter.  */
+  while (true) {
+    bool have_delta = d != DeltaList.end() && d->File == id
+                      && (d->Begin < end || (to_eof && d->Begin == end));
+    bool have_ins = i != InsertionList.end() && i->File == id
+                    && (i->Offset < end || (to_eof && i->Offset == end));
+
+    if (!have_delta && !have_ins) {
+      break;
     }
+
+    if (have_ins && (!have_delta || i->Offset <= d->Begin)) {
+      /* An insertion inside a removed range goes where the removed range
+         was.  */
+      if (i->Offset > pos) {
+        pieces.push_back(buffer.slice(pos, i->Offset));
+        pos = i->Offset;
+      }
+      pieces.push_back(i->Text);
+      modified = true;
+      ++i;
+    } else {
+      if (d->Order < max_order) {
+        if (d->Begin > pos) {
+          pieces.push_back(buffer.slice(pos, d->Begin));
+        }
+        pieces.push_back(d->NewText);
+        pos = std::max(pos, d->End);
+        modified = true;
+      }
+      ++d;
+    }
+  }
+
+  if (pos < end) {
+    pieces.push_back(buffer.slice(pos, end));
+  }
+
+  return modified;
+}
+
+bool TextModifications::Get_Modified_Text(const CharSourceRange &range,
+                                          std::string &text)
+{
+  CharSourceRange file_range = Lexer::makeFileCharRange(range, SM, LO);
+  if (file_range.isInvalid()) {
+    return false;
+  }
+
+  std::pair<FileID, unsigned> begin = SM.getDecomposedLoc(file_range.getBegin());
+  std::pair<FileID, unsigned> end = SM.getDecomposedLoc(file_range.getEnd());
+  if (begin.first != end.first || begin.second > end.second) {
+    return false;
+  }
+
+  std::vector<StringRef> pieces;
+  if (!Get_Pieces(begin.first, begin.second, end.second, pieces)) {
+    return false;
+  }
+
+  text.clear();
+  for (StringRef piece : pieces) {
+    text += piece;
   }
+
+  return true;
+}
+
+std::unique_ptr<MemoryBuffer> TextModifications::Get_Modified_Buffer(FileID id,
+                                                                     StringRef name)
+{
+  std::vector<StringRef> pieces;
+  Get_Pieces(id, pieces);
+
+  size_t size = 0;
+  for (StringRef piece : pieces) {
+    size += piece.size();
+  }
+
+  /* Copy every piece straight to its place in the final buffer.  */
+  std::unique_ptr<WritableMemoryBuffer> buf =
+    WritableMemoryBuffer::getNewUninitMemBuffer(size, name);
+  char *dest = buf->getBufferStart();
+
+  for (StringRef piece : pieces) {
+    memcpy(dest, piece.data(), piece.size());
+    dest += piece.size();
+  }
+
+  return buf;
 }
 
 void TextModifications::Dump(unsigned num, const Delta &a)
@@ -497,18 +681,15 @@ void TextModifications::Dump(unsigned num, const Delta &a)
     */
     FileID id = it->second.first;
 
-    /* Our updated file buffer.  */
-    const RewriteBuffer *rewritebuf = RW.getRewriteBufferFor(id);
-
-    /* If we have modifications, then dump the buffer.  */
-    if (rewritebuf) {
-      /* The RewriteBuffer object contains a sequence of deltas of the original
-         buffer.  Clearly a faster way would be apply those deltas into the
-         target buffer directly, but clang doesn't seems to provide such
-         interface, so we expand them into a temporary string and them pass
-         it to the SourceManager.  */
-      std::string modified_str = std::string(rewritebuf->begin(), rewritebuf->end());
-      fputs(modified_str.c_str(), file);
+    /* If we have modifications, then dump the buffer with every change up to
+       this one.  */
+    if (Is_Modified(id)) {
+      std::vector<StringRef> pieces;
+      Get_Pieces(id, pieces, num + 1);
+
+      for (StringRef piece : pieces) {
+        fwrite(piece.data(), 1, piece.size(), file);
+      }
       fputs("\n\n/* --------- */\n\n", file);
     }
   }
@@ -516,46 +697,6 @@ void TextModifications::Dump(unsigned num, const Delta &a)
   fclose(file);
 }
 
-bool TextModifications::Is_Before_Or_Equal(const PresumedLoc &a, const PresumedLoc &b)
-{
-  unsigned a_line = a.getLine();
-  unsigned a_col  = a.getColumn();
-  unsigned b_line = b.getLine();
-  unsigned b_col  = b.getColumn();
-
-  unsigned m = std::max(a_col, b_col);
-  unsigned psi_a = m*a_line + a_col;
-  unsigned psi_b = m*b_line + b_col;
-
-  return psi_a <= psi_b;
-}
-
-bool TextModifications::Intersects(const SourceRange &a, const SourceRange &b)
-{
-  PresumedLoc a_begin = SM.getPresumedLoc(a.getBegin());
-  PresumedLoc a_end   = SM.getPresumedLoc(a.getEnd());
-  PresumedLoc b_begin = SM.getPresumedLoc(b.getBegin());
-  PresumedLoc b_end   = SM.getPresumedLoc(b.getEnd());
-
-  assert(a_begin.getFileID() == a_end.getFileID());
-  assert(b_begin.getFileID() == b_end.getFileID());
-
-  if (a_begin.getFileID() != b_begin.getFileID()) {
-    /* Files are distinct, thus we can't easily determine which comes first.  */
-    return false;
-  }
-
-  assert(a_begin.getLine() <= a_end.getLine());
-  assert(b_begin.getLine() <= b_end.getLine());
-
-  return Is_Before_Or_Equal(a_begin, b_end) && Is_Before_Or_Equal(b_begin, a_end);
-}
-
-bool TextModifications::Intersects(const Delta &a, const Delta &b)
-{
-  return Intersects(a.ToChange, b.ToChange);
-}
-
 /* ---- End of Deltas class -------- */
 
 void SymbolExternalizer::Replace_Text(const SourceRange &range, StringRef new_name, int prio)
@@ -578,8 +719,7 @@ void SymbolExternalizer::Insert_Text(const SourceLocation &loc, StringRef text)
     floc = AST->getSourceManager().getExpansionLoc(loc);
   }
 
-  TM.Insert_Into_FileEntryMap(floc);
-  TM.Get_Rewriter().InsertText(floc, text);
+  TM.Insert_Text(floc, text);
 }
 
 VarDecl *SymbolExternalizer::Create_Externalized_Var(DeclaratorDecl *decl, const std::string &name)
@@ -678,7 +818,7 @@ bool SymbolExternalizer::Commit_Changes_To_Source(
   bool main_file_inserted = false;
 
   auto new_ofs = IntrusiveRefCntPtr<vfs::OverlayFileSystem>(
-                       new vfs::OverlayFileSystem(vfs::getRealFileSystem()));
+                       new vfs::OverlayFileSystem(CachingFileSystem::Get_Instance()));
 
   auto new_mfs = IntrusiveRefCntPtr<vfs::InMemoryFileSystem>(
                         new vfs::InMemoryFileSystem);
@@ -688,7 +828,6 @@ bool SymbolExternalizer::Commit_Changes_To_Source(
   /* Commit the text changes.  */
   TM.Commit();
 
-  Rewriter &RW = TM.Get_Rewriter();
   auto FileEntryMap = TM.Get_FileEntry_Map();
 
   /* Iterate into all files we may have opened, most probably headers that are
@@ -703,19 +842,10 @@ bool SymbolExternalizer::Commit_Changes_To_Source(
     FileID id = it->second.first;
     StringRef filename = it->second.second;
 
-    const RewriteBuffer *rewritebuf = RW.getRewriteBufferFor(id);
-
     /* If we have modifications, then update the buffer.  */
-    if (rewritebuf) {
-      /* The RewriteBuffer object contains a sequence of deltas of the original
-         buffer.  Clearly a faster way would be apply those deltas into the
-         target buffer directly, but clang doesn't seems to provide such
-         interface, so we expand them into a temporary string and them pass
-         it to the SourceManager.  */
-      std::string modified_str = std::string(rewritebuf->begin(), rewritebuf->end());
-
+    if (TM.Is_Modified(id)) {
       if (new_mfs->addFile(filename,
-                       0, MemoryBuffer::getMemBufferCopy(modified_str)) == false) {
+                       0, TM.Get_Modified_Buffer(id, filename)) == false) {
         llvm::outs() << "Unable to add " << filename << " into InMemoryFS.\n";
       }
 
@@ -751,10 +881,9 @@ bool SymbolExternalizer::Commit_Changes_To_Source(
       OptionalFileEntryRef fentry_ref = sm.getFileEntryRefForID(id);
       StringRef filename = fentry_ref->getName();
 
-      const std::string &main_file_content = Get_Modifications_To_Main_File();
       if (new_mfs->addFile(filename,
                        0,
-                       MemoryBuffer::getMemBufferCopy(main_file_content)) == false) {
+                       TM.Get_Modified_Buffer(id, filename)) == false) {
         llvm::outs() << "Unable to add " << filename << " into InMemoryFS.\n";
       }
   }
@@ -772,10 +901,10 @@ std::string SymbolExternalizer::Get_Modifications_To_Main_File(void)
 
   /* Our updated file buffer for main file.  */
   FileID main_id = sm.getMainFileID();
-  Rewriter &RW = TM.Get_Rewriter();
-  RewriteBuffer &main_buf = RW.getEditBuffer(main_id);
+  std::unique_ptr<MemoryBuffer> main_buf =
+    TM.Get_Modified_Buffer(main_id, "");
 
-  return std::string(main_buf.begin(), main_buf.end());
+  return main_buf->getBuffer().str();
 }
 
 /** Given a MacroExpansion object, we try to get the location of where the token
@@ -808,7 +937,7 @@ void SymbolExternalizer::Rewrite_Macros(void)
         MacroInfo *maybe_macro = MW.Get_Macro_Info(id_info, def->getLocation());
 
         if (!maybe_macro && !MacroWalker::Is_Identifier_Macro_Argument(info, id_info)) {
-          SymbolUpdateStatus *sym = getSymbolsUpdateStatus(id_info->getName());
+          SymbolUpdateStatus *sym = getSymbolsUpdateStatus(id_info);
           if (sym && sym->Needs_Sym_Rename())
             Replace_Text(SourceRange(tok.getLocation(), tok.getLastLoc()), sym->getUseName(), 10);
         }
@@ -854,6 +983,43 @@ SymbolUpdateStatus *SymbolExternalizer::getSymbolsUpdateStatus(const StringRef &
   return &ret->second;
 }
 
+SymbolUpdateStatus *SymbolExternalizer::getSymbolsUpdateStatus(const IdentifierInfo *info)
+{
+  /* Decls with names that are not identifiers have no IdentifierInfo.  */
+  if (info == nullptr)
+    return nullptr;
+
+  auto ret = SymbolsByIdentifier.find(info);
+  if (ret == SymbolsByIdentifier.end())
+    return nullptr;
+
+  return ret->second;
+}
+
+std::unordered_set<Decl *> SymbolExternalizer::Index_Symbols_And_Get_Redecls(void)
+{
+  IdentifierTable &symtab = AST->getPreprocessor().getIdentifierTable();
+  std::unordered_set<Decl *> redecls;
+
+  for (auto it = SymbolsMap.begin(); it != SymbolsMap.end(); ++it) {
+    auto info = symtab.find(it->getKey());
+
+    /* If there is no such identifier then the symbol is not in the TU.  */
+    if (info == symtab.end())
+      continue;
+
+    SymbolsByIdentifier[info->getValue()] = &it->second;
+
+    for (NamedDecl *decl : Get_Decl_From_Symtab(AST, info->getValue())) {
+      for (Decl *redecl : decl->redecls()) {
+        redecls.insert(redecl);
+      }
+    }
+  }
+
+  return redecls;
+}
+
 void SymbolExternalizer::Dump_SymbolsMap(void)
 {
   SourceManager &sm = AST->getSourceManager();
@@ -896,7 +1062,8 @@ void SymbolExternalizer::Compute_SymbolsMap_Late_Insert_Locations(std::vector<Sy
 
     SourceLocation loc_1stuse = SM.getExpansionLoc(first_use->getLocation());
 
-    Decl *topdecl = Get_Toplevel_Decl_At_Location(AST, loc_1stuse);
+    Decl *topdecl = ClosureVisitor.Get_Toplevel_Decl_Index()
+                                  .Get_Decl_At_Location(loc_1stuse);
     assert(topdecl && "No Toplevel decl encapsulate given expr?");
 
     /* Check if the declaration have comments.  In this case we want to insert
@@ -1062,9 +1229,25 @@ void SymbolExternalizer::Externalize_Symbols(std::vector<std::string> const &to_
     to_externalize = RENAME_PREFIX + to_externalize;
   }
 
+  std::unordered_set<Decl *> redecls = Index_Symbols_And_Get_Redecls();
+
   /* Start traversing the AST to find all references to the symbols that we want
-   * to externalize or rename. */
-  ExternalizerVisitor(*this).TraverseDecl(AST->getASTContext().getTranslationUnitDecl());
+   * to externalize or rename.  Only the toplevel decls of the main file which
+   * are in the closure will be output, so there is no need to go through the
+   * other ones but the declarations of the symbols themselves.  Headers which
+   * are kept as #includes are parsed again in full, so everything in them is
+   * traversed.  Keep the TU order, as the first declaration found is the one
+   * that gets externalized.  */
+  ExternalizerVisitor visitor(*this);
+  ClosureSet &closure = ClosureVisitor.Get_Closure();
+  SourceManager &sm = AST->getSourceManager();
+  for (auto it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
+    Decl *decl = *it;
+    if (closure.Is_Decl_Marked(decl) || redecls.find(decl) != redecls.end()
+        || !sm.isInMainFile(sm.getExpansionLoc(decl->getBeginLoc()))) {
+      visitor.TraverseDecl(decl);
+    }
+  }
   Late_Externalize();
 
   /* Search for all macros and macro expansions and rewrite them using the new
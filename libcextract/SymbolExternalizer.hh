@@ -20,8 +20,10 @@
 #include "Closure.hh"
 
 #include <clang/Tooling/Tooling.h>
-#include <clang/Rewrite/Core/Rewriter.h>
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include <climits>
 
 using namespace clang;
 
@@ -141,7 +143,7 @@ struct SymbolUpdateStatus
   }
 };
 
-/** Text Modification class wrapping Clang's Rewriter.
+/** Text Modification engine.
  *
  *  Clang has a Rewriter class in order to issue Text Modifications into the
  *  same Compilation Unit.  The problem is that this class expects that every
@@ -155,8 +157,14 @@ struct SymbolUpdateStatus
  *  modifications wants to modify the same piece of text, we only let the one
  *  with highest priority.  With this, we classify the modifications which
  *  removes content to be the highest priority, and the ones which only changes
- *  the name of things to be the lowest priority.  Hence at some point we compute
- *  the insersection of all with all and discards the ones with lower priority.
+ *  the name of things to be the lowest priority.
+ *
+ *  Every modification is keyed by its FileID and the raw offsets on that
+ *  file, so solving them is sorting by priority and sweeping through the
+ *  accepted ones.  The accepted modifications are then sorted by offset and
+ *  the modified buffer is built in a single linear pass as a piece table of
+ *  the original buffer and the new texts, which is copied only once into the
+ *  final MemoryBuffer.
  */
 class TextModifications
 {
@@ -170,7 +178,11 @@ class TextModifications
       : ToChange(),
         NewText(),
         Priority(0),
-        ID(0)
+        ID(0),
+        Order(0),
+        File(),
+        Begin(0),
+        End(0)
     {
     }
 
@@ -201,29 +213,59 @@ class TextModifications
 
     /* ID.  */
     int ID;
+
+    /* Position of this delta when sorted by priority.  Set by Solve.  */
+    unsigned Order;
+
+    /* File and offsets [Begin, End) in the file of ToChange.  */
+    FileID File;
+    unsigned Begin;
+    unsigned End;
+  };
+
+  /** A text insertion.  Insertions are not subject to priorities and are
+      never discarded.  Many insertions in the same location are output in
+      the order they were issued.  */
+  struct Insertion
+  {
+    FileID File;
+    unsigned Offset;
+    std::string Text;
   };
 
   /** Constructor for the TextModification class.  */
   TextModifications(ASTUnit *ast, bool dump = false)
     : SM(ast->getSourceManager()),
       LO(ast->getLangOpts()),
-      RW(SM, LO),
       DumpingEnabled(dump)
   {}
 
-  /** Get underlying Rewriter class.  */
-  inline Rewriter &Get_Rewriter(void)
-  {
-    return RW;
-  }
-
   /* Insert a text modification.  */
   void Insert(Delta &delta);
 
-  /* Solve the modifications according to their priorities and apply to clang's
-     Rewriter class instance.  */
+  /* Insert text at location.  */
+  void Insert_Text(const SourceLocation &loc, StringRef text);
+
+  /* Solve the modifications according to their priorities and get them ready
+     for building the modified buffers.  */
   void Commit(void);
 
+  /* Check if the file was modified.  */
+  bool Is_Modified(FileID id);
+
+  /* Check if any modification touches `range`.  Must be called after
+     Commit.  */
+  bool Is_Modified(const CharSourceRange &range);
+
+  /* Build the buffer of file `id` with all modifications applied.  */
+  std::unique_ptr<llvm::MemoryBuffer> Get_Modified_Buffer(FileID id,
+                                                          StringRef name);
+
+  /* Get the text of `range` with all modifications applied.  Returns false
+     if no modification touches the range, in which case the original text
+     can be used as is.  Must be called after Commit.  */
+  bool Get_Modified_Text(const CharSourceRange &range, std::string &text);
+
   /* Get FileEntry map.  */
   typedef std::unordered_map<const FileEntry *, std::pair<FileID, StringRef>>
     FileEntryMapType;
@@ -249,14 +291,16 @@ class TextModifications
      priorities.  */
   void Sort(void);
 
-  /* Checks if two SourceRanges intersects.  */
-  bool Intersects(const SourceRange &a, const SourceRange &b);
+  /* Collect the pieces of the modified buffer of file `id`, considering only
+     the deltas which Order is smaller than `max_order`.  */
+  void Get_Pieces(FileID id, std::vector<StringRef> &pieces,
+                  unsigned max_order = UINT_MAX);
 
-  /* Check if two Deltas (text modifications) intersects.  */
-  bool Intersects(const Delta &a, const Delta &b);
-
-  /* Check which SourceLocation comes first.  */
-  bool Is_Before_Or_Equal(const PresumedLoc &a, const PresumedLoc &b);
+  /* Same as above, but only for the offsets [begin, end) of the file.
+     Returns true if any modification was found in it.  */
+  bool Get_Pieces(FileID id, unsigned begin, unsigned end,
+                  std::vector<StringRef> &pieces,
+                  unsigned max_order = UINT_MAX);
 
   /* Reference to the AST SourceManager.  */
   SourceManager &SM;
@@ -264,15 +308,17 @@ class TextModifications
   /* Reference to the AST LangOptions.  */
   const LangOptions &LO;
 
-  /* The clang's Rewriter class.  */
-  Rewriter RW;
-
   /* Flag indicating we want to dump our changes.  */
   bool DumpingEnabled;
 
-  /* The list of Text Modifications we want to do.  */
+  /* The list of Text Modifications we want to do.  After Commit, sorted by
+     FileID and offset.  */
   std::vector<Delta> DeltaList;
 
+  /* The list of Text Insertions we want to do.  After Commit, sorted by
+     FileID and offset.  */
+  std::vector<Insertion> InsertionList;
+
   /* Our own mapping from FileEntry to FileID to get the modifications to the
      files.  */
   FileEntryMapType FileEntryMap;
@@ -343,6 +389,7 @@ class SymbolExternalizer
   Get_Range_Of_Identifier_In_Macro_Expansion(const MacroExpansion *exp);
 
   SymbolUpdateStatus *getSymbolsUpdateStatus(const StringRef &sym);
+  SymbolUpdateStatus *getSymbolsUpdateStatus(const IdentifierInfo *info);
 
   bool Drop_Static(FunctionDecl *decl);
 
@@ -363,6 +410,14 @@ class SymbolExternalizer
 
   std::string Get_Modifications_To_Main_File(void);
 
+  /** Take the text modifications out of the externalizer so they can be
+      applied later when printing the AST, rather than reparsing it.  Must be
+      called after Commit_Changes_To_Source.  */
+  inline std::unique_ptr<TextModifications> Take_Text_Modifications(void)
+  {
+    return std::make_unique<TextModifications>(std::move(TM));
+  }
+
   inline std::vector<ExternalizerLogEntry> &Get_Log_Of_Changed_Names(void)
   {
     return Log;
@@ -395,6 +450,10 @@ class SymbolExternalizer
   /** Do the late externalize logic.  */
   void Late_Externalize(void);
 
+  /** Map the symbols in SymbolsMap to its IdentifierInfo and collect every
+      redeclaration of them in the TU.  */
+  std::unordered_set<Decl *> Index_Symbols_And_Get_Redecls(void);
+
   /** Rewrite the macros which tokens matches the symbols we want to externalize.  */
   void Rewrite_Macros(void);
 
@@ -419,7 +478,7 @@ class SymbolExternalizer
   /** MacroWalker object which helps iterating on Macros.  */
   MacroWalker MW;
 
-  /** Clang's Rewriter class used to auxiliate us with changes in the source code.  */
+  /** Text modification engine used to auxiliate us with changes in the source code.  */
   TextModifications TM;
 
   /** Reference to the InlineAnalysis in the PassManager::Context instance.  */
@@ -440,6 +499,10 @@ class SymbolExternalizer
   /** Symbols and its externalization type */
   llvm::StringMap<SymbolUpdateStatus> SymbolsMap;
 
+  /** Same as SymbolsMap, but indexed by the symbol IdentifierInfo so that
+      the AST visitor does not have to hash the symbol names.  */
+  llvm::DenseMap<const IdentifierInfo *, SymbolUpdateStatus *> SymbolsByIdentifier;
+
   /* ClosureVisitor to compute the closure.  */
   DeclClosureVisitor ClosureVisitor;
 
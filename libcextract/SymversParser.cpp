@@ -14,29 +14,37 @@
 /* Author: Marcos de Paulo Souza  */
 
 #include "SymversParser.hh"
+#include "NonLLVMMisc.hh"
 
 #include <iostream>
-#include <fstream>
-#include <string>
-#include <sstream>
-#include <libgen.h>
-
-#include "NonLLVMMisc.hh"
+#include <stdexcept>
+#include <stdint.h>
 
 Symvers::Symvers(const std::string &path)
-    : Parser(path)
+    : Parser(path),
+      File(),
+      Modules(),
+      Map()
 {
   Parse();
 }
 
-void Symvers::Parse()
+Symvers::~Symvers(void)
 {
-  std::string line;
-  std::ifstream f;
-  f.open(parser_path);
+}
 
-  if (!f.is_open())
+void Symvers::Parse()
+{
+  try {
+    File = std::make_unique<MappedFile>(parser_path.c_str());
+  } catch (std::runtime_error &) {
     throw std::runtime_error("File not found: " + parser_path);
+  }
+
+  std::string_view text = File->View();
+
+  /* There is a symbol per line.  */
+  Map.reserve(std::count(text.begin(), text.end(), '\n') + 1);
 
   /* The Module.symvers file contains five fields separated by tabs:
    * https://www.kernel.org/doc/html/latest/kbuild/modules.html#symbols-from-the-kernel-vmlinux-modules
@@ -46,34 +54,54 @@ void Symvers::Parse()
    * Any of these can be empty, namespace for example. At this point we only
    * care for the Symbol name and the module associates with it.
    */
-  while (f.good()) {
-    std::getline(f, line);
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string_view::npos) {
+      end = text.size();
+    }
 
-    /* Should be the last line */
-    if (line.empty())
-      continue;
+    std::string_view line = text.substr(pos, end - pos);
+    pos = end + 1;
 
-    std::string temp;
-    std::string sym_name;
-    std::string sym_mod;
+    // Discard the CRC, then get the symbol and module
+    size_t name_start = line.find('\t');
+    if (name_start == std::string_view::npos) {
+      continue;
+    }
+    name_start++;
 
-    std::stringstream ss(line);
+    size_t name_end = std::min(line.find('\t', name_start), line.size());
+    std::string_view sym_name = line.substr(name_start, name_end - name_start);
+    if (sym_name.empty()) {
+      continue;
+    }
 
-    // Discard the CRC
-    std::getline(ss, temp, '\t');
-    // Get the symbol and module
-    std::getline(ss, sym_name, '\t');
-    std::getline(ss, sym_mod, '\t');
+    std::string_view sym_mod;
+    if (name_end < line.size()) {
+      size_t mod_end = std::min(line.find('\t', name_end + 1), line.size());
+      sym_mod = line.substr(name_end + 1, mod_end - name_end - 1);
+    }
 
     // Only get the name of the module, instead of the path to it
-    Symbol sym(sym_name, get_basename(sym_mod.data()));
-    Insert_Symbols_Into_Hash(sym);
+    size_t slash = sym_mod.rfind('/');
+    if (slash != std::string_view::npos) {
+      sym_mod.remove_prefix(slash + 1);
+    }
+
+    uint32_t id = Modules.Intern(sym_mod);
+    if (id > UINT16_MAX) {
+      throw std::runtime_error("Too many modules in " + parser_path);
+    }
+
+    // Later lines replace earlier ones
+    Map[sym_name] = id;
   }
 }
 
 void Symvers::Dump(void)
 {
   std::cout << "Symbol\tModule" << std::endl;
-  for (auto &p : map)
-    std::cout << p.first << "\t" << p.second << std::endl;
+  for (auto &p : Map)
+    std::cout << p.first << "\t" << Modules.Get(p.second) << std::endl;
 }
@@ -30,102 +30,64 @@
 #pragma once
 
 #include "Parser.hh"
+#include "StringTable.hh"
 
-#include <cassert>
+#include <memory>
 #include <string>
-#include <iterator>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
-/** @brief Kernel symbol
-  *
-  * The symbol is question is always related to a module, or to vmlinux
-  */
-class Symbol
-{
-  public:
-  Symbol(const std::string &name, const std::string &mod)
-    : name(name),
-      mod(mod)
-  {
-    // Ensure that we have a Symbol name
-    assert(!name.empty());
-  }
-
-  std::string GetName()
-  {
-    return name;
-  }
-
-  const std::string &GetName() const
-  {
-    return name;
-  }
-
-  std::string GetModule()
-  {
-    return mod;
-  }
-
-  const std::string &GetModule() const
-  {
-    return mod;
-  }
-
-  private:
-  std::string name;
-  std::string mod;
-};
+class MappedFile;
 
 /** Symvers -- Parse and cache Module.symvers symbols content for fast access.
   *
-  * Cache the symbols and modules found for fast access.
+  * The file is mapped and the symbol names are kept as views into it.  Only a
+  * few hundred modules export the tens of thousands of symbols, so the module
+  * names are interned and each symbol maps to the 16-bit id of its module.
   **/
 class Symvers : public Parser
 {
   public:
   Symvers(const std::string &path);
+  ~Symvers(void);
 
   void Parse();
 
   /* Get symbol if available in the Symvers file.  Or 0 if not available.  */
-  inline bool Symbol_Exists(const std::string &sym)
+  inline bool Symbol_Exists(std::string_view sym)
   {
-    auto container = map.find(sym);
-    return container != map.end();
+    return Map.find(sym) != Map.end();
   }
 
   std::vector<std::string> Get_All_Symbols()
   {
     std::vector<std::string> vec;
+    vec.reserve(Map.size());
 
-    for (auto sym : map)
-      vec.push_back(sym.first);
+    for (auto &sym : Map)
+      vec.push_back(std::string(sym.first));
 
     return vec;
   }
 
-  /* Get symbol if available in the Symvers file.  Or 0 if not available.  */
-  std::string Get_Symbol_Module(const std::string &sym)
+  /* Get the module of the symbol, or an empty string if it is not in the
+     Symvers file.  The view lives as long as this object.  */
+  std::string_view Get_Symbol_Module(std::string_view sym)
   {
-    auto container = map.find(sym);
+    auto container = Map.find(sym);
     // Symbol not found
-    if (container == map.end())
+    if (container == Map.end())
       return {};
-    return container->second;
+    return Modules.Get(container->second);
   }
 
   // Externalize the symbols that are not part of vmlinux
-  bool Needs_Externalization(const std::string &sym_mod)
+  bool Needs_Externalization(std::string_view sym_mod)
   {
     return sym_mod != "vmlinux";
   }
 
-  /* Cache the symbols from a module.  */
-  inline void Insert_Symbols_Into_Hash(const Symbol &sym)
-  {
-    map[sym.GetName()] = sym.GetModule();
-  }
-
   /** Dump for debugging reasons.  */
   void Dump(void);
 
@@ -133,6 +95,12 @@ class Symvers : public Parser
   void Dump_Cache(void);
 
   private:
-  /** Hash symbols from symtab into their value.  */
-  std::unordered_map<std::string, std::string> map;
+  /** The mapped Module.symvers file, which the symbol names point into.  */
+  std::unique_ptr<MappedFile> File;
+
+  /** Names of the modules, without their paths.  */
+  StringTable Modules;
+
+  /** Hash symbols into the id of their module.  */
+  std::unordered_map<std::string_view, uint16_t> Map;
 };
@@ -19,17 +19,24 @@ TopLevelASTIterator::TopLevelASTIterator(ASTUnit *ast, bool skip_macros_in_decls
   : AST(ast),
     SM(AST->getSourceManager()),
     PrepRec(*AST->getPreprocessor().getPreprocessingRecord()),
-    DeclIt(AST->top_level_begin()),
-    MacroIt(PrepRec.begin()),
+    Order(SM),
+    DeclIt(0),
+    MacroIt(0),
     UndefIt(0),
     NeedsUndef({}),
-    BeforeClass(SM),
     MW(AST->getPreprocessor()),
     SkipMacrosInDecls(skip_macros_in_decls),
     Ended(false),
-    EndLocOfLastDecl(PrepRec.begin()->getSourceRange().getBegin())
+    CurrentKey(0),
+    EndKeyOfLastDecl(0)
 {
+  Populate_Entities();
   Populate_Needs_Undef();
+
+  if (!PrepKeys.empty()) {
+    EndKeyOfLastDecl = PrepKeys[0];
+  }
+
   Advance();
 }
 
@@ -56,11 +63,24 @@ SourceLocation TopLevelASTIterator::Return::Get_Location(void)
   __builtin_unreachable();
 }
 
-void TopLevelASTIterator::Populate_Needs_Undef(void)
+void TopLevelASTIterator::Populate_Entities(void)
 {
-  PreprocessingRecord *rec = AST->getPreprocessor().getPreprocessingRecord();
+  for (auto it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
+    Decl *decl = *it;
+    Decls.push_back(decl);
+    DeclKeys.push_back(Get_Order_Key(decl->getLocation()));
+    DeclEndKeys.push_back(Get_Order_Key(decl->getEndLoc()));
+  }
 
-  for (PreprocessedEntity *entity : *rec) {
+  for (PreprocessedEntity *entity : PrepRec) {
+    Entities.push_back(entity);
+    PrepKeys.push_back(Get_Order_Key(entity->getSourceRange().getBegin()));
+  }
+}
+
+void TopLevelASTIterator::Populate_Needs_Undef(void)
+{
+  for (PreprocessedEntity *entity : Entities) {
     if (MacroDefinitionRecord *def = dyn_cast<MacroDefinitionRecord>(entity)) {
 
       MacroDirective *directive = MW.Get_Macro_Directive(def);
@@ -81,94 +101,60 @@ void TopLevelASTIterator::Populate_Needs_Undef(void)
   }
 
   /* Sort macros by location where they should be undefined.  */
-  class CompareMacroUndefLoc
-  {
-    public:
-    CompareMacroUndefLoc(BeforeThanCompare<SourceLocation> &beforeclass)
-      : BeforeClassRef(beforeclass)
-    { }
-
-    bool operator()(const MacroDirective *a, const MacroDirective *b)
-    {
-      return BeforeClassRef(a->getDefinition().getUndefLocation(),
-                            b->getDefinition().getUndefLocation());
-    }
-
-    BeforeThanCompare<SourceLocation> &BeforeClassRef;
-  };
-  std::sort(NeedsUndef.begin(), NeedsUndef.end(), CompareMacroUndefLoc(BeforeClass));
+  std::vector<std::pair<uint64_t, MacroDirective *>> sorted;
+  for (MacroDirective *directive : NeedsUndef) {
+    SourceLocation undef_loc = directive->getDefinition().getUndefLocation();
+    sorted.push_back({Get_Order_Key(undef_loc), directive});
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<uint64_t, MacroDirective *> &a,
+                      const std::pair<uint64_t, MacroDirective *> &b) {
+                     return a.first < b.first;
+                   });
+
+  for (unsigned i = 0; i < sorted.size(); i++) {
+    NeedsUndef[i] = sorted[i].second;
+    UndefKeys.push_back(Get_Order_Key(NeedsUndef[i]->getLocation()));
+  }
 }
 
 bool TopLevelASTIterator::Advance(void)
 {
-  SourceManager &sm = AST->getSourceManager();
-  const SourceLocation &end = sm.getLocForEndOfFile(sm.getMainFileID());
+  /* Exhausted streams gets the largest possible key.  */
+  const uint64_t end = UINT64_MAX;
 
-#define NEXT_DECL_IF_EXISTS(DeclIt, end) ((DeclIt) != AST->top_level_end()) \
-                                         ? (*(DeclIt))->getLocation() \
-                                         : (end)
-#define NEXT_PREP_IF_EXISTS(MacroIt, end) ((MacroIt) != PrepRec.end()) \
-                                         ? (*(MacroIt))->getSourceRange().getBegin() \
-                                         : (end)
-#define NEXT_UNDEF_IF_EXISTS(UndefIt, end) (UndefIt < NeedsUndef.size()) \
-                                           ? (NeedsUndef)[UndefIt]->getLocation() \
-                                           : (end);
-
-  SourceLocation end_of_last_decl = EndLocOfLastDecl;
+  uint64_t end_of_last_decl = EndKeyOfLastDecl;
 
   do {
-    const SourceLocation &next_decl_loc = NEXT_DECL_IF_EXISTS(DeclIt, end);
-    const SourceLocation &next_prep_loc = NEXT_PREP_IF_EXISTS(MacroIt, end);
-    const SourceLocation &next_undef_loc = NEXT_UNDEF_IF_EXISTS(UndefIt, end);
-
-    // Find out what comes first.
-    std::vector<SourceLocation> vec = {
-      next_decl_loc,
-      next_prep_loc,
-      next_undef_loc,
-    };
-
-    class CompareLocWithAssertion
-    {
-      public:
-      CompareLocWithAssertion(BeforeThanCompare<SourceLocation> &beforeclass)
-        : BeforeClassRef(beforeclass)
-      { }
-
-      bool operator()(const SourceLocation &a, const SourceLocation &b)
-      {
-        assert(a.isValid());
-        assert(b.isValid());
-        return BeforeClassRef(a, b);
-      }
-
-      BeforeThanCompare<SourceLocation> &BeforeClassRef;
-    };
-
-    std::sort(vec.begin(), vec.end(), CompareLocWithAssertion(BeforeClass));
+    uint64_t next_decl_key = (DeclIt < DeclKeys.size()) ? DeclKeys[DeclIt] : end;
+    uint64_t next_prep_key = (MacroIt < PrepKeys.size()) ? PrepKeys[MacroIt] : end;
+    uint64_t next_undef_key = (UndefIt < UndefKeys.size()) ? UndefKeys[UndefIt] : end;
 
-    /* Check which comes next.  */
-    const SourceLocation &next = vec[0];
-    if (next == end) {
+    /* Check which comes next.  On ties, decls come first, then preprocessed
+       entities, then undefs.  */
+    if (next_decl_key == end && next_prep_key == end && next_undef_key == end) {
       /* We reached the end.  */
       Ended = true;
       return false;
     }
 
-    if (next == next_decl_loc) {
-      EndLocOfLastDecl = (*DeclIt)->getEndLoc();
-      Current = Return(*DeclIt);
+    if (next_decl_key <= next_prep_key && next_decl_key <= next_undef_key) {
+      EndKeyOfLastDecl = DeclEndKeys[DeclIt];
+      CurrentKey = next_decl_key;
+      Current = Return(Decls[DeclIt]);
       ++DeclIt;
 
-    } else if (next == next_prep_loc) {
-      Current = Return(*MacroIt);
+    } else if (next_prep_key <= next_undef_key) {
+      CurrentKey = next_prep_key;
+      Current = Return(Entities[MacroIt]);
       ++MacroIt;
     }
-    else if (next == next_undef_loc) {
+    else {
+      CurrentKey = next_undef_key;
       Current = Return(NeedsUndef[UndefIt]);
       ++UndefIt;
     }
-  } while (SkipMacrosInDecls && Is_Before(Current.Get_Location(), end_of_last_decl));
+  } while (SkipMacrosInDecls && CurrentKey < end_of_last_decl);
 
   return true;
 }
@@ -176,10 +162,9 @@ bool TopLevelASTIterator::Advance(void)
 bool TopLevelASTIterator::Skip_Until(const SourceLocation &loc)
 {
   bool valid = Current.Type != ReturnType::TYPE_INVALID;
-  SourceLocation current = Current.Get_Location();
-  while (valid && Is_Before(current, loc)) {
+  uint64_t key = Get_Order_Key(loc);
+  while (valid && CurrentKey < key) {
     valid = Advance();
-    current = Current.Get_Location();
   }
 
   return valid;
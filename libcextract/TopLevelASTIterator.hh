@@ -16,9 +16,11 @@
 #pragma once
 
 #include "MacroWalker.hh"
+#include "TranslationUnitOrder.hh"
 #include "clang/Frontend/ASTUnit.h"
 
 #include <vector>
+#include <cstdint>
 
 using namespace clang;
 
@@ -81,6 +83,14 @@ class TopLevelASTIterator
   bool Advance(void);
   bool Skip_Until(const SourceLocation &loc);
 
+  /** Get a key which orders the location in the translation unit.  If location
+      `a` comes before location `b` in the TU, then Get_Order_Key(a) <
+      Get_Order_Key(b).  */
+  inline uint64_t Get_Order_Key(const SourceLocation &loc)
+  {
+    return Order.Get_Key(loc);
+  }
+
   inline bool Is_Current_A_Decl()
   {
     return Current.Type == ReturnType::TYPE_DECL;
@@ -120,43 +130,42 @@ class TopLevelASTIterator
   }
 
   private:
+  void Populate_Entities(void);
   void Populate_Needs_Undef(void);
 
   ASTUnit *AST;
   SourceManager &SM;
   PreprocessingRecord &PrepRec;
 
-  /* AST iterator.  */
-  ASTUnit::top_level_iterator DeclIt;
+  /* Order key of each entity in the streams, plus the key of the end
+     location of each toplevel decl.  */
+  std::vector<uint64_t> DeclKeys;
+  std::vector<uint64_t> DeclEndKeys;
+  std::vector<uint64_t> PrepKeys;
+  std::vector<uint64_t> UndefKeys;
 
-  /* Macro Iterators.  */
-  PreprocessingRecord::iterator MacroIt;
+  /* Toplevel decls and preprocessed entities, in TU order.  */
+  std::vector<Decl*> Decls;
+  std::vector<PreprocessedEntity*> Entities;
+
+  /* Stream positions.  */
+  unsigned DeclIt;
+  unsigned MacroIt;
   unsigned UndefIt;
 
   /* Vector of macros that needs to be undeclared.  */
   std::vector<MacroDirective*> NeedsUndef;
 
-  /* Comparator for SourceLocations.  */
-  BeforeThanCompare<SourceLocation> BeforeClass;
-  inline bool Is_Before(const SourceLocation &a, const SourceLocation &b)
-  {
-    assert(a.isValid());
-    assert(b.isValid());
-    return BeforeClass(a, b);
-  }
-
-  inline bool Is_After(const SourceLocation &a, const SourceLocation &b)
-  {
-    assert(a.isValid());
-    assert(b.isValid());
-    return BeforeClass(b, a);
-  }
+  /* Order of locations in the TU, so comparing two locations is comparing
+     two integers.  */
+  TranslationUnitOrder Order;
 
   MacroWalker MW;
 
   bool SkipMacrosInDecls;
   bool Ended;
-  SourceLocation EndLocOfLastDecl;
+  uint64_t CurrentKey;
+  uint64_t EndKeyOfLastDecl;
 
   public:
   void Debug_Print(void);
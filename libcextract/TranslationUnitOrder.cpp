@@ -0,0 +1,288 @@
+//===- TranslationUnitOrder.cpp - Order locations in the TU with integers *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Order locations in the translation unit with integer keys.
+//
+//===----------------------------------------------------------------------===//
+
+#include "TranslationUnitOrder.hh"
+
+#include <algorithm>
+
+TranslationUnitOrder::TranslationUnitOrder(SourceManager &sm)
+  : SM(sm),
+    NumLocal(0)
+{
+  Build();
+}
+
+/** Linearize the include tree of the translation unit.
+ *
+ * Every SLocEntry that is a file gets a range of keys as large as the file
+ * itself plus everything included from it.  Files included in a file get a
+ * subrange right after the offset in which they were included, hence the key
+ * of a location is monotonically increasing in the order clang sees it.  This
+ * is what isBeforeInTranslationUnit computes by walking the include stack on
+ * every comparison, but here we do it only once.
+ *
+ * Files loaded from a PCH or a preamble are linearized as well.  Their root
+ * is included at the location they were imported, e.g. a preamble at the
+ * start of the main file.
+ */
+void TranslationUnitOrder::Build(void)
+{
+  NumLocal = SM.local_sloc_entry_size();
+  unsigned n = NumLocal + SM.loaded_sloc_entry_size();
+
+  std::vector<int> parent(n, -1);
+  std::vector<unsigned> include_offset(n, 0);
+  std::vector<bool> is_file(n, false);
+
+  FileOrder.resize(n, { 0, 0, {} });
+  int main_node = Get_Node(SM.getMainFileID());
+
+  /* Entry 0 is a dummy entry.  */
+  for (unsigned i = 1; i < n; i++) {
+    const SrcMgr::SLocEntry *entry;
+    if (i < NumLocal) {
+      entry = &SM.getLocalSLocEntry(i);
+      if (!entry->isFile())
+        continue;
+
+      unsigned next_offset = (i + 1 < NumLocal) ? SM.getLocalSLocEntry(i + 1).getOffset()
+                                                : SM.getNextLocalOffset();
+      FileOrder[i].ExpandedSize = next_offset - entry->getOffset();
+    } else {
+      bool invalid = false;
+      entry = &SM.getLoadedSLocEntry(i - NumLocal, &invalid);
+      if (invalid || !entry->isFile())
+        continue;
+
+      /* Loaded entries are not laid out in the order they were created, so
+         ask the size to the SourceManager.  */
+      FileID id = SM.getFileID(SourceLocation::getFromRawEncoding(entry->getOffset()));
+      FileOrder[i].ExpandedSize = SM.getFileIDSize(id) + 1;
+    }
+    is_file[i] = true;
+
+    SourceLocation include_loc = entry->getFile().getIncludeLoc();
+    if (include_loc.isValid()) {
+      std::pair<FileID, unsigned> decomposed =
+          SM.getDecomposedExpansionLoc(include_loc);
+      int p = Get_Node(decomposed.first);
+
+      if (p > 0 && (unsigned) p != i) {
+        parent[i] = p;
+        include_offset[i] = decomposed.second;
+      }
+    }
+  }
+
+  /* Loaded files are not created after the files they are included from, so
+     the tree is walked explicitly.  The children of a file are sorted by the
+     offset in which they were included.  */
+  std::vector<std::vector<unsigned>> children(n);
+  for (unsigned i = 1; i < n; i++) {
+    if (parent[i] >= 0) {
+      children[parent[i]].push_back(i);
+    }
+  }
+  for (std::vector<unsigned> &c : children) {
+    std::stable_sort(c.begin(), c.end(), [&](unsigned a, unsigned b) {
+      return include_offset[a] < include_offset[b];
+    });
+  }
+
+  /* Files without a parent (builtins, command line) come before the main
+     file, as isBeforeInTranslationUnit does.  */
+  std::vector<unsigned> roots;
+  for (unsigned i = 1; i < n; i++) {
+    if (is_file[i] && parent[i] < 0 && (int) i != main_node) {
+      roots.push_back(i);
+    }
+  }
+  if (main_node > 0) {
+    roots.push_back(main_node);
+  }
+
+  /* Parents come before their children in preorder, so walking it backwards
+     accumulates the size of every included file.  */
+  std::vector<unsigned> preorder;
+  std::vector<unsigned> stack(roots.rbegin(), roots.rend());
+  while (!stack.empty()) {
+    unsigned i = stack.back();
+    stack.pop_back();
+    preorder.push_back(i);
+    stack.insert(stack.end(), children[i].rbegin(), children[i].rend());
+  }
+
+  for (auto it = preorder.rbegin(); it != preorder.rend(); ++it) {
+    if (parent[*it] >= 0) {
+      FileOrder[parent[*it]].ExpandedSize += FileOrder[*it].ExpandedSize;
+    }
+  }
+
+  uint64_t next_root_key = 0;
+  for (unsigned i : roots) {
+    FileOrder[i].StartKey = next_root_key;
+    next_root_key += FileOrder[i].ExpandedSize;
+  }
+
+  /* Now propagate the keys to the included files.  */
+  for (unsigned i : preorder) {
+    if (parent[i] < 0)
+      continue;
+
+    FileOrderInfo &p = FileOrder[parent[i]];
+    uint64_t included_so_far = p.Includes.empty() ? 0 : p.Includes.back().second;
+
+    FileOrder[i].StartKey = p.StartKey + include_offset[i] + 1 + included_so_far;
+    p.Includes.push_back({include_offset[i],
+                          included_so_far + FileOrder[i].ExpandedSize});
+  }
+}
+
+int TranslationUnitOrder::Get_Node(FileID id) const
+{
+  /* Local FileIDs are positive, and loaded ones are -2 minus their index in
+     the loaded SLocEntry table.  */
+  int raw = (int) id.getHashValue();
+  if (raw > 0) {
+    return (unsigned) raw < NumLocal ? raw : -1;
+  }
+
+  if (raw < -1) {
+    unsigned node = NumLocal + (unsigned) (-raw - 2);
+    return node < FileOrder.size() ? (int) node : -1;
+  }
+
+  return -1;
+}
+
+uint64_t TranslationUnitOrder::Get_Key(const SourceLocation &loc) const
+{
+  if (loc.isInvalid()) {
+    return 0;
+  }
+
+  std::pair<FileID, unsigned> decomposed = SM.getDecomposedExpansionLoc(loc);
+  int id = Get_Node(decomposed.first);
+  unsigned offset = decomposed.second;
+
+  /* Should not happen, but do not index out of FileOrder if it does.  Such
+     locations are sorted with the builtins.  */
+  if (id <= 0) {
+    return 0;
+  }
+
+  const FileOrderInfo &info = FileOrder[id];
+
+  /* Find how much was included before this offset.  */
+  auto it = std::lower_bound(info.Includes.begin(), info.Includes.end(), offset,
+                             [](const std::pair<unsigned, uint64_t> &a,
+                                unsigned off) {
+                               return a.first < off;
+                             });
+  uint64_t included = (it == info.Includes.begin()) ? 0 : std::prev(it)->second;
+
+  return info.StartKey + offset + included;
+}
+
+TopLevelDeclIndex::TopLevelDeclIndex(ASTUnit *ast)
+  : AST(ast)
+{
+}
+
+void TopLevelDeclIndex::Build(void)
+{
+  Order.reset(new TranslationUnitOrder(AST->getSourceManager()));
+
+  for (auto it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
+    Decl *decl = *it;
+    Decls.push_back(decl);
+    Ranges.push_back({Order->Get_Key(decl->getBeginLoc()),
+                      Order->Get_Key(decl->getEndLoc())});
+  }
+
+  /* Toplevel decls should already be in TU order, but the binary search
+     depends on it.  Keep decls with the same begin in their original order.  */
+  bool sorted = std::is_sorted(Ranges.begin(), Ranges.end(),
+                               [](const Range &a, const Range &b) {
+                                 return a.Begin < b.Begin;
+                               });
+  if (!sorted) {
+    std::vector<unsigned> perm(Decls.size());
+    for (unsigned i = 0; i < perm.size(); i++) {
+      perm[i] = i;
+    }
+    std::stable_sort(perm.begin(), perm.end(), [this](unsigned a, unsigned b) {
+      return Ranges[a].Begin < Ranges[b].Begin;
+    });
+
+    std::vector<Range> ranges(perm.size());
+    std::vector<Decl *> decls(perm.size());
+    for (unsigned i = 0; i < perm.size(); i++) {
+      ranges[i] = Ranges[perm[i]];
+      decls[i] = Decls[perm[i]];
+    }
+    Ranges = std::move(ranges);
+    Decls = std::move(decls);
+  }
+}
+
+Decl *TopLevelDeclIndex::Get_Decl_At_Location(const SourceLocation &loc)
+{
+  if (!Order) {
+    Build();
+  }
+
+  uint64_t key = Order->Get_Key(loc);
+
+  /* Find the first decl that begins after loc.  Any decl that contains loc
+     begins before it.  */
+  auto it = std::upper_bound(Ranges.begin(), Ranges.end(), key,
+                             [](uint64_t k, const Range &r) {
+                               return k < r.Begin;
+                             });
+
+  if (it == Ranges.begin()) {
+    return nullptr;
+  }
+
+  /* Toplevel decls do not nest, but decls with the same begin may have
+     different ends, e.g. `struct S {...} s;`, so look at all of them.  */
+  uint64_t begin = std::prev(it)->Begin;
+  while (it != Ranges.begin() && std::prev(it)->Begin == begin) {
+    --it;
+    if (it->End >= key) {
+      return Decls[it - Ranges.begin()];
+    }
+  }
+
+  return nullptr;
+}
+
+ArrayRef<Decl *> TopLevelDeclIndex::Get_Decls_With_Same_Beginloc(const SourceLocation &loc)
+{
+  if (!Order) {
+    Build();
+  }
+
+  uint64_t key = Order->Get_Key(loc);
+
+  auto range = std::equal_range(Ranges.begin(), Ranges.end(), Range{key, key},
+                                [](const Range &a, const Range &b) {
+                                  return a.Begin < b.Begin;
+                                });
+
+  size_t first = range.first - Ranges.begin();
+  size_t count = range.second - range.first;
+
+  return ArrayRef<Decl *>(Decls.data() + first, count);
+}
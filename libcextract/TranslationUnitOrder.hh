@@ -0,0 +1,98 @@
+//===- TranslationUnitOrder.hh - Order locations in the TU with integers *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Order locations in the translation unit with integer keys.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "clang/Frontend/ASTUnit.h"
+
+#include <vector>
+#include <cstdint>
+
+using namespace clang;
+
+/** @brief Map source locations to integer keys in translation unit order.
+ *
+ * The include tree of the translation unit is linearized once, so comparing
+ * two locations becomes comparing two integers instead of walking the include
+ * stack as isBeforeInTranslationUnit does on every comparison.
+ */
+class TranslationUnitOrder
+{
+  public:
+  TranslationUnitOrder(SourceManager &sm);
+
+  /** Get a key which orders the location in the translation unit.  If location
+      `a` comes before location `b` in the TU, then Get_Key(a) < Get_Key(b).
+      Macro locations are mapped to the location where they were expanded.  */
+  uint64_t Get_Key(const SourceLocation &loc) const;
+
+  private:
+  void Build(void);
+
+  /** Get the index of `id` in FileOrder, or -1 if there is none.  */
+  int Get_Node(FileID id) const;
+
+  SourceManager &SM;
+
+  /* Number of local SLocEntries.  The loaded ones come after them in
+     FileOrder.  */
+  unsigned NumLocal;
+
+  /* For each FileID, the key of its first character and the offsets in
+     which other files were included together with the accumulated size of
+     every file included so far.  */
+  struct FileOrderInfo
+  {
+    uint64_t StartKey;
+    uint64_t ExpandedSize;
+    std::vector<std::pair<unsigned, uint64_t>> Includes;
+  };
+  std::vector<FileOrderInfo> FileOrder;
+};
+
+/** @brief Index of the toplevel decls of an AST by location.
+ *
+ * Holds the expanded begin and end keys of every toplevel decl in a flat
+ * array sorted in TU order, so looking for the decl at a given location is
+ * a binary search on integers.  The index is built on the first query and
+ * must not outlive the AST it was built from.
+ */
+class TopLevelDeclIndex
+{
+  public:
+  TopLevelDeclIndex(ASTUnit *ast);
+
+  /** Get the toplevel decl that contains the location loc.  */
+  Decl *Get_Decl_At_Location(const SourceLocation &loc);
+
+  /** Get the toplevel decls which expanded begin location is loc.  */
+  ArrayRef<Decl *> Get_Decls_With_Same_Beginloc(const SourceLocation &loc);
+
+  private:
+  void Build(void);
+
+  ASTUnit *AST;
+
+  /* Lazily built so passes that never query it pay nothing.  */
+  std::unique_ptr<TranslationUnitOrder> Order;
+
+  struct Range
+  {
+    uint64_t Begin;
+    uint64_t End;
+  };
+
+  /* Key ranges of the toplevel decls, parallel to Decls.  */
+  std::vector<Range> Ranges;
+  std::vector<Decl *> Decls;
+};
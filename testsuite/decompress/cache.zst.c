@@ -0,0 +1,16 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_DEBUGINFO_PATH=../testsuite/decompress/test.zst -DCE_DEBUGINFO_CACHE=$temp_file" } */
+/* { dg-run-twice } */
+int f(void)
+{
+	return 0;
+}
+
+int main(void)
+{
+	return f();
+}
+
+/* The first run writes the symbols of test.zst into the cache, and the
+   second one must use them without writing the cache again.  */
+
+/* { dg-final { scan-tree-dump "int f\(void\)" } } */
@@ -0,0 +1,13 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION" }*/
+
+#define A 1
+#include "order-1.h"
+#define C 3
+
+int f(void)
+{
+  return A + B + C + h.x;
+}
+
+/* { dg-final { scan-tree-dump "#define A 1\n+#define B 2\n+struct hdr { int x; };\n+#define MID 5\n+static struct hdr h = { MID };\n+#define C 3\n" } } */
+/* { dg-final { scan-tree-dump "return A \+ B \+ C \+ h.x;" } } */
@@ -0,0 +1,4 @@
+#define B 2
+struct hdr { int x; };
+#define MID 5
+static struct hdr h = { MID };
@@ -0,0 +1,18 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_EXPORT_SYMBOLS=g" }*/
+/* { dg-server }*/
+/* { dg-run-twice }*/
+
+#define A 1
+#include "server-1.h"
+#define C 3
+
+int f(void)
+{
+  return A + C + g(h.x);
+}
+
+/* { dg-final { scan-tree-dump "#define A 1\n+#define B 2\n+struct hdr { int x; };\n+#define MID 5\n+static struct hdr h = { MID };\n+" } } */
+/* { dg-final { scan-tree-dump "static int \(\*klpe_g\)\(int\) __attribute__\(\(used\)\);|__attribute__\(\(used\)\) static int \(\*klpe_g\)\(int\);" } } */
+/* { dg-final { scan-tree-dump "#define C 3\n+" } } */
+/* { dg-final { scan-tree-dump "return A \+ C \+ \(\*klpe_g\)\(h.x\);" } } */
+/* { dg-final { scan-tree-dump-not "return x \+ B;" } } */
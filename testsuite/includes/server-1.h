@@ -0,0 +1,9 @@
+#define B 2
+struct hdr { int x; };
+#define MID 5
+static struct hdr h = { MID };
+
+static int g(int x)
+{
+  return x + B;
+}
@@ -0,0 +1,32 @@
+/* { dg-compile "-fdump-ipa-clones -O3 -g3 -Wno-implicit-int"} */
+/* { dg-options "-batch"} */
+/* { dg-stdin "closure main" } */
+/* { dg-stdin "bogus main" } */
+/* { dg-stdin "   " } */
+/* { dg-stdin "where-is-inlined g" } */
+
+static inline int g(void)
+{
+  return 42;
+}
+
+static __attribute__((noinline)) h(void)
+{
+  return 43;
+}
+
+static int f()
+{
+  return g();
+}
+
+int main(void)
+{
+  return f() + h();
+}
+
+
+/* { dg-final { scan-tree-dump "(^|\n)g\n" } } */
+/* { dg-final { scan-tree-dump "ERROR: unknown query 'bogus'\n\n" } } */
+/* { dg-final { scan-tree-dump "ERROR: unknown query ''\n\n" } } */
+/* { dg-final { scan-tree-dump-not "(^|\n)h\n" } } */
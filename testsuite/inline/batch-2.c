@@ -0,0 +1,35 @@
+/* { dg-compile "-fdump-ipa-clones -O3 -g3 -Wno-implicit-int"} */
+/* { dg-options "-batch -json"} */
+/* { dg-stdin "{"id": 1, "query": "closure", "symbols": ["main"]}" } */
+/* { dg-stdin "{"id": "two", "query": "bogus", "symbols": []}" } */
+/* { dg-stdin "{"id": 3, "query": " } */
+/* { dg-stdin "not json" } */
+/* { dg-stdin "{"query": "closure", "symbols": ["main"]} trailing" } */
+
+static inline int g(void)
+{
+  return 42;
+}
+
+static __attribute__((noinline)) h(void)
+{
+  return 43;
+}
+
+static int f()
+{
+  return g();
+}
+
+int main(void)
+{
+  return f() + h();
+}
+
+
+/* { dg-final { scan-tree-dump "{\"id\": 1, \"result\": \[[^]]*\"g\"[^]]*\]}\n" } } */
+/* { dg-final { scan-tree-dump "{\"id\": \"two\", \"error\": \"unknown query 'bogus'\"}\n" } } */
+/* { dg-final { scan-tree-dump "{\"id\": 3, \"error\": \"expected '" } } */
+/* { dg-final { scan-tree-dump "{\"error\": \"expected '{' in query\"}\n" } } */
+/* { dg-final { scan-tree-dump "{\"error\": \"trailing characters after the query\"}\n" } } */
+/* { dg-final { scan-tree-dump-not "\"h\"" } } */
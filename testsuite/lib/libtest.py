@@ -4,6 +4,7 @@ import os
 import platform
 import pathlib
 import re
+import shutil
 import signal
 import subprocess
 import sys
@@ -22,7 +23,10 @@ BLUE   = '\033[34m'
 def cleanup_temp_files(files):
     for f in files:
         try:
-            os.remove(f)
+            if os.path.isdir(f):
+                shutil.rmtree(f)
+            else:
+                os.remove(f)
         except FileNotFoundError:
             pass
 
@@ -44,6 +48,7 @@ class UnitTest:
 
         self.test_path = test_path
         self.test_folder = self.extract_test_folder()
+        self.temp_file = '/tmp/' + next(tempfile._get_candidate_names())
         self.file = open(test_path, "r")
         self.file_content = self.file.read()
         self.lines = self.file_content.split('\n')
@@ -53,10 +58,15 @@ class UnitTest:
         self.must_not_have = self.extract_must_not_have()
         self.error_msgs = self.extract_error_msgs()
         self.warning_msgs = self.extract_warning_msgs()
+        self.note_msgs = self.extract_note_msgs()
+        self.run_twice = self.should_run_twice()
+        self.use_server = self.should_use_server()
         self.compile_options = self.extract_must_compile()
         self.skip_silently = self.should_skip_test_silently()
         self.no_debuginfo = self.without_debuginfo()
         self.no_ipa_clones = self.without_ipaclones()
+        self.use_index = self.with_index()
+        self.stdin = self.extract_stdin()
         self.skip_on_archs = self.should_skip_test_on_archs()
 
         self.binaries_path = binaries_path
@@ -68,15 +78,16 @@ class UnitTest:
         last_slash = self.test_path.rfind('/')
         return self.test_path[:last_slash]
 
-    # Given a string, expand all tokens we find. Currently only the `$test_dir`
-    # token.
+    # Given a string, expand all tokens we find. Currently the `$test_dir`
+    # and `$temp_file` tokens.
     def expand_tokens_in_string(self, string):
         x = string
         x = x.replace("$test_dir", self.test_folder)
+        x = x.replace("$temp_file", self.temp_file)
         return x
 
-    # Given a list of strings, expand all tokens we find. Currently only the `$test_dir`
-    # token.
+    # Given a list of strings, expand all tokens we find. Currently the `$test_dir`
+    # and `$temp_file` tokens.
     def expand_tokens_in_list(self, l):
         new_list = []
         for s in l:
@@ -130,6 +141,18 @@ class UnitTest:
                 matches.append(regex)
         return matches
 
+    # Extract note message.
+    def extract_note_msgs(self):
+        p = re.compile('{ *dg-note *"(.*)" *}')
+
+        matches = []
+        for line in self.lines:
+            matched = re.search(p, line)
+            if matched is not None:
+                regex = "note: .*" + matched.group(1)
+                matches.append(regex)
+        return matches
+
     # Extract rules that must NOT be in the clang-extract output.
     def extract_must_not_have(self):
         p = re.compile('{ *dg-final *{ *scan-tree-dump-not *"(.*)" *} *}')
@@ -180,6 +203,71 @@ class UnitTest:
 
         return False
 
+    # Flag that the tool must run twice with the same options, e.g. to check
+    # that the second run reuses what the first one left in `$temp_file`.
+    # Only the second run is checked.
+    def should_run_twice(self):
+        p = re.compile('{ *dg-run-twice *}')
+        matched = re.search(p, self.file_content)
+        if matched is not None:
+            return True
+
+        return False
+
+    # Get the modification time of `$temp_file`, or of the files in it if it
+    # is a directory.  Empty if there is no such file.
+    def get_temp_file_times(self):
+        if os.path.isdir(self.temp_file):
+            paths = [ os.path.join(self.temp_file, f)
+                      for f in sorted(os.listdir(self.temp_file)) ]
+        elif os.path.exists(self.temp_file):
+            paths = [ self.temp_file ]
+        else:
+            paths = []
+
+        return [ (path, os.stat(path).st_mtime_ns) for path in paths ]
+
+    # When the options use `$temp_file`, the first run must write it and the
+    # second run must only reuse it.  Returns False if that is not the case.
+    def check_temp_file_reused(self, first_times):
+        if self.temp_file not in ' '.join(self.options):
+            return True
+
+        if len(first_times) == 0:
+            self.log.print("First run did not write " + self.temp_file)
+            return False
+
+        if self.get_temp_file_times() != first_times:
+            self.log.print("Second run changed " + self.temp_file)
+            return False
+
+        return True
+
+    # Flag that the tool must run as requests to a server started with
+    # --serve, rather than on its own.
+    def should_use_server(self):
+        p = re.compile('{ *dg-server *}')
+        matched = re.search(p, self.file_content)
+        if matched is not None:
+            return True
+
+        return False
+
+    # Start a clang-extract server listening on `socket`, and wait for it to
+    # be ready, which it tells with a note once it is listening.
+    def start_server(self, clang_extract, socket):
+        server = subprocess.Popen([ clang_extract, '--serve', socket ],
+                                  stdout=subprocess.DEVNULL,
+                                  stderr=subprocess.PIPE)
+        line = server.stderr.readline().decode()
+        if "listening on" in line:
+            return server
+
+        server.kill()
+        server.wait()
+        print("Server did not start listening on " + socket + ": " + line)
+        exit(99)
+
     def without_debuginfo(self):
         p = re.compile('{ *dg-no-debuginfo *}')
         matched = re.search(p, self.file_content)
@@ -196,6 +284,47 @@ class UnitTest:
 
         return False
 
+    # Extract the lines given through dg-stdin, which are fed to the tool
+    # through stdin, e.g. the queries of the batch mode.  None if there is no
+    # dg-stdin.
+    def extract_stdin(self):
+        p = re.compile('{ *dg-stdin "(.*)" *}')
+
+        matches = []
+        for line in self.lines:
+            matched = re.search(p, line)
+            if matched is not None:
+                matches.append(self.expand_tokens_in_string(matched.group(1)) + '\n')
+
+        if len(matches) == 0:
+            return None
+
+        return ''.join(matches).encode()
+
+    # Flag that the ipa-clones must be given through an index built with
+    # -build-index rather than directly.
+    def with_index(self):
+        p = re.compile('{ *dg-use-index *}')
+        matched = re.search(p, self.file_content)
+        if matched is not None:
+            return True
+
+        return False
+
+    # Write an index of the ipa-clones at `ipa_path` into `$temp_file`.
+    def build_index(self, inline, ipa_path):
+        command = [ inline, '-build-index', ipa_path, '-o', self.temp_file ]
+        tool = subprocess.run(command, timeout=10, stderr=subprocess.STDOUT,
+                              stdout=subprocess.PIPE)
+
+        self.log.print("terminal output of -build-index:")
+        self.log.print(tool.stdout.decode())
+        if tool.returncode != 0:
+            print(tool.stdout.decode())
+            exit(99)
+
+        return self.temp_file
+
 
     def gcc_compile(self):
         # Do not compile if dg-compile wasn't specified.
@@ -294,6 +423,18 @@ class UnitTest:
                              self.warning_msgs) == False:
             return False
 
+        founds = [False] * len(self.note_msgs)
+
+        for i in range(len(self.note_msgs)):
+            p = self.note_msgs[i]
+            matched = re.search(p, terminal_output)
+            if matched is not None:
+                founds[i] = True
+
+        if self.check_founds(founds, "Note message not found: ",
+                             self.note_msgs) == False:
+            return False
+
         return True
 
 
@@ -363,11 +504,33 @@ class UnitTest:
                     self.test_path ]
         command.extend(self.options)
 
-        tool = subprocess.run(command, timeout=10, stderr=subprocess.STDOUT,
-                              stdout=subprocess.PIPE)
+        server = None
+        socket = self.temp_file + '.sock'
+        if self.use_server:
+            server = self.start_server(clang_extract, socket)
+            command[1:1] = [ '--connect', socket ]
 
-        r = self.check(tool, ce_output_path)
-        cleanup_temp_files([ce_output_path])
+        tool = subprocess.run(command, timeout=10, stderr=subprocess.STDOUT,
+                              stdout=subprocess.PIPE, input=self.stdin)
+        temp_file_reused = True
+        if self.run_twice:
+            self.log.print("terminal output of first run:")
+            self.log.print(tool.stdout.decode())
+            first_times = self.get_temp_file_times()
+            tool = subprocess.run(command, timeout=10, stderr=subprocess.STDOUT,
+                                  stdout=subprocess.PIPE, input=self.stdin)
+            temp_file_reused = self.check_temp_file_reused(first_times)
+
+        if server is not None:
+            server.terminate()
+            server.wait()
+
+        if temp_file_reused:
+            r = self.check(tool, ce_output_path)
+        else:
+            self.print_result(1)
+            r = 1
+        cleanup_temp_files([ce_output_path, self.temp_file, socket])
         return r
 
     def run_inline_test(self, lto_test=False):
@@ -390,15 +553,25 @@ class UnitTest:
                 if lto_test:
                     # Pass the directory with all ipa-clones rather than the
                     # path to the ipa-clone file.
-                    command.append(os.path.dirname(self.get_ipa_clones_path(elf)))
+                    ipa_path = os.path.dirname(self.get_ipa_clones_path(elf))
                 else:
-                    command.append(self.get_ipa_clones_path(elf))
+                    ipa_path = self.get_ipa_clones_path(elf)
+                if self.use_index:
+                    ipa_path = self.build_index(inline, ipa_path)
+                command.append(ipa_path)
 
         tool = subprocess.run(command, timeout=10, stderr=subprocess.STDOUT,
-                              stdout=subprocess.PIPE)
+                              stdout=subprocess.PIPE, input=self.stdin)
+
+        # The answers to the queries read from stdin are printed to stdout
+        # rather than to the output file, so check them instead.
+        if self.stdin is not None:
+            with open(ce_output_path, mode="wt", encoding="utf-8") as file:
+                file.write(tool.stdout.decode())
 
         r = self.check(tool, ce_output_path)
-        cleanup_temp_files((elf, self.get_ipa_clones_path(elf), ce_output_path))
+        cleanup_temp_files((elf, self.get_ipa_clones_path(elf), ce_output_path,
+                            self.temp_file))
         if lto_test == True:
             filelist = glob.glob('*.ipa-clones')
             cleanup_temp_files(filelist)
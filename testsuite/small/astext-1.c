@@ -0,0 +1,18 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=g -DCE_EXPORT_SYMBOLS=f,var -DCE_EXTERNALIZE_IN_AST" }*/
+
+static int var;
+
+static int f(int x)
+{
+  return x;
+}
+
+int g(int x)
+{
+  return f(x) + var;
+}
+
+/* { dg-final { scan-tree-dump "static int \(\*klpe_f\)\(int\) __attribute__\(\(used\)\);|__attribute__\(\(used\)\) static int \(\*klpe_f\)\(int\);" } } */
+/* { dg-final { scan-tree-dump "static int \*klpe_var __attribute__\(\(used\)\);|__attribute__\(\(used\)\) static int \*klpe_var" } } */
+/* { dg-final { scan-tree-dump "return \(\*klpe_f\)\(x\) \+ \(\*klpe_var\);" } } */
+/* { dg-final { scan-tree-dump-not "return x;" } } */
@@ -0,0 +1,14 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=g -DCE_RENAME_SYMBOLS -DCE_EXTERNALIZE_IN_AST" }*/
+
+struct AAA
+{
+  int a;
+};
+
+static int g(struct AAA *aa)
+{
+  return aa->a;
+}
+
+/* { dg-final { scan-tree-dump "int klpp_g\(struct AAA \*aa\)" } } */
+/* { dg-final { scan-tree-dump-not "static int klpp_g" } } */
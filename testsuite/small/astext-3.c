@@ -0,0 +1,22 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=g -DCE_EXPORT_SYMBOLS=f -DCE_EXTERNALIZE_IN_AST" }*/
+
+static int f(int x)
+{
+  return x;
+}
+
+int g(int x)
+{
+#ifdef NOT_DEFINED
+  if (x) {
+#else
+  if (x > 0) {
+#endif
+    return f(x) + 1;
+  }
+  return 0;
+}
+
+/* { dg-final { scan-tree-dump "static int \(\*klpe_f\)\(int\) __attribute__\(\(used\)\);|__attribute__\(\(used\)\) static int \(\*klpe_f\)\(int\);" } } */
+/* { dg-final { scan-tree-dump "return \(\*klpe_f\)\(x\) \+ 1;" } } */
+/* { dg-final { scan-tree-dump-not "return x;" } } */
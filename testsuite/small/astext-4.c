@@ -0,0 +1,12 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=g -DCE_EXPORT_SYMBOLS=var -DCE_LATE_EXTERNALIZE -DCE_EXTERNALIZE_IN_AST" }*/
+
+int var;
+
+/** Returns var.  */
+int g(void)
+{
+  return var;
+}
+
+/* { dg-final { scan-tree-dump "static int \*klpe_var __attribute__\(\(used\)\);\n+/\*\* Returns var.  \*/|__attribute__\(\(used\)\) static int \*klpe_var;\n+/\*\* Returns var.  \*/" } } */
+/* { dg-final { scan-tree-dump "return \(\*klpe_var\);" } } */
@@ -0,0 +1,16 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=g -DCE_EXPORT_SYMBOLS=f -DCE_EXTERNALIZE_IN_AST -DCE_FINGERPRINT=$temp_file" }*/
+/* { dg-run-twice }*/
+
+static int f(int x)
+{
+  return x;
+}
+
+int g(int x)
+{
+  return f(x);
+}
+
+/* { dg-note "Output is up to date with" } */
+/* { dg-final { scan-tree-dump "static int \(\*klpe_f\)\(int\) __attribute__\(\(used\)\);|__attribute__\(\(used\)\) static int \(\*klpe_f\)\(int\);" } } */
+/* { dg-final { scan-tree-dump "return \(\*klpe_f\)\(x\);" } } */
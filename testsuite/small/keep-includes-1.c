@@ -0,0 +1,20 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=g -DCE_EXPORT_SYMBOLS=f -DCE_KEEP_INCLUDES" }*/
+
+#include "keep-includes-1.h"
+
+int f(int x)
+{
+  return x;
+}
+
+int g(int x)
+{
+  return f(x) + 1;
+}
+
+/* call_f is not in the closure, but the header which has it is kept, so its
+   call to f must be externalized as well.  */
+
+/* { dg-final { scan-tree-dump "#include \"keep-includes-1.h\"" } } */
+/* { dg-final { scan-tree-dump "return \(\*klpe_f\)\(x\) \+ 1;" } } */
+/* { dg-final { scan-tree-dump-not "return x;" } } */
@@ -0,0 +1,6 @@
+int f(int x);
+
+static inline int call_f(int x)
+{
+  return f(x);
+}
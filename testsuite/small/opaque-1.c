@@ -0,0 +1,32 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_OPAQUE_TYPES" }*/
+
+#define BIG_LEN 4
+
+typedef int big_int;
+
+struct inner {
+  int x;
+};
+
+struct big {
+  struct inner in;
+  big_int arr[BIG_LEN];
+  int y;
+};
+
+struct small {
+  int z;
+};
+
+int f(struct big *b, struct small *s)
+{
+  return s->z + (b != 0);
+}
+
+/* { dg-final { scan-tree-dump "struct big;" } } */
+/* { dg-final { scan-tree-dump "int z;" } } */
+/* { dg-final { scan-tree-dump-not "struct big {" } } */
+/* { dg-final { scan-tree-dump-not "struct inner" } } */
+/* { dg-final { scan-tree-dump-not "int x;" } } */
+/* { dg-final { scan-tree-dump-not "big_int" } } */
+/* { dg-final { scan-tree-dump-not "BIG_LEN" } } */
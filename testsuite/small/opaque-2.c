@@ -0,0 +1,27 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_OPAQUE_TYPES" }*/
+
+typedef int dep_int;
+
+struct dep {
+  dep_int d;
+};
+
+struct ret {
+  struct dep dd;
+};
+
+struct ret h(void);
+
+int f(struct ret *r)
+{
+  /* The address of h does not require struct ret to be complete, but its
+     declaration is output, so the closure requires it after struct ret was
+     found only through a pointer.  */
+  return r != 0 && &h != 0;
+}
+
+/* { dg-final { scan-tree-dump "typedef int dep_int;" } } */
+/* { dg-final { scan-tree-dump "struct dep {\n *dep_int d;\n};" } } */
+/* { dg-final { scan-tree-dump "struct ret {\n *struct dep dd;\n};" } } */
+/* { dg-final { scan-tree-dump "struct ret h\(void\);" } } */
+/* { dg-final { scan-tree-dump-not "struct ret;" } } */
@@ -0,0 +1,17 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION" }*/
+
+#define X 1
+static int a = X;
+#undef X
+#define X 2
+struct S { int x; } s1, s2;
+int unused;
+
+int f(void)
+{
+  return a + X + s2.x;
+}
+
+/* { dg-final { scan-tree-dump "#define X 1\n+static int a = X;\n+#undef X\n+#define X 2\n+struct S { int x; } s1, s2;\n" } } */
+/* { dg-final { scan-tree-dump "return a \+ X \+ s2.x;" } } */
+/* { dg-final { scan-tree-dump-not "int unused;" } } */
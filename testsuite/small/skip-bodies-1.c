@@ -0,0 +1,38 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=g -DCE_SKIP_FUNCTION_BODIES" }*/
+
+struct used_by_h { int a; };
+struct used_by_f { int b; };
+struct used_by_k { int c; };
+
+static int h(void)
+{
+  struct used_by_h x = {1};
+  return x.a;
+}
+
+static inline int k(int x)
+{
+  struct used_by_k z = {x};
+  return z.c;
+}
+
+static inline int f(int x)
+{
+  struct used_by_f y = {k(x)};
+  return y.b;
+}
+
+int g(int x)
+{
+  return f(x) + 1;
+}
+
+/* { dg-final { scan-tree-dump "int g\(int x\)\n{\n  return f\(x\) \+ 1;\n}" } } */
+/* { dg-final { scan-tree-dump "static inline int f\(int x\)\n{" } } */
+/* { dg-final { scan-tree-dump "static inline int k\(int x\)\n{" } } */
+/* { dg-final { scan-tree-dump "struct used_by_f {" } } */
+/* { dg-final { scan-tree-dump "struct used_by_k {" } } */
+/* { dg-final { scan-tree-dump "return z.c;" } } */
+/* { dg-final { scan-tree-dump-not "struct used_by_h" } } */
+/* { dg-final { scan-tree-dump-not "return x.a;" } } */
+/* { dg-final { scan-tree-dump-not "int h\(void\)" } } */
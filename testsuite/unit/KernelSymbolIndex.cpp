@@ -0,0 +1,95 @@
+//===- KernelSymbolIndex.cpp - Unit tests of KernelSymbolIndex  --*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Check which definition of a symbol KernelSymbolIndex attributes to a
+/// module.
+//
+//===----------------------------------------------------------------------===//
+
+#include "KernelSymbolIndex.hh"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+static int Failures = 0;
+
+#define CHECK_EQ(a, b) \
+  do { \
+    std::string _a = (a), _b = (b); \
+    if (_a != _b) { \
+      std::cerr << __FILE__ << ':' << __LINE__ << ": expected \"" << _b \
+                << "\" but got \"" << _a << "\"\n"; \
+      Failures++; \
+    } \
+  } while (0)
+
+/* Compile `code` into the module `name`.ko of the tree at `dir`.  */
+static bool Build_Module(const std::string &dir, const char *name,
+                         const char *code)
+{
+  std::string source = dir + "/" + name + ".c";
+  std::ofstream(source) << code;
+
+  std::string command = "/usr/bin/gcc -c -o " + dir + "/" + name + ".ko "
+                        + source;
+  return system(command.c_str()) == 0;
+}
+
+/* Get the module where the definition of `sym` found for `module` is, or
+   "(null)" if there is none.  */
+static std::string Module_Of(const KernelSymbolIndex &index, const char *sym,
+                             const char *module)
+{
+  const KernelSymbolIndex::Definition *def = index.Find_Definition(sym, module);
+  if (def == nullptr) {
+    return "(null)";
+  }
+  return std::string(index.Get_Module_Name(def->Module));
+}
+
+int main(void)
+{
+  char dir_template[] = "/tmp/ce-ksi-XXXXXX";
+  const char *dir = mkdtemp(dir_template);
+  if (dir == nullptr) {
+    std::cerr << "Unable to create a temporary directory\n";
+    return 1;
+  }
+
+  bool built =
+    Build_Module(dir, "a",
+                 "static int local_in_both __attribute__((used)) = 1;\n"
+                 "int global_in_a = 2;\n")
+    && Build_Module(dir, "b",
+                    "static int local_in_b __attribute__((used)) = 3;\n"
+                    "static int local_in_both __attribute__((used)) = 4;\n");
+
+  if (built) {
+    std::string index_path = std::string(dir) + "/index";
+    KernelSymbolIndex::Build(dir, index_path.c_str());
+    KernelSymbolIndex index(index_path.c_str());
+
+    CHECK_EQ(Module_Of(index, "local_in_b", "b"), "b");
+    CHECK_EQ(Module_Of(index, "local_in_b", "a"), "(null)");
+    CHECK_EQ(Module_Of(index, "local_in_both", "a"), "a");
+    CHECK_EQ(Module_Of(index, "local_in_both", "b"), "b");
+    CHECK_EQ(Module_Of(index, "local_in_both", "vmlinux"), "(null)");
+    CHECK_EQ(Module_Of(index, "global_in_a", "b"), "a");
+    CHECK_EQ(Module_Of(index, "missing", "a"), "(null)");
+  } else {
+    std::cerr << "Unable to compile the modules\n";
+    Failures++;
+  }
+
+  system(("rm -rf " + std::string(dir)).c_str());
+
+  return Failures != 0;
+}
@@ -0,0 +1,129 @@
+//===- SourceScanner.cpp - Unit tests of SourceScanner          --*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Check the identifiers and directives found by SourceScanner.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SourceScanner.hh"
+#include "LLVMMisc.hh"
+
+#include <string>
+
+static int Failures = 0;
+
+#define CHECK_EQ(a, b) \
+  do { \
+    std::string _a = (a), _b = (b); \
+    if (_a != _b) { \
+      llvm::errs() << __FILE__ << ':' << __LINE__ << ": expected \"" << _b \
+                   << "\" but got \"" << _a << "\"\n"; \
+      Failures++; \
+    } \
+  } while (0)
+
+/* Get the directives of `text` as "name@offset" separated by spaces.  */
+static std::string Directives(std::string_view text)
+{
+  SourceScanner scanner(text);
+  std::string_view name;
+  size_t offset;
+  std::string ret;
+
+  while (scanner.Next_Directive(name, offset)) {
+    if (!ret.empty()) {
+      ret += ' ';
+    }
+    ret += std::string(name) + '@' + std::to_string(offset);
+  }
+
+  return ret;
+}
+
+/* Get the identifiers of `text` separated by spaces.  */
+static std::string Identifiers(std::string_view text)
+{
+  SourceScanner scanner(text);
+  std::string_view id;
+  size_t offset;
+  std::string ret;
+
+  while (scanner.Next_Identifier(id, offset)) {
+    if (!ret.empty()) {
+      ret += ' ';
+    }
+    ret += std::string(id);
+  }
+
+  return ret;
+}
+
+static void Test_Directives(void)
+{
+  CHECK_EQ(Directives("#ifdef X\n#endif\n"), "ifdef@0 endif@9");
+  CHECK_EQ(Directives("#  ifdef X\n\t#\tendif\n"), "ifdef@0 endif@12");
+  CHECK_EQ(Directives("#\n"), "");
+  CHECK_EQ(Directives("a#if"), "");
+}
+
+static void Test_Token_Pasting(void)
+{
+  CHECK_EQ(Directives("#define CAT(a, b) a##b\n"), "define@0");
+  CHECK_EQ(Directives("#define CAT(a, b) a ## b\n"), "define@0");
+  CHECK_EQ(Directives("#define F(x) x##ifdef\n"), "define@0");
+  CHECK_EQ(Directives("#define F(x) x ##ifdef\n"), "define@0");
+  CHECK_EQ(Directives("#define F(x) x## endif\n"), "define@0");
+  CHECK_EQ(Directives("##if"), "");
+}
+
+static void Test_Literals_And_Comments(void)
+{
+  CHECK_EQ(Directives("char *s = \"#if\";\n#endif\n"), "endif@17");
+  CHECK_EQ(Directives("char c = '#';\n"), "");
+  CHECK_EQ(Directives("char *s = \"\\\"#if\";\n"), "");
+  CHECK_EQ(Directives("/* #if */ // #ifdef\n#else\n"), "else@20");
+  CHECK_EQ(Directives("a / b; #if\n"), "if@7");
+
+  CHECK_EQ(Identifiers("f(\"str id\", 'c') /* cmt */ + g // h\n"), "f g");
+  CHECK_EQ(Identifiers("__x1 $y _\xc3\xa9"), "__x1 $y _\xc3\xa9");
+}
+
+/* Text crossing the 32 bytes blocks of the vectorized classifier.  */
+static void Test_Blocks(void)
+{
+  std::string text(40, ' ');
+  text += "#ifdef LONG_IDENTIFIER_CROSSING_THE_BLOCK_BOUNDARY\n";
+  text += std::string(30, ' ') + "/*" + std::string(40, '#') + "*/#endif";
+
+  CHECK_EQ(Directives(text), "ifdef@40 endif@" + std::to_string(text.size() - 6));
+  CHECK_EQ(Identifiers(text), "ifdef LONG_IDENTIFIER_CROSSING_THE_BLOCK_BOUNDARY endif");
+}
+
+static void Test_Balanced_Ifdef(void)
+{
+  CHECK_EQ(Has_Balanced_Ifdef("#if A\n#  ifdef B\n#endif\n#endif\n") ? "true" : "false",
+           "true");
+  CHECK_EQ(Has_Balanced_Ifdef("#else\nstruct s {\n#endif\n") ? "true" : "false",
+           "false");
+  CHECK_EQ(Has_Balanced_Ifdef("#define F(x) x##ifdef\n") ? "true" : "false",
+           "true");
+  CHECK_EQ(Has_Balanced_Ifdef("const char *s = \"#if\";\n") ? "true" : "false",
+           "true");
+}
+
+int main(void)
+{
+  Test_Directives();
+  Test_Token_Pasting();
+  Test_Literals_And_Comments();
+  Test_Blocks();
+  Test_Balanced_Ifdef();
+
+  return Failures != 0;
+}
@@ -0,0 +1,156 @@
+//===- TextModifications.cpp - Unit tests of TextModifications  --*- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Check how TextModifications solves overlapping deltas.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SymbolExternalizer.hh"
+
+#include <clang/Tooling/Tooling.h>
+
+using namespace llvm;
+using namespace clang;
+
+/* Offsets:      0   4   8   12  16  20  24  */
+static const char *Code = "int aaa; int bbb; int ccc;\n";
+
+static int Failures = 0;
+
+#define CHECK_EQ(a, b) \
+  do { \
+    std::string _a = (a), _b = (b); \
+    if (_a != _b) { \
+      llvm::errs() << __FILE__ << ':' << __LINE__ << ": expected \"" << _b \
+                   << "\" but got \"" << _a << "\"\n"; \
+      Failures++; \
+    } \
+  } while (0)
+
+static std::unique_ptr<ASTUnit> AST;
+
+static SourceLocation Loc(unsigned offset)
+{
+  SourceManager &sm = AST->getSourceManager();
+  return sm.getLocForStartOfFile(sm.getMainFileID()).getLocWithOffset(offset);
+}
+
+/* Issue a delta replacing the offsets [begin, end) of Code.  */
+static void Replace(TextModifications &tm, unsigned begin, unsigned end,
+                    const std::string &text, int prio)
+{
+  TextModifications::Delta delta(SourceRange(Loc(begin), Loc(end)), text, prio);
+  tm.Insert(delta);
+}
+
+static std::string Result(TextModifications &tm)
+{
+  tm.Commit();
+  FileID main = AST->getSourceManager().getMainFileID();
+  return tm.Get_Modified_Buffer(main, "input.c")->getBuffer().str();
+}
+
+/* Deltas which do not overlap are all applied.  */
+static void Test_Disjoint(void)
+{
+  TextModifications tm(AST.get());
+  Replace(tm, 22, 25, "z", 1);
+  Replace(tm, 4, 7, "x", 1);
+  CHECK_EQ(Result(tm), "int x; int bbb; int z;\n");
+}
+
+/* The delta with the highest priority wins, whatever the issue order.  */
+static void Test_Priority(void)
+{
+  TextModifications tm(AST.get());
+  Replace(tm, 13, 16, "y", 1);
+  Replace(tm, 9, 17, "", 10);
+  CHECK_EQ(Result(tm), "int aaa;  int ccc;\n");
+
+  TextModifications tm2(AST.get());
+  Replace(tm2, 9, 17, "", 10);
+  Replace(tm2, 13, 16, "y", 1);
+  CHECK_EQ(Result(tm2), "int aaa;  int ccc;\n");
+}
+
+/* On the same priority, the delta issued first wins.  */
+static void Test_Same_Priority(void)
+{
+  TextModifications tm(AST.get());
+  Replace(tm, 4, 7, "p", 1);
+  Replace(tm, 4, 8, "q", 1);
+  CHECK_EQ(Result(tm), "int p; int bbb; int ccc;\n");
+}
+
+/* Ranges which only touch are considered to overlap.  */
+static void Test_Adjacent(void)
+{
+  TextModifications tm(AST.get());
+  Replace(tm, 4, 7, "x", 2);
+  Replace(tm, 7, 8, ",", 1);
+  CHECK_EQ(Result(tm), "int x; int bbb; int ccc;\n");
+}
+
+/* The same change issued twice is applied once.  */
+static void Test_Duplicate(void)
+{
+  TextModifications tm(AST.get());
+  Replace(tm, 4, 7, "x", 1);
+  Replace(tm, 4, 7, "x", 1);
+  CHECK_EQ(Result(tm), "int x; int bbb; int ccc;\n");
+}
+
+/* Insertions are never discarded, go before a replacement at the same
+   offset, and keep the order they were issued.  */
+static void Test_Insertions(void)
+{
+  TextModifications tm(AST.get());
+  Replace(tm, 4, 7, "x", 1);
+  tm.Insert_Text(Loc(4), "A");
+  tm.Insert_Text(Loc(4), "B");
+  tm.Insert_Text(Loc(0), "static ");
+  CHECK_EQ(Result(tm), "static int ABx; int bbb; int ccc;\n");
+}
+
+/* The text of a range with the modifications applied.  */
+static void Test_Modified_Text(void)
+{
+  TextModifications tm(AST.get());
+  Replace(tm, 13, 16, "y", 1);
+  tm.Commit();
+
+  std::string text;
+  bool modified = tm.Get_Modified_Text(CharSourceRange::getCharRange(Loc(9), Loc(17)),
+                                       text);
+  CHECK_EQ(modified ? "true" : "false", "true");
+  CHECK_EQ(text, "int y;");
+
+  modified = tm.Get_Modified_Text(CharSourceRange::getCharRange(Loc(18), Loc(26)),
+                                  text);
+  CHECK_EQ(modified ? "true" : "false", "false");
+}
+
+int main(void)
+{
+  AST = tooling::buildASTFromCodeWithArgs(Code, {"-xc"}, "input.c");
+  if (!AST) {
+    llvm::errs() << "Unable to build the AST\n";
+    return 1;
+  }
+
+  Test_Disjoint();
+  Test_Priority();
+  Test_Same_Priority();
+  Test_Adjacent();
+  Test_Duplicate();
+  Test_Insertions();
+  Test_Modified_Text();
+
+  return Failures != 0;
+}